@@ -0,0 +1,374 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: config.c
+ * Purpose: server configuration module. Parses command line options into -
+            the global configuration
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "config.h"
+
+/* Option identifiers for long options without a short form */
+enum {
+    OPT_HEADER_TIMEOUT = 256,
+    OPT_WRITE_TIMEOUT,
+    OPT_MAX_CONNS_PER_IP,
+    OPT_QUEUE_LIMIT,
+    OPT_QUEUE_POLICY,
+    OPT_QUEUE_TARGET,
+    OPT_QUEUE_INTERVAL,
+    OPT_DRAIN_TIMEOUT,
+    OPT_NEGATIVE_TTL,
+    OPT_DIR_LISTING,
+    OPT_SEND_MODE,
+    OPT_MMAP_POPULATE,
+    OPT_BACKLOG,
+    OPT_DEFER_ACCEPT,
+    OPT_FASTOPEN,
+    OPT_SNDBUF,
+    OPT_RCVBUF,
+    OPT_NO_CORK,
+    OPT_LISTEN,
+    OPT_NO_HTTP2,
+    OPT_TLS_LISTEN,
+    OPT_TLS_CERT,
+    OPT_TLS_KEY,
+    OPT_PROXY,
+    OPT_FASTCGI,
+    OPT_FASTCGI_MATCH,
+    OPT_PLUGIN,
+    OPT_VHOST
+};
+
+server_config_t config = {
+    .num_listen = 0,
+    .tls_cert = NULL,
+    .tls_key = NULL,
+    .num_proxy = 0,
+    .fastcgi = NULL,
+    .num_fastcgi_match = 0,
+    .num_plugins = 0,
+    .num_vhosts = 0,
+    .webroot = NULL,
+    .header_timeout = DEFAULT_HEADER_TIMEOUT,
+    .write_timeout = DEFAULT_WRITE_TIMEOUT,
+    .max_conns_per_ip = DEFAULT_MAX_CONNS_PER_IP,
+    .queue_limit = DEFAULT_QUEUE_LIMIT,
+    .queue_policy = QUEUE_REJECT,
+    .queue_target = DEFAULT_QUEUE_TARGET,
+    .queue_interval = DEFAULT_QUEUE_INTERVAL,
+    .drain_timeout = DEFAULT_DRAIN_TIMEOUT,
+    .negative_ttl = DEFAULT_NEGATIVE_TTL,
+    .dir_listing = false,
+    .send_mode = SEND_SENDFILE,
+    .mmap_populate = false,
+    .backlog = DEFAULT_BACKLOG,
+    .defer_accept = DEFAULT_DEFER_ACCEPT,
+    .fastopen = DEFAULT_FASTOPEN,
+    .sndbuf = 0,
+    .rcvbuf = 0,
+    .cork = true,
+    .http2 = true
+};
+
+static const struct option long_options[] = {
+    {"header-timeout", required_argument, NULL, OPT_HEADER_TIMEOUT},
+    {"write-timeout", required_argument, NULL, OPT_WRITE_TIMEOUT},
+    {"max-conns-per-ip", required_argument, NULL, OPT_MAX_CONNS_PER_IP},
+    {"queue-limit", required_argument, NULL, OPT_QUEUE_LIMIT},
+    {"queue-policy", required_argument, NULL, OPT_QUEUE_POLICY},
+    {"queue-target", required_argument, NULL, OPT_QUEUE_TARGET},
+    {"queue-interval", required_argument, NULL, OPT_QUEUE_INTERVAL},
+    {"drain-timeout", required_argument, NULL, OPT_DRAIN_TIMEOUT},
+    {"negative-ttl", required_argument, NULL, OPT_NEGATIVE_TTL},
+    {"dir-listing", no_argument, NULL, OPT_DIR_LISTING},
+    {"send-mode", required_argument, NULL, OPT_SEND_MODE},
+    {"mmap-populate", no_argument, NULL, OPT_MMAP_POPULATE},
+    {"backlog", required_argument, NULL, OPT_BACKLOG},
+    {"defer-accept", required_argument, NULL, OPT_DEFER_ACCEPT},
+    {"fastopen", required_argument, NULL, OPT_FASTOPEN},
+    {"sndbuf", required_argument, NULL, OPT_SNDBUF},
+    {"rcvbuf", required_argument, NULL, OPT_RCVBUF},
+    {"no-cork", no_argument, NULL, OPT_NO_CORK},
+    {"listen", required_argument, NULL, OPT_LISTEN},
+    {"no-http2", no_argument, NULL, OPT_NO_HTTP2},
+    {"tls-listen", required_argument, NULL, OPT_TLS_LISTEN},
+    {"tls-cert", required_argument, NULL, OPT_TLS_CERT},
+    {"tls-key", required_argument, NULL, OPT_TLS_KEY},
+    {"proxy", required_argument, NULL, OPT_PROXY},
+    {"fastcgi", required_argument, NULL, OPT_FASTCGI},
+    {"fastcgi-match", required_argument, NULL, OPT_FASTCGI_MATCH},
+    {"plugin", required_argument, NULL, OPT_PLUGIN},
+    {"vhost", required_argument, NULL, OPT_VHOST},
+    {NULL, 0, NULL, 0}
+};
+
+/* Print usage and exit */
+static void usage(void) {
+    fprintf(stderr, "Usage: ./server [port number] [path to webroot] "
+                    "[options]\n"
+                    "  --header-timeout=MS    deadline for request header\n"
+                    "  --write-timeout=MS     deadline for writing response\n"
+                    "  --max-conns-per-ip=N   connections per address, "
+                    "0 for no limit\n"
+                    "  --queue-limit=N        task queue bound, "
+                    "0 for unbounded\n"
+                    "  --queue-policy=P       block, reject or drop-oldest "
+                    "when full\n"
+                    "  --queue-target=MS      queueing delay that triggers "
+                    "shedding, 0 disables\n"
+                    "  --queue-interval=MS    window the delay target is "
+                    "checked over\n"
+                    "  --drain-timeout=MS     time allowed to finish clients "
+                    "on shutdown\n"
+                    "  --negative-ttl=MS      time a missing path is "
+                    "remembered, 0 disables\n"
+                    "  --dir-listing          list directories without "
+                    "an index file\n"
+                    "  --send-mode=M          read, sendfile, mmap or splice "
+                    "for file bodies\n"
+                    "  --mmap-populate        prefault cached mappings of "
+                    "hot files\n"
+                    "  --backlog=N            listen backlog, 0 for "
+                    "somaxconn\n"
+                    "  --defer-accept=S       seconds to wait for request "
+                    "bytes before accept, 0 disables\n"
+                    "  --fastopen=N           TCP Fast Open queue, "
+                    "0 disables\n"
+                    "  --sndbuf=BYTES         client send buffer, "
+                    "0 for autotuning\n"
+                    "  --rcvbuf=BYTES         client receive buffer, "
+                    "0 for autotuning\n"
+                    "  --no-cork              don't cork clients while "
+                    "writing a response\n"
+                    "  --listen=ADDR          also listen on IPV4:PORT, "
+                    "[IPV6]:PORT, unix:/path\n"
+                    "                         or unix:@name, may be "
+                    "repeated\n"
+                    "  --no-http2             don't answer HTTP/2 prior "
+                    "knowledge or h2c upgrades\n"
+                    "  --tls-listen=ADDR      also listen for TLS on ADDR, "
+                    "may be repeated\n"
+                    "  --tls-cert=FILE        PEM certificate chain for TLS "
+                    "listeners\n"
+                    "  --tls-key=FILE         PEM private key for TLS "
+                    "listeners\n"
+                    "  --proxy=/PREFIX=ADDR   forward URIs under PREFIX to "
+                    "the HTTP server at ADDR,\n"
+                    "                         may be repeated\n"
+                    "  --fastcgi=ADDR         FastCGI application server, "
+                    "usually unix:/path\n"
+                    "  --fastcgi-match=M      send .ext or /prefix to the "
+                    "application server,\n"
+                    "                         may be repeated\n"
+                    "  --plugin=PATH[=ARG]    load a handler plugin, "
+                    "may be repeated\n"
+                    "  --vhost=NAME=PATH[,cache=N][,.EXT=TYPE]\n"
+                    "                         serve Host NAME from PATH, "
+                    "may be repeated\n");
+    exit(EXIT_FAILURE);
+}
+
+/* Convert a non negative integer option */
+/* Exits with usage on anything else */
+static int parse_number(const char *value) {
+    char *end = NULL;
+    long number;
+
+    number = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || number < 0) {
+        usage();
+    }
+
+    return (int)number;
+}
+
+/* Convert a queue policy name */
+static queue_policy_t parse_policy(const char *value) {
+    if (strcmp(value, "block") == 0) {
+        return QUEUE_BLOCK;
+    } else if (strcmp(value, "reject") == 0) {
+        return QUEUE_REJECT;
+    } else if (strcmp(value, "drop-oldest") == 0) {
+        return QUEUE_DROP_OLDEST;
+    }
+
+    usage();
+    return QUEUE_REJECT;
+}
+
+/* Convert a send mode name */
+static send_mode_t parse_send_mode(const char *value) {
+    if (strcmp(value, "read") == 0) {
+        return SEND_READ;
+    } else if (strcmp(value, "sendfile") == 0) {
+        return SEND_SENDFILE;
+    } else if (strcmp(value, "mmap") == 0) {
+        return SEND_MMAP;
+    } else if (strcmp(value, "splice") == 0) {
+        return SEND_SPLICE;
+    }
+
+    usage();
+    return SEND_SENDFILE;
+}
+
+/* Parse command line arguements */
+/* Positional port and webroot are required, everything else is optional */
+void parse_config(int argc, char *argv[]) {
+    int option;
+
+    /* Positional port is the first listener */
+    config.num_listen = 1;
+
+    while ((option = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (option) {
+        case OPT_HEADER_TIMEOUT:
+            config.header_timeout = parse_number(optarg);
+            break;
+        case OPT_WRITE_TIMEOUT:
+            config.write_timeout = parse_number(optarg);
+            break;
+        case OPT_MAX_CONNS_PER_IP:
+            config.max_conns_per_ip = parse_number(optarg);
+            break;
+        case OPT_QUEUE_LIMIT:
+            config.queue_limit = parse_number(optarg);
+            break;
+        case OPT_QUEUE_POLICY:
+            config.queue_policy = parse_policy(optarg);
+            break;
+        case OPT_QUEUE_TARGET:
+            config.queue_target = parse_number(optarg);
+            break;
+        case OPT_QUEUE_INTERVAL:
+            config.queue_interval = parse_number(optarg);
+            break;
+        case OPT_DRAIN_TIMEOUT:
+            config.drain_timeout = parse_number(optarg);
+            break;
+        case OPT_NEGATIVE_TTL:
+            config.negative_ttl = parse_number(optarg);
+            break;
+        case OPT_DIR_LISTING:
+            config.dir_listing = true;
+            break;
+        case OPT_SEND_MODE:
+            config.send_mode = parse_send_mode(optarg);
+            break;
+        case OPT_MMAP_POPULATE:
+            config.mmap_populate = true;
+            break;
+        case OPT_BACKLOG:
+            config.backlog = parse_number(optarg);
+            break;
+        case OPT_DEFER_ACCEPT:
+            config.defer_accept = parse_number(optarg);
+            break;
+        case OPT_FASTOPEN:
+            config.fastopen = parse_number(optarg);
+            break;
+        case OPT_SNDBUF:
+            config.sndbuf = parse_number(optarg);
+            break;
+        case OPT_RCVBUF:
+            config.rcvbuf = parse_number(optarg);
+            break;
+        case OPT_NO_CORK:
+            config.cork = false;
+            break;
+        case OPT_LISTEN:
+            if (config.num_listen == MAX_LISTENERS) {
+                usage();
+            }
+            config.listen[config.num_listen++] = optarg;
+            break;
+        case OPT_NO_HTTP2:
+            config.http2 = false;
+            break;
+        case OPT_TLS_LISTEN:
+            if (config.num_listen == MAX_LISTENERS) {
+                usage();
+            }
+            config.listen_tls[config.num_listen] = true;
+            config.listen[config.num_listen++] = optarg;
+            break;
+        case OPT_TLS_CERT:
+            config.tls_cert = optarg;
+            break;
+        case OPT_TLS_KEY:
+            config.tls_key = optarg;
+            break;
+        case OPT_PROXY:
+            if (config.num_proxy == MAX_PROXY_ROUTES) {
+                usage();
+            }
+            config.proxy[config.num_proxy++] = optarg;
+            break;
+        case OPT_FASTCGI:
+            config.fastcgi = optarg;
+            break;
+        case OPT_FASTCGI_MATCH:
+            if (config.num_fastcgi_match == FASTCGI_MAX_MATCHES) {
+                usage();
+            }
+            config.fastcgi_match[config.num_fastcgi_match++] = optarg;
+            break;
+        case OPT_PLUGIN:
+            if (config.num_plugins == MAX_PLUGINS) {
+                usage();
+            }
+            config.plugins[config.num_plugins++] = optarg;
+            break;
+        case OPT_VHOST:
+            /* The positional webroot is the default host */
+            if (config.num_vhosts == MAX_VHOSTS - 1) {
+                usage();
+            }
+            config.vhosts[config.num_vhosts++] = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+
+    /* Check if enough command line arguements were given */
+    if (argc - optind != 2) {
+        usage();
+    }
+
+    /* TLS listeners need something to present, and nothing else uses it */
+    if ((config.tls_cert != NULL) != (config.tls_key != NULL)) {
+        usage();
+    }
+    for (int i = 0; i < config.num_listen; i++) {
+        if (config.listen_tls[i] && !config.tls_cert) {
+            usage();
+        }
+    }
+
+    /* Matches without a backend would have nowhere to go */
+    if (config.num_fastcgi_match > 0 && !config.fastcgi) {
+        usage();
+    }
+
+    /* HTTP/2 streams are only served from the webroot, they would go -
+       around every plugin, proxy route and FastCGI match */
+    if (config.http2 &&
+        (config.num_plugins > 0 || config.num_proxy > 0 || config.fastcgi)) {
+        fprintf(stderr, "HTTP/2 disabled, plugins, proxy routes and FastCGI "
+                        "only see HTTP/1.x requests\n");
+        config.http2 = false;
+    }
+
+    /* A bare port listens on both IPv6 and IPv4 */
+    config.listen[0] = argv[optind];
+    config.webroot = argv[optind + 1];
+
+    return;
+}
@@ -0,0 +1,134 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: config.h
+ * Purpose: server configuration header file. Defines the runtime options -
+            parsed from the command line
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+
+#include "threadpool.h"
+#include "sender.h"
+#include "listener.h"
+#include "proxy.h"
+#include "fastcgi.h"
+#include "plugin.h"
+#include "vhost.h"
+
+/* Default deadlines, in milliseconds */
+#define DEFAULT_HEADER_TIMEOUT 10000
+#define DEFAULT_WRITE_TIMEOUT 30000
+
+/* Default cap on concurrent connections from one source address, off, -
+   since clients behind one NAT or a local load test share an address */
+#define DEFAULT_MAX_CONNS_PER_IP 0
+
+/* Default task queue bound and delay target, in milliseconds */
+#define DEFAULT_QUEUE_LIMIT 1024
+#define DEFAULT_QUEUE_TARGET 20
+#define DEFAULT_QUEUE_INTERVAL 200
+
+/* Default time allowed for draining clients on shutdown, in milliseconds */
+#define DEFAULT_DRAIN_TIMEOUT 10000
+
+/* Default time a missing path is remembered, in milliseconds */
+#define DEFAULT_NEGATIVE_TTL 5000
+
+/* Default listener tuning, 0 backlog takes the kernel cap */
+#define DEFAULT_BACKLOG 0
+#define DEFAULT_DEFER_ACCEPT 5
+#define DEFAULT_FASTOPEN 256
+
+/* Server configuration, filled in once at startup */
+typedef struct {
+    char *webroot;
+
+    /* Addresses to listen on, the positional port comes first */
+    const char *listen[MAX_LISTENERS];
+    int num_listen;
+
+    /* Which of those terminate TLS, and the certificate they present */
+    bool listen_tls[MAX_LISTENERS];
+    const char *tls_cert;
+    const char *tls_key;
+
+    /* PREFIX=ADDR routes forwarded upstream */
+    const char *proxy[MAX_PROXY_ROUTES];
+    int num_proxy;
+
+    /* FastCGI application server, and the extensions and prefixes it -
+       serves */
+    const char *fastcgi;
+    const char *fastcgi_match[FASTCGI_MAX_MATCHES];
+    int num_fastcgi_match;
+
+    /* PATH[=ARG] handler plugins, offered requests in this order */
+    const char *plugins[MAX_PLUGINS];
+    int num_plugins;
+
+    /* NAME=PATH[,cache=N][,.EXT=TYPE] virtual hosts, besides the webroot */
+    const char *vhosts[MAX_VHOSTS - 1];
+    int num_vhosts;
+
+    /* Time allowed for a client to send its request header */
+    int header_timeout;
+
+    /* Time allowed for a response to be written out */
+    int write_timeout;
+
+    /* Concurrent connections allowed per source address, 0 for no limit */
+    int max_conns_per_ip;
+
+    /* Task queue bound, 0 for unbounded, and what to do when it is full */
+    int queue_limit;
+    queue_policy_t queue_policy;
+
+    /* Queueing delay that triggers shedding, 0 disables it */
+    int queue_target;
+    int queue_interval;
+
+    /* Time allowed for in flight and queued clients on shutdown */
+    int drain_timeout;
+
+    /* Time a missing path is remembered, 0 disables negative caching */
+    int negative_ttl;
+
+    /* Generate a listing for directories without an index file */
+    bool dir_listing;
+
+    /* How file bodies are sent, and whether cached mappings are -
+       prefaulted */
+    send_mode_t send_mode;
+    bool mmap_populate;
+
+    /* Listen backlog, 0 for the kernel cap */
+    int backlog;
+
+    /* Seconds accept() waits for request bytes, 0 disables */
+    int defer_accept;
+
+    /* TCP Fast Open queue length, 0 disables */
+    int fastopen;
+
+    /* Socket buffer sizes, 0 leaves the kernel autotuning them */
+    int sndbuf;
+    int rcvbuf;
+
+    /* Cork clients while a response is written */
+    bool cork;
+
+    /* Speak cleartext HTTP/2 to clients that ask for it */
+    bool http2;
+} server_config_t;
+
+/* Global configuration, read only after parse_config() */
+extern server_config_t config;
+
+/* Parse command line arguements into the global configuration */
+void parse_config(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,251 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: conn.c
+ * Purpose: connection module. Connections are allocated once and then -
+            recycled through a lock-free freelist, so accepting a client -
+            never touches malloc(). The freelist is a stack of indexes whose -
+            head carries a tag, bumped on every change, so a stale -
+            compare-and-swap can't succeed after the same index was popped -
+            and pushed back
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+
+#include "conn.h"
+#include "connlimit.h"
+#include "http.h"
+#include "tls.h"
+
+/* Index meaning the freelist is empty */
+#define FREELIST_EMPTY UINT32_MAX
+
+static struct {
+    connection_t **conns;
+    _Atomic uint32_t *next;
+    uint32_t capacity;
+
+    /* Tag in the top half, index of the first free connection below */
+    _Atomic uint64_t head;
+
+    /* Indexes never handed out yet */
+    atomic_uint fresh;
+} pool;
+
+/* Build a freelist head from a tag and an index */
+static uint64_t make_head(uint64_t tag, uint32_t index) {
+    return (tag << 32) | index;
+}
+
+/* Size the pool */
+void conn_pool_init(void) {
+    struct rlimit rlim;
+
+    /* Each connection holds a descriptor, more than that is never needed */
+    if (getrlimit(RLIMIT_NOFILE, &rlim) == ERROR) {
+        perror("Error: getrlimit() failed");
+        exit(EXIT_FAILURE);
+    }
+
+    pool.capacity = rlim.rlim_cur < CONN_POOL_MAX ? (uint32_t)rlim.rlim_cur :
+                                                    CONN_POOL_MAX;
+
+    pool.conns = calloc(pool.capacity, sizeof *pool.conns);
+    pool.next = calloc(pool.capacity, sizeof *pool.next);
+    if (!pool.conns || !pool.next) {
+        perror("Error: calloc() failed to allocate connection pool");
+        exit(EXIT_FAILURE);
+    }
+
+    atomic_init(&pool.head, make_head(0, FREELIST_EMPTY));
+    atomic_init(&pool.fresh, 0);
+
+    return;
+}
+
+/* Pop a free index, FREELIST_EMPTY if there is none */
+static uint32_t pop_free(void) {
+    uint64_t head = atomic_load(&pool.head), next;
+    uint32_t index;
+
+    do {
+        index = (uint32_t)head;
+        if (index == FREELIST_EMPTY) {
+            return FREELIST_EMPTY;
+        }
+
+        /* Objects are never freed, so reading a stale next is harmless, -
+           the tag makes the swap fail */
+        next = make_head((head >> 32) + 1, atomic_load(&pool.next[index]));
+    } while (!atomic_compare_exchange_weak(&pool.head, &head, next));
+
+    return index;
+}
+
+/* Push an index back on the freelist */
+static void push_free(uint32_t index) {
+    uint64_t head = atomic_load(&pool.head), next;
+
+    do {
+        atomic_store(&pool.next[index], (uint32_t)head);
+        next = make_head((head >> 32) + 1, index);
+    } while (!atomic_compare_exchange_weak(&pool.head, &head, next));
+}
+
+/* Take a connection */
+connection_t *conn_get(int fd, const struct sockaddr *peer,
+                       socklen_t peer_length) {
+    connection_t *conn = NULL;
+    uint32_t index;
+
+    index = pop_free();
+
+    /* Nothing recycled yet, allocate the next fresh connection */
+    if (index == FREELIST_EMPTY) {
+        index = atomic_fetch_add(&pool.fresh, 1);
+        if (index >= pool.capacity) {
+            atomic_fetch_sub(&pool.fresh, 1);
+            return NULL;
+        }
+
+        pool.conns[index] = aligned_alloc(CACHE_LINE_SIZE,
+                                          sizeof *pool.conns[index]);
+        if (!pool.conns[index]) {
+            perror("Error: aligned_alloc() failed to allocate connection");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    conn = pool.conns[index];
+    conn->index = index;
+    conn->fd = fd;
+    conn->accepted = timer_now_ms();
+    conn->enqueued = 0;
+    conn->length = 0;
+    conn->buffer[0] = '\0';
+    memset(&conn->timer, '\0', sizeof conn->timer);
+    conn->handshake_pending = false;
+    conn->relayed = false;
+    conn->tls = NULL;
+    conn->h2 = NULL;
+
+    if (peer_length > sizeof conn->peer) {
+        peer_length = sizeof conn->peer;
+    }
+    memcpy(&conn->peer, peer, peer_length);
+    conn->peer_length = peer_length;
+
+    return conn;
+}
+
+/* Close and recycle a connection */
+void conn_close(connection_t *conn) {
+    /* The descriptor can be reused by the acceptor as soon as it is -
+       closed, so its slot goes first */
+    connlimit_release(conn->fd);
+
+    /* Offloaded TLS says goodbye through the kernel before closing */
+    if (conn->tls) {
+        tls_close(conn);
+    }
+    close(conn->fd);
+
+    push_free(conn->index);
+
+    return;
+}
+
+/* Deadline expired */
+/* Shutting down both sides fails the worker's next read() or write() */
+void conn_expired(void *arg) {
+    connection_t *conn = arg;
+
+    shutdown(conn->fd, SHUT_RDWR);
+}
+
+/* Find where the body starts */
+const char *conn_body(const connection_t *conn) {
+    const char *end = strstr(conn->buffer, "\r\n\r\n");
+
+    if (end) {
+        return end + 4;
+    }
+
+    end = strstr(conn->buffer, "\n\n");
+
+    return end ? end + 2 : NULL;
+}
+
+/* Checks if a full request header has been buffered */
+bool conn_header_complete(const connection_t *conn) {
+    return conn_body(conn) != NULL;
+}
+
+/* Read available header bytes */
+header_status_t conn_read_header(connection_t *conn) {
+    size_t space;
+    ssize_t bytes_read;
+
+    while (!conn_header_complete(conn)) {
+        /* Leave room for the terminator */
+        space = sizeof conn->buffer - 1 - conn->length;
+        if (space == 0) {
+            break;
+        }
+
+        bytes_read = read(conn->fd, conn->buffer + conn->length, space);
+        if (bytes_read == ERROR && errno == EINTR) {
+            continue;
+        }
+
+        /* Rest of the header is still on its way */
+        if (bytes_read == ERROR && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return HEADER_PENDING;
+        }
+
+        if (bytes_read == ERROR) {
+            perror("Error: cannot read request");
+            return HEADER_CLOSED;
+        }
+
+        /* Client stopped sending, serve what it sent if anything */
+        if (bytes_read == 0) {
+            return conn->length > 0 ? HEADER_DONE : HEADER_CLOSED;
+        }
+
+        conn->length += (size_t)bytes_read;
+        conn->buffer[conn->length] = '\0';
+    }
+
+    return HEADER_DONE;
+}
+
+/* Format the client's address */
+bool conn_peer_address(const connection_t *conn, char *out, size_t size) {
+    const struct sockaddr_in6 *v6 = (const struct sockaddr_in6 *)&conn->peer;
+    const struct sockaddr_in *v4 = (const struct sockaddr_in *)&conn->peer;
+
+    if (conn->peer.ss_family == AF_INET) {
+        return inet_ntop(AF_INET, &v4->sin_addr, out, (socklen_t)size);
+    }
+
+    if (conn->peer.ss_family != AF_INET6) {
+        return false;
+    }
+
+    /* IPv4 clients of a dual-stack listener */
+    if (IN6_IS_ADDR_V4MAPPED(&v6->sin6_addr)) {
+        return inet_ntop(AF_INET, &v6->sin6_addr.s6_addr[12], out,
+                         (socklen_t)size);
+    }
+
+    return inet_ntop(AF_INET6, &v6->sin6_addr, out, (socklen_t)size);
+}
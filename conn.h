@@ -0,0 +1,97 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: conn.h
+ * Purpose: connection header file. Defines the pooled connection object -
+            that carries a client from accept() to close()
+ */
+
+#ifndef CONN_H
+#define CONN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "timer.h"
+
+/* Bytes of request header a connection can hold */
+#define CONN_BUFFER_SIZE 8192
+
+/* Most connections alive at once, also capped by RLIMIT_NOFILE */
+#define CONN_POOL_MAX 65536
+
+/* Connections are aligned so two never share a cache line */
+#define CACHE_LINE_SIZE 64
+
+/* One client connection */
+/* Fields touched on every hand over come first, in one cache line */
+typedef struct {
+    int fd;
+    uint32_t index;
+
+    /* Accept time in ms, and queue time in us for delay measurement */
+    uint64_t accepted;
+    uint64_t enqueued;
+
+    /* Request bytes buffered so far, buffer stays NUL terminated */
+    size_t length;
+
+    /* Header deadline while parked, write deadline while served */
+    timer_entry_t timer;
+
+    struct sockaddr_storage peer;
+    socklen_t peer_length;
+
+    /* Raw TLS until the handshake is done, then either the kernel -
+       handles records (tls kept for close) or the fd is relayed through -
+       a socketpair by the TLS module */
+    bool handshake_pending;
+    bool relayed;
+    struct ssl_st *tls;
+
+    /* HTTP/2 session of a connection parked between requests */
+    struct h2_session *h2;
+
+    char buffer[CONN_BUFFER_SIZE];
+} __attribute__((aligned(CACHE_LINE_SIZE))) connection_t;
+
+/* What reading a request header got up to */
+typedef enum {
+    HEADER_PENDING,
+    HEADER_DONE,
+    HEADER_CLOSED
+} header_status_t;
+
+/* Size the pool, connections are allocated on first use and recycled */
+void conn_pool_init(void);
+
+/* Take a connection for a freshly accepted client */
+/* Returns NULL once every connection is in use */
+connection_t *conn_get(int fd, const struct sockaddr *peer,
+                       socklen_t peer_length);
+
+/* Release the client's slot, close it and recycle the connection */
+void conn_close(connection_t *conn);
+
+/* Deadline callback, shuts the client down so blocked I/O on it fails */
+void conn_expired(void *arg);
+
+/* Format the client's address, IPv4 clients of a dual-stack listener -
+   as plain IPv4 */
+/* Returns false for unix socket clients, which have none */
+bool conn_peer_address(const connection_t *conn, char *out, size_t size);
+
+/* Read whatever header bytes have arrived, never blocks */
+/* Done means the header ended, the buffer filled or the client stopped -
+   sending after some bytes. Closed means nothing usable arrived */
+header_status_t conn_read_header(connection_t *conn);
+
+/* Checks if a full request header has been buffered */
+bool conn_header_complete(const connection_t *conn);
+
+/* Find where the body starts, just past the blank line ending the header */
+/* Returns NULL if the client stopped sending before the blank line */
+const char *conn_body(const connection_t *conn);
+
+#endif
@@ -0,0 +1,193 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: connlimit.c
+ * Purpose: connection limit module. Counts open connections per source -
+            address in a hash table, and remembers which address each -
+            client socket was counted against. IPv4 addresses are counted -
+            in their mapped IPv6 form, IPv6 ones per /64 since that is what -
+            a single host is usually given. Unix socket peers are local and -
+            never limited
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "connlimit.h"
+
+/* Open connection count for one address */
+typedef struct ip_entry {
+    struct in6_addr addr;
+    int count;
+    struct ip_entry *next;
+} ip_entry_t;
+
+/* What a client socket was counted against */
+typedef struct {
+    struct in6_addr addr;
+    bool tracked;
+} fd_slot_t;
+
+static struct {
+    pthread_mutex_t mutex;
+    ip_entry_t *buckets[CONNLIMIT_BUCKETS];
+    fd_slot_t *fds;
+    size_t num_fds;
+    int max_per_ip;
+} limit = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+/* Hash an address into a bucket */
+static size_t hash_addr(const struct in6_addr *addr) {
+    uint32_t words[4], hash = 0;
+
+    memcpy(words, addr->s6_addr, sizeof words);
+    for (size_t i = 0; i < 4; i++) {
+        hash = (hash ^ words[i]) * UINT32_C(2654435761);
+    }
+
+    return (hash >> 16) & (CONNLIMIT_BUCKETS - 1);
+}
+
+/* Work out the address a peer is counted against */
+/* Returns false for peers that are never limited */
+static bool limit_key(const struct sockaddr *peer, struct in6_addr *key) {
+    const struct sockaddr_in *v4 = NULL;
+
+    memset(key, '\0', sizeof *key);
+
+    switch (peer->sa_family) {
+    case AF_INET:
+        v4 = (const struct sockaddr_in *)peer;
+        key->s6_addr[10] = 0xff;
+        key->s6_addr[11] = 0xff;
+        memcpy(&key->s6_addr[12], &v4->sin_addr, sizeof v4->sin_addr);
+        return true;
+    case AF_INET6:
+        *key = ((const struct sockaddr_in6 *)peer)->sin6_addr;
+
+        /* Mapped IPv4 from a dual-stack listener is counted as IPv4 */
+        if (!IN6_IS_ADDR_V4MAPPED(key)) {
+            memset(&key->s6_addr[8], '\0', 8);
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Set up the address and socket tables */
+void connlimit_init(int max_per_ip) {
+    struct rlimit rlim;
+
+    limit.max_per_ip = max_per_ip;
+    if (max_per_ip == 0) {
+        return;
+    }
+
+    /* One slot per possible descriptor */
+    if (getrlimit(RLIMIT_NOFILE, &rlim) == -1) {
+        perror("Error: getrlimit() failed");
+        exit(EXIT_FAILURE);
+    }
+
+    limit.num_fds = (size_t)rlim.rlim_cur;
+    limit.fds = calloc(limit.num_fds, sizeof *limit.fds);
+    if (!limit.fds) {
+        perror("Error: calloc() failed to allocate descriptor table");
+        exit(EXIT_FAILURE);
+    }
+
+    return;
+}
+
+/* Account a client against its address */
+bool connlimit_acquire(int client, const struct sockaddr *peer) {
+    ip_entry_t *entry = NULL;
+    struct in6_addr key;
+    size_t bucket;
+    bool allowed = true;
+
+    if (limit.max_per_ip == 0 || (size_t)client >= limit.num_fds ||
+        !limit_key(peer, &key)) {
+        return true;
+    }
+
+    bucket = hash_addr(&key);
+
+    /* Critical section */
+    pthread_mutex_lock(&limit.mutex);
+
+    for (entry = limit.buckets[bucket]; entry; entry = entry->next) {
+        if (IN6_ARE_ADDR_EQUAL(&entry->addr, &key)) {
+            break;
+        }
+    }
+
+    /* First connection from this address */
+    if (!entry) {
+        entry = malloc(sizeof *entry);
+        if (!entry) {
+            perror("Error: malloc() failed to allocate address entry");
+            exit(EXIT_FAILURE);
+        }
+
+        entry->addr = key;
+        entry->count = 0;
+        entry->next = limit.buckets[bucket];
+        limit.buckets[bucket] = entry;
+    }
+
+    if (entry->count >= limit.max_per_ip) {
+        allowed = false;
+    } else {
+        entry->count++;
+        limit.fds[client].addr = entry->addr;
+        limit.fds[client].tracked = true;
+    }
+
+    pthread_mutex_unlock(&limit.mutex);
+
+    return allowed;
+}
+
+/* Release a client socket */
+void connlimit_release(int client) {
+    ip_entry_t *entry = NULL, **link = NULL;
+    struct in6_addr addr;
+
+    if (limit.max_per_ip == 0 || (size_t)client >= limit.num_fds) {
+        return;
+    }
+
+    /* Critical section */
+    pthread_mutex_lock(&limit.mutex);
+
+    if (!limit.fds[client].tracked) {
+        pthread_mutex_unlock(&limit.mutex);
+        return;
+    }
+
+    addr = limit.fds[client].addr;
+    limit.fds[client].tracked = false;
+
+    /* Drop the count, and the entry once the address has gone quiet */
+    link = &limit.buckets[hash_addr(&addr)];
+    while ((entry = *link)) {
+        if (IN6_ARE_ADDR_EQUAL(&entry->addr, &addr)) {
+            if (--entry->count == 0) {
+                *link = entry->next;
+                free(entry);
+            }
+            break;
+        }
+        link = &entry->next;
+    }
+
+    pthread_mutex_unlock(&limit.mutex);
+
+    return;
+}
@@ -0,0 +1,29 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: connlimit.h
+ * Purpose: connection limit header file. Defines the per source address cap -
+            on concurrent connections
+ */
+
+#ifndef CONNLIMIT_H
+#define CONNLIMIT_H
+
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/* Number of buckets in the address table, power of two */
+#define CONNLIMIT_BUCKETS 1024
+
+/* Set up the address table, max of 0 disables the limit */
+void connlimit_init(int max_per_ip);
+
+/* Account a new client socket against its source address */
+/* Returns false if the address is already at its limit */
+bool connlimit_acquire(int client, const struct sockaddr *peer);
+
+/* Release a client socket, must be called before it is closed */
+void connlimit_release(int client);
+
+#endif
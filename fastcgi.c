@@ -0,0 +1,945 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: fastcgi.c
+ * Purpose: FastCGI module. Requests for configured extensions and -
+            prefixes run on an application server over a few long lived -
+            connections shared by every worker. A backend that says it -
+            multiplexes gets many requests per connection, told apart by -
+            request id. Each connection has a reader thread that splices -
+            stdout records into a pipe per request, and the worker splices -
+            that pipe to its client, so response bodies never pass through -
+            user space
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <signal.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "fastcgi.h"
+#include "config.h"
+#include "listener.h"
+#include "sender.h"
+#include "stats.h"
+#include "timer.h"
+#include "tune.h"
+#include "io.h"
+
+/* Record header size and protocol version */
+#define FCGI_HEADER_LENGTH 8
+#define FCGI_VERSION 1
+
+/* Record types */
+typedef enum {
+    FCGI_BEGIN_REQUEST = 1,
+    FCGI_ABORT_REQUEST = 2,
+    FCGI_END_REQUEST = 3,
+    FCGI_PARAMS = 4,
+    FCGI_STDIN = 5,
+    FCGI_STDOUT = 6,
+    FCGI_STDERR = 7,
+    FCGI_GET_VALUES = 9,
+    FCGI_GET_VALUES_RESULT = 10
+} fcgi_type_t;
+
+/* Role of every request, and the flag keeping the connection open */
+#define FCGI_RESPONDER 1
+#define FCGI_KEEP_CONN 1
+
+/* One request on a backend connection, its id is its index plus one */
+typedef struct {
+    /* Held by a worker, or waiting for the worker and the end record */
+    bool in_use;
+    bool worker_done;
+    bool ended;
+
+    /* Write end of the pipe its stdout goes to, ERROR once ended */
+    int pipe;
+} fcgi_slot_t;
+
+/* One connection to the application server */
+typedef struct {
+    int fd;
+    bool open;
+    bool dead;
+    bool reading;
+
+    /* Being connected by a worker, which holds no lock meanwhile */
+    bool opening;
+
+    /* Requests it takes at once, and how many slots are taken */
+    size_t capacity;
+    size_t active;
+
+    /* Records from different workers go out whole */
+    pthread_mutex_t write_lock;
+
+    fcgi_slot_t slots[FASTCGI_MAX_REQUESTS];
+} backend_t;
+
+static struct {
+    bool enabled;
+
+    struct sockaddr_storage addr;
+    socklen_t addr_length;
+
+    /* Absolute, scripts are named to the backend by full path */
+    char document_root[PATH_MAX];
+
+    const char *const *matches;
+    int num_matches;
+
+    /* Guards every backend's slots and state */
+    pthread_mutex_t lock;
+    pthread_cond_t freed;
+    backend_t backends[FASTCGI_MAX_CONNECTIONS];
+} fastcgi = {
+    .enabled = false,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .freed = PTHREAD_COND_INITIALIZER
+};
+
+/* Set up the gateway */
+void fastcgi_init(const char *address, const char *const *matches,
+                  int count, const char *document_root) {
+    if (!address) {
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (matches[i][0] != '.' && matches[i][0] != '/') {
+            fprintf(stderr, "Error: cannot parse FastCGI match %s, expected "
+                            ".ext or /prefix\n", matches[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    fastcgi.addr_length = listener_parse(address, &fastcgi.addr);
+    fastcgi.matches = matches;
+    fastcgi.num_matches = count;
+
+    if (!realpath(document_root, fastcgi.document_root)) {
+        perror("Error: cannot resolve webroot for FastCGI");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < FASTCGI_MAX_CONNECTIONS; i++) {
+        pthread_mutex_init(&fastcgi.backends[i].write_lock, NULL);
+    }
+
+    fastcgi.enabled = true;
+
+    return;
+}
+
+/* Checks an extension or prefix */
+bool fastcgi_match(const char *uri) {
+    size_t path_length = strlen(uri);
+    const char *match = NULL;
+    size_t length;
+
+    if (!fastcgi.enabled) {
+        return false;
+    }
+
+    for (int i = 0; i < fastcgi.num_matches; i++) {
+        match = fastcgi.matches[i];
+        length = strlen(match);
+
+        /* Extensions end the path, prefixes start it */
+        if (match[0] == '.'
+                ? path_length >= length &&
+                  strncmp(uri + path_length - length, match, length) == 0
+                : path_has_prefix(uri, match, length)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Fill in a record header */
+static void put_header(unsigned char *out, fcgi_type_t type, int id,
+                       size_t length) {
+    out[0] = FCGI_VERSION;
+    out[1] = (unsigned char)type;
+    out[2] = (unsigned char)(id >> 8);
+    out[3] = (unsigned char)id;
+    out[4] = (unsigned char)(length >> 8);
+    out[5] = (unsigned char)length;
+    out[6] = 0;
+    out[7] = 0;
+}
+
+/* Read exactly length bytes from a blocking descriptor */
+static bool read_full(int fd, void *buffer, size_t length) {
+    char *ptr = buffer;
+    ssize_t bytes;
+
+    while (length > 0) {
+        bytes = read(fd, ptr, length);
+        if (bytes == ERROR && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            return false;
+        }
+
+        ptr += bytes;
+        length -= (size_t)bytes;
+    }
+
+    return true;
+}
+
+/* Throw away length bytes of a record nobody wants */
+static bool discard(int fd, size_t length) {
+    char scratch[4096];
+    size_t chunk;
+
+    while (length > 0) {
+        chunk = length < sizeof scratch ? length : sizeof scratch;
+        if (!read_full(fd, scratch, chunk)) {
+            return false;
+        }
+        length -= chunk;
+    }
+
+    return true;
+}
+
+/* Append a name-value pair, lengths over 127 take four bytes */
+static bool add_param(unsigned char *out, size_t space, size_t *length,
+                      const char *name, size_t name_length,
+                      const char *value, size_t value_length) {
+    size_t lengths[2] = {name_length, value_length};
+
+    if (*length + 8 + name_length + value_length > space) {
+        return false;
+    }
+
+    for (size_t i = 0; i < ARRAY_LENGTH(lengths); i++) {
+        if (lengths[i] < 128) {
+            out[(*length)++] = (unsigned char)lengths[i];
+        } else {
+            out[(*length)++] = (unsigned char)((lengths[i] >> 24) | 0x80);
+            out[(*length)++] = (unsigned char)(lengths[i] >> 16);
+            out[(*length)++] = (unsigned char)(lengths[i] >> 8);
+            out[(*length)++] = (unsigned char)lengths[i];
+        }
+    }
+
+    memcpy(out + *length, name, name_length);
+    *length += name_length;
+    memcpy(out + *length, value, value_length);
+    *length += value_length;
+
+    return true;
+}
+
+/* Append a pair with NUL terminated name and value */
+static bool add_string(unsigned char *out, size_t space, size_t *length,
+                       const char *name, const char *value) {
+    return add_param(out, space, length, name, strlen(name), value,
+                     strlen(value));
+}
+
+/* Ask a new connection whether the backend multiplexes */
+/* Anything but a clear yes, in time, means one request at a time */
+static size_t query_capacity(int fd) {
+    unsigned char query[FCGI_HEADER_LENGTH + 32];
+    unsigned char header[FCGI_HEADER_LENGTH];
+    char body[256];
+    struct pollfd ready = { .fd = fd, .events = POLLIN };
+    size_t length = 0, body_length;
+
+    add_string(query + FCGI_HEADER_LENGTH, sizeof query - FCGI_HEADER_LENGTH,
+               &length, "FCGI_MPXS_CONNS", "");
+    put_header(query, FCGI_GET_VALUES, 0, length);
+
+    if (!io_write_all(fd, query, FCGI_HEADER_LENGTH + length) ||
+        poll(&ready, 1, config.write_timeout) != 1 ||
+        !read_full(fd, header, sizeof header)) {
+        return 1;
+    }
+
+    /* Anything too long is read past, the next record starts after it */
+    body_length = (size_t)header[4] << 8 | header[5];
+    if (body_length + header[6] > sizeof body) {
+        discard(fd, body_length + header[6]);
+        return 1;
+    }
+
+    if (!read_full(fd, body, body_length + header[6]) ||
+        header[1] != FCGI_GET_VALUES_RESULT) {
+        return 1;
+    }
+
+    /* Single pair, FCGI_MPXS_CONNS with a one character value */
+    if (body_length == 18 && memcmp(body + 2, "FCGI_MPXS_CONNS", 15) == 0 &&
+        body[17] == '1') {
+        return FASTCGI_MAX_REQUESTS;
+    }
+
+    return 1;
+}
+
+/* Free a slot once the worker and the backend are both finished with it */
+/* Called with the lock held. Closes a dead connection once it is idle */
+static void settle(backend_t *backend, fcgi_slot_t *slot) {
+    if (slot && slot->in_use && slot->worker_done && slot->ended) {
+        slot->in_use = false;
+        backend->active--;
+        pthread_cond_broadcast(&fastcgi.freed);
+    }
+
+    if (backend->open && backend->dead && backend->active == 0 &&
+        !backend->reading) {
+        close(backend->fd);
+        backend->open = false;
+        pthread_cond_broadcast(&fastcgi.freed);
+    }
+}
+
+/* End a request from the reader, its worker sees end of file */
+/* Called with the lock held */
+static void end_slot(backend_t *backend, fcgi_slot_t *slot) {
+    if (!slot->in_use || slot->ended) {
+        return;
+    }
+
+    close(slot->pipe);
+    slot->pipe = ERROR;
+    slot->ended = true;
+    settle(backend, slot);
+}
+
+/* Reader thread for one backend connection */
+/* Hands stdout to the owning request and ends requests as the backend -
+   finishes them, until the connection fails */
+static void *read_backend(void *args) {
+    backend_t *backend = args;
+    unsigned char header[FCGI_HEADER_LENGTH];
+    fcgi_slot_t *slot = NULL;
+    size_t length, padding, id;
+    ssize_t moved;
+    char message[1024];
+
+    while (read_full(backend->fd, header, sizeof header)) {
+        id = (size_t)header[2] << 8 | header[3];
+        length = (size_t)header[4] << 8 | header[5];
+        padding = header[6];
+
+        slot = id >= 1 && id <= backend->capacity ? &backend->slots[id - 1]
+                                                  : NULL;
+
+        /* Slot state only changes under the lock, and ended only here */
+        pthread_mutex_lock(&fastcgi.lock);
+        if (slot && (!slot->in_use || slot->ended)) {
+            slot = NULL;
+        }
+        pthread_mutex_unlock(&fastcgi.lock);
+
+        if (header[1] == FCGI_STDOUT && slot && slot->pipe != ERROR) {
+            /* Straight from the socket into the request's pipe */
+            while (length > 0) {
+                moved = splice(backend->fd, NULL, slot->pipe, NULL, length,
+                               SPLICE_F_MOVE);
+                if (moved == ERROR && errno == EINTR) {
+                    continue;
+                }
+
+                /* Worker gave up, the rest of the record goes nowhere */
+                if (moved == ERROR && errno == EPIPE) {
+                    break;
+                }
+
+                if (moved <= 0) {
+                    goto failed;
+                }
+                length -= (size_t)moved;
+            }
+        } else if (header[1] == FCGI_STDERR && length < sizeof message) {
+            if (!read_full(backend->fd, message, length)) {
+                goto failed;
+            }
+            fprintf(stderr, "FastCGI: %.*s\n", (int)length, message);
+            length = 0;
+        } else if (header[1] == FCGI_END_REQUEST && slot) {
+            pthread_mutex_lock(&fastcgi.lock);
+            end_slot(backend, slot);
+            pthread_mutex_unlock(&fastcgi.lock);
+        }
+
+        if (!discard(backend->fd, length + padding)) {
+            break;
+        }
+    }
+
+failed:
+    /* Every request still on the connection ends with it */
+    pthread_mutex_lock(&fastcgi.lock);
+
+    backend->dead = true;
+    for (size_t i = 0; i < backend->capacity; i++) {
+        end_slot(backend, &backend->slots[i]);
+    }
+    backend->reading = false;
+    settle(backend, NULL);
+
+    pthread_mutex_unlock(&fastcgi.lock);
+
+    return NULL;
+}
+
+/* Connect to the backend and ask how many requests it takes */
+/* Called without the lock, both can block. Returns the socket, or -
+   ERROR if it can't be reached */
+static int connect_backend(size_t *capacity) {
+    int fd;
+
+    fd = socket(fastcgi.addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == ERROR) {
+        perror("Error: cannot open FastCGI socket");
+        return ERROR;
+    }
+
+    if (connect(fd, (const struct sockaddr *)&fastcgi.addr,
+                fastcgi.addr_length) == ERROR) {
+        perror("Error: cannot connect to FastCGI backend");
+        close(fd);
+        return ERROR;
+    }
+
+    *capacity = query_capacity(fd);
+
+    return fd;
+}
+
+/* Open a backend connection and start its reader */
+/* Called with the lock held, which is dropped while connecting. The -
+   slot is marked opening meanwhile, so no one else picks it. Returns -
+   false if it can't be reached */
+static bool open_backend(backend_t *backend) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    sigset_t all, old;
+    size_t capacity = 1;
+    int fd;
+
+    backend->opening = true;
+    pthread_mutex_unlock(&fastcgi.lock);
+
+    fd = connect_backend(&capacity);
+
+    pthread_mutex_lock(&fastcgi.lock);
+    backend->opening = false;
+
+    /* Whoever waited on this connection tries again either way */
+    pthread_cond_broadcast(&fastcgi.freed);
+
+    if (fd == ERROR) {
+        return false;
+    }
+
+    backend->fd = fd;
+    backend->capacity = capacity;
+    backend->active = 0;
+    backend->dead = false;
+    backend->reading = true;
+    backend->open = true;
+    for (size_t i = 0; i < FASTCGI_MAX_REQUESTS; i++) {
+        backend->slots[i].in_use = false;
+    }
+
+    /* Signals are meant for the acceptor, keep them off this thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    if (pthread_create(&thread, &attr, read_backend, backend)) {
+        perror("Error: cannot create FastCGI reader thread");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    STAT_INC(fastcgi_connects);
+
+    return true;
+}
+
+/* Take a free request slot, opening a connection if all are full */
+/* Returns NULL if none came free within the write timeout, or with -
+   unreachable set if the backend can't be reached */
+static backend_t *acquire(int pipe, int *id, bool *unreachable) {
+    struct timespec deadline;
+    backend_t *backend = NULL, *closed = NULL;
+
+    *unreachable = false;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += config.write_timeout / 1000;
+    deadline.tv_nsec += (long)(config.write_timeout % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&fastcgi.lock);
+
+    while (true) {
+        closed = NULL;
+
+        for (size_t i = 0; i < FASTCGI_MAX_CONNECTIONS; i++) {
+            backend = &fastcgi.backends[i];
+            if (!backend->open) {
+                closed = closed || backend->opening ? closed : backend;
+                continue;
+            }
+            if (backend->dead || backend->active == backend->capacity) {
+                continue;
+            }
+
+            for (size_t j = 0; j < backend->capacity; j++) {
+                if (!backend->slots[j].in_use) {
+                    backend->slots[j] = (fcgi_slot_t){
+                        .in_use = true,
+                        .worker_done = false,
+                        .ended = false,
+                        .pipe = pipe
+                    };
+                    backend->active++;
+                    *id = (int)j + 1;
+
+                    pthread_mutex_unlock(&fastcgi.lock);
+                    return backend;
+                }
+            }
+        }
+
+        /* Everything open is busy, another connection may help */
+        if (closed && !open_backend(closed)) {
+            *unreachable = true;
+            break;
+        }
+
+        if (!closed && pthread_cond_timedwait(&fastcgi.freed, &fastcgi.lock,
+                                              &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&fastcgi.lock);
+
+    return NULL;
+}
+
+/* Worker is done with a request */
+/* One the backend never finished takes its connection down, since its -
+   id can't be used again until it does */
+static void release(backend_t *backend, int id) {
+    fcgi_slot_t *slot = &backend->slots[id - 1];
+
+    pthread_mutex_lock(&fastcgi.lock);
+
+    slot->worker_done = true;
+    if (!slot->ended && !backend->dead) {
+        backend->dead = true;
+        shutdown(backend->fd, SHUT_RDWR);
+    }
+    settle(backend, slot);
+
+    pthread_mutex_unlock(&fastcgi.lock);
+}
+
+/* Send whole records, never interleaved with another worker's */
+static bool send_records(backend_t *backend, const void *records,
+                         size_t length) {
+    bool ok;
+
+    pthread_mutex_lock(&backend->write_lock);
+    ok = io_write_all(backend->fd, records, length);
+    pthread_mutex_unlock(&backend->write_lock);
+
+    return ok;
+}
+
+/* Build begin request and params records */
+/* Returns their length, 0 if the params didn't fit */
+static size_t build_params(unsigned char *out, size_t space,
+                           const connection_t *conn,
+                           const http_request_t *request, int id,
+                           const char *end, size_t body_length) {
+    unsigned char *params = out + 2 * FCGI_HEADER_LENGTH + 8;
+    size_t length = 0, params_space = space - 3 * FCGI_HEADER_LENGTH - 8;
+    const char *line = NULL, *newline = NULL, *colon = NULL, *value = NULL;
+    char name[256], number[32], peer[INET6_ADDRSTRLEN];
+    char filename[PATH_MAX + CONN_BUFFER_SIZE], uri[CONN_BUFFER_SIZE];
+    size_t line_length, name_length;
+    bool ok = true;
+
+    if (params_space > FASTCGI_RECORD_SIZE) {
+        params_space = FASTCGI_RECORD_SIZE;
+    }
+
+    /* Responder role, keep the connection for the next request */
+    put_header(out, FCGI_BEGIN_REQUEST, id, 8);
+    memset(out + FCGI_HEADER_LENGTH, '\0', 8);
+    out[FCGI_HEADER_LENGTH + 1] = FCGI_RESPONDER;
+    out[FCGI_HEADER_LENGTH + 2] = FCGI_KEEP_CONN;
+
+    /* Scripts are named by the normalized path, so a .. can't name a -
+       file above the document root */
+    snprintf(filename, sizeof filename, "%s%s", fastcgi.document_root,
+             request->URI);
+    snprintf(number, sizeof number, "%zu", body_length);
+
+    ok = encode_uri(uri, sizeof uri, request->URI, request->query,
+                    request->query_length) &&
+         add_string(params, params_space, &length, "GATEWAY_INTERFACE",
+                    "CGI/1.1") &&
+         add_string(params, params_space, &length, "SERVER_SOFTWARE",
+                    "server") &&
+         add_string(params, params_space, &length, "SERVER_PROTOCOL",
+                    request->httpversion) &&
+         add_string(params, params_space, &length, "REQUEST_METHOD",
+                    request->method) &&
+         add_string(params, params_space, &length, "REQUEST_URI", uri) &&
+         add_string(params, params_space, &length, "SCRIPT_NAME",
+                    request->URI) &&
+         add_string(params, params_space, &length, "SCRIPT_FILENAME",
+                    filename) &&
+         add_string(params, params_space, &length, "DOCUMENT_ROOT",
+                    fastcgi.document_root) &&
+         add_param(params, params_space, &length, "QUERY_STRING", 12,
+                   request->query ? request->query : "",
+                   request->query_length) &&
+         add_string(params, params_space, &length, "CONTENT_LENGTH",
+                    body_length > 0 ? number : "");
+
+    if (conn_peer_address(conn, peer, sizeof peer)) {
+        ok = ok && add_string(params, params_space, &length, "REMOTE_ADDR",
+                              peer);
+    }
+
+    /* Request headers become HTTP_ variables, apart from the two CGI -
+       already has its own names for. The blank line before end means -
+       the request line ends in a newline */
+    line = strchr(conn->buffer, '\n') + 1;
+    while (ok && line < end &&
+           (newline = memchr(line, '\n', (size_t)(end - line)))) {
+        line_length = (size_t)(newline - line);
+        if (line_length > 0 && line[line_length - 1] == '\r') {
+            line_length--;
+        }
+
+        colon = memchr(line, ':', line_length);
+        name_length = colon ? (size_t)(colon - line) : 0;
+        if (name_length > 0 && name_length < sizeof name - 5) {
+            value = colon + 1;
+            while (value < line + line_length && *value == ' ') {
+                value++;
+            }
+
+            if (strncasecmp(line, "Content-Type", name_length) == 0 &&
+                name_length == 12) {
+                memcpy(name, "CONTENT_TYPE", 12);
+                name_length = 12;
+            } else if (strncasecmp(line, "Content-Length", name_length) == 0 &&
+                       name_length == 14) {
+                name_length = 0;
+            } else {
+                memcpy(name, "HTTP_", 5);
+                for (size_t i = 0; i < name_length; i++) {
+                    name[5 + i] = line[i] == '-'
+                                      ? '_'
+                                      : (char)toupper((unsigned char)line[i]);
+                }
+                name_length += 5;
+            }
+
+            if (name_length > 0) {
+                ok = add_param(params, params_space, &length, name,
+                               name_length, value,
+                               (size_t)(line + line_length - value));
+            }
+        }
+
+        line = newline + 1;
+    }
+
+    if (!ok) {
+        return 0;
+    }
+
+    /* Params, then the empty record ending them */
+    put_header(out + FCGI_HEADER_LENGTH + 8, FCGI_PARAMS, id, length);
+    put_header(params + length, FCGI_PARAMS, id, 0);
+
+    return 2 * FCGI_HEADER_LENGTH + 8 + length + FCGI_HEADER_LENGTH;
+}
+
+/* Send the request body as stdin records, then the empty one ending it */
+static bool send_body(backend_t *backend, connection_t *conn, int id,
+                      const char *body, size_t buffered, size_t length) {
+    unsigned char record[FCGI_HEADER_LENGTH + 16384];
+    size_t chunk;
+    ssize_t bytes;
+
+    while (length > 0) {
+        /* What came with the header first, then from the client */
+        if (buffered > 0) {
+            chunk = buffered < sizeof record - FCGI_HEADER_LENGTH
+                        ? buffered
+                        : sizeof record - FCGI_HEADER_LENGTH;
+            memcpy(record + FCGI_HEADER_LENGTH, body, chunk);
+            body += chunk;
+            buffered -= chunk;
+        } else {
+            chunk = length < sizeof record - FCGI_HEADER_LENGTH
+                        ? length
+                        : sizeof record - FCGI_HEADER_LENGTH;
+            bytes = read(conn->fd, record + FCGI_HEADER_LENGTH, chunk);
+            if (bytes == ERROR &&
+                (errno == EINTR ||
+                 (errno == EAGAIN && io_wait(conn->fd, POLLIN)))) {
+                continue;
+            }
+            if (bytes <= 0) {
+                return false;
+            }
+            chunk = (size_t)bytes;
+        }
+
+        put_header(record, FCGI_STDIN, id, chunk);
+        if (!send_records(backend, record, FCGI_HEADER_LENGTH + chunk)) {
+            return false;
+        }
+        length -= chunk;
+    }
+
+    put_header(record, FCGI_STDIN, id, 0);
+
+    return send_records(backend, record, FCGI_HEADER_LENGTH);
+}
+
+/* Wait for the response pipe, up to the write timeout */
+static bool wait_pipe(int pipe) {
+    struct pollfd ready = { .fd = pipe, .events = POLLIN };
+    int result;
+
+    while ((result = poll(&ready, 1, config.write_timeout)) == ERROR &&
+           errno == EINTR) {
+    }
+
+    return result == 1;
+}
+
+/* Turn the CGI header into a status line and headers for the client */
+/* Returns false if the header didn't come in full */
+static bool forward_header(int pipe, int client, char *buffer, size_t *length,
+                           size_t *header_length) {
+    char out[FASTCGI_HEADER_SIZE + 64];
+    const char *status = "200 OK", *line = NULL, *newline = NULL;
+    const char *end = NULL, *limit = NULL;
+    size_t out_length = 0, line_length, status_length = 6;
+    ssize_t bytes;
+    bool location = false, has_status = false;
+
+    /* Read until the blank line, whatever of the body follows stays */
+    while (!(end = memmem(buffer, *length, "\r\n\r\n", 4)) &&
+           !(end = memmem(buffer, *length, "\n\n", 2))) {
+        if (*length == FASTCGI_HEADER_SIZE) {
+            return false;
+        }
+
+        bytes = read(pipe, buffer + *length, FASTCGI_HEADER_SIZE - *length);
+        if (bytes == ERROR &&
+            (errno == EINTR || (errno == EAGAIN && wait_pipe(pipe)))) {
+            continue;
+        }
+        if (bytes <= 0) {
+            return false;
+        }
+        *length += (size_t)bytes;
+    }
+    *header_length = (size_t)(end - buffer) + (end[0] == '\r' ? 4 : 2);
+    limit = buffer + *header_length;
+
+    /* Headers other than Status go to the client as they are */
+    for (line = buffer; line < end; line = newline + 1) {
+        newline = memchr(line, '\n', (size_t)(limit - line));
+        line_length = (size_t)(newline - line);
+        if (line_length > 0 && line[line_length - 1] == '\r') {
+            line_length--;
+        }
+
+        if (line_length > 7 && strncasecmp(line, "Status:", 7) == 0) {
+            status = line + 7;
+            while (*status == ' ') {
+                status++;
+            }
+            status_length = (size_t)(line + line_length - status);
+            has_status = true;
+            continue;
+        }
+
+        location = location ||
+                   (line_length > 9 && strncasecmp(line, "Location:", 9) == 0);
+
+        if (out_length + line_length + 2 > sizeof out) {
+            return false;
+        }
+        memcpy(out + out_length, line, line_length);
+        memcpy(out + out_length + line_length, "\r\n", 2);
+        out_length += line_length + 2;
+    }
+
+    /* Redirect without a status, as CGI defines */
+    if (location && !has_status) {
+        status = "302 Found";
+        status_length = 9;
+    }
+
+    return io_write_all(client, "HTTP/1.0 ", 9) &&
+           io_write_all(client, status, status_length) &&
+           io_write_all(client, "\r\n", 2) &&
+           io_write_all(client, out, out_length) &&
+           io_write_all(client, "\r\n", 2);
+}
+
+/* Splice the rest of the response from the pipe to the client */
+/* Returns true once the backend ended the request */
+static bool forward_body(int pipe, int client) {
+    ssize_t moved;
+
+    while (true) {
+        moved = splice(pipe, NULL, client, NULL, SPLICE_PIPE_SIZE,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved == 0) {
+            return true;
+        }
+        if (moved > 0 || (moved == ERROR && errno == EINTR)) {
+            continue;
+        }
+
+        /* Pipe empty or socket full, splice can't say which */
+        if (moved == ERROR && errno == EAGAIN) {
+            struct pollfd ready[2] = {
+                { .fd = pipe, .events = POLLIN },
+                { .fd = client, .events = POLLOUT }
+            };
+
+            if (poll(ready, 2, config.write_timeout) > 0 &&
+                !(ready[1].revents & (POLLERR | POLLHUP))) {
+                continue;
+            }
+        }
+
+        return false;
+    }
+}
+
+/* Forward a request */
+void fastcgi_forward(connection_t *conn, const http_request_t *request) {
+    unsigned char records[FASTCGI_PARAMS_SIZE];
+    char header[FASTCGI_HEADER_SIZE];
+    const char *body = NULL, *value = NULL;
+    size_t length, value_length, body_length = 0, buffered, header_length;
+    size_t header_read = 0;
+    backend_t *backend = NULL;
+    bool started = false, unreachable;
+    int pipe[2], id;
+
+    STAT_INC(fastcgi_requests);
+
+    /* Body starts after the blank line, a client that stopped sending -
+       before it never finished the header */
+    body = conn_body(conn);
+    if (!body) {
+        send_response(conn->fd, RESPONSE_BAD_REQUEST);
+        return;
+    }
+
+    /* Request bodies need a length, there's no chunked upload support */
+    if (request_header(request, HEADER_TRANSFER_ENCODING, &value_length)) {
+        send_response(conn->fd, RESPONSE_NOT_IMPLEMENTED);
+        return;
+    }
+
+    value = request_header(request, HEADER_CONTENT_LENGTH, &value_length);
+    if (value && !parse_content_length(value, value_length, &body_length)) {
+        send_response(conn->fd, RESPONSE_BAD_REQUEST);
+        return;
+    }
+
+    buffered = conn->length - (size_t)(body - conn->buffer);
+    if (buffered > body_length) {
+        buffered = body_length;
+    }
+
+    /* Response arrives here, the worker only ever waits on its read end */
+    if (pipe2(pipe, O_CLOEXEC) == ERROR) {
+        perror("Error: pipe2() failed for FastCGI response");
+        send_response(conn->fd, RESPONSE_UNAVAILABLE);
+        return;
+    }
+    fcntl(pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+
+    backend = acquire(pipe[1], &id, &unreachable);
+    if (!backend) {
+        close(pipe[0]);
+        close(pipe[1]);
+        STAT_INC(fastcgi_errors);
+        send_response(conn->fd, unreachable ? RESPONSE_BAD_GATEWAY
+                                            : RESPONSE_UNAVAILABLE);
+        return;
+    }
+
+    /* Whole response has to go out before the write deadline */
+    timer_add(&conn->timer, config.write_timeout, conn_expired, conn);
+    tune_cork(conn, true);
+
+    length = build_params(records, sizeof records, conn, request, id, body,
+                          body_length);
+    if (length > 0 && send_records(backend, records, length) &&
+        send_body(backend, conn, id, body, buffered, body_length)) {
+        started = forward_header(pipe[0], conn->fd, header, &header_read,
+                                 &header_length);
+    }
+
+    /* Body that came in with the header, then the rest of the pipe */
+    if (started &&
+        io_write_all(conn->fd, header + header_length,
+                     header_read - header_length)) {
+        forward_body(pipe[0], conn->fd);
+    }
+
+    tune_cork(conn, false);
+    timer_cancel(&conn->timer);
+
+    close(pipe[0]);
+    release(backend, id);
+
+    if (!started) {
+        STAT_INC(fastcgi_errors);
+        send_response(conn->fd, length > 0 ? RESPONSE_BAD_GATEWAY
+                                           : RESPONSE_TOO_LARGE);
+    }
+
+    return;
+}
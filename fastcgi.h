@@ -0,0 +1,47 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: fastcgi.h
+ * Purpose: FastCGI header file. Defines the gateway to a FastCGI -
+            application server for configured extensions and prefixes
+ */
+
+#ifndef FASTCGI_H
+#define FASTCGI_H
+
+#include <stdbool.h>
+
+#include "conn.h"
+#include "http.h"
+
+/* Most extensions and prefixes sent to the application server */
+#define FASTCGI_MAX_MATCHES 16
+
+/* Backend connections kept open, shared by every worker */
+#define FASTCGI_MAX_CONNECTIONS 4
+
+/* Requests in flight on one connection, when the backend multiplexes */
+#define FASTCGI_MAX_REQUESTS 16
+
+/* Largest block of request parameters, and of CGI response header */
+#define FASTCGI_PARAMS_SIZE 16384
+#define FASTCGI_HEADER_SIZE 8192
+
+/* Largest record body the protocol allows */
+#define FASTCGI_RECORD_SIZE 65535
+
+/* Set up the gateway for the application server at address */
+/* matches are .ext or /prefix, document_root is where scripts are */
+void fastcgi_init(const char *address, const char *const *matches,
+                  int count, const char *document_root);
+
+/* Checks if a normalized path goes to the application server */
+bool fastcgi_match(const char *uri);
+
+/* Run a request on the application server and stream its response back */
+/* Answers 502 if the backend can't be reached or fails before the -
+   response starts, or 503 if every backend request slot stays busy. -
+   The caller still closes the connection */
+void fastcgi_forward(connection_t *conn, const http_request_t *request);
+
+#endif
@@ -0,0 +1,442 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: filecache.c
+ * Purpose: file metadata cache module. Caches stat() results by URI, so -
+            workers never touch the filesystem for a file they have seen. -
+            URIs that don't exist are remembered too, so scans for missing -
+            paths skip the kernel path walk, and so are directories, with -
+            the index file they resolve to. Entries stay valid until the -
+            webroot watcher invalidates them, missing ones also expire. -
+            Entries are keyed by virtual host as well, and each host can -
+            only fill its own share of the cache
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "filecache.h"
+#include "http.h"
+#include "stats.h"
+#include "webroot.h"
+#include "ticker.h"
+#include "vhost.h"
+
+/* Cached metadata for one URI */
+typedef struct cache_entry {
+    char *uri;
+    uint32_t hash;
+    int host;
+    resolution_t kind;
+    file_meta_t meta;
+
+    /* Negative entries record a URI that doesn't exist, until expires */
+    uint64_t expires;
+    size_t ring;
+
+    struct cache_entry *next;
+} cache_entry_t;
+
+static struct {
+    pthread_rwlock_t lock;
+    cache_entry_t *buckets[FILECACHE_BUCKETS];
+    size_t counts[MAX_VHOSTS];
+    bool enabled;
+
+    /* Negative entries in insertion order, the oldest is evicted first */
+    cache_entry_t *negatives[FILECACHE_MAX_NEGATIVE];
+    size_t next_negative;
+    unsigned negative_ttl;
+
+    /* Bumped on every invalidation, so a lookup that raced with one -
+       doesn't insert what it saw before the change */
+    atomic_uint_fast64_t generation;
+} cache = { .lock = PTHREAD_RWLOCK_INITIALIZER };
+
+/* FNV-1a hash of a host and a URI */
+static uint32_t hash_uri(int host, const char *uri) {
+    uint32_t hash = UINT32_C(2166136261) ^ (uint32_t)host;
+
+    while (*uri) {
+        hash ^= (unsigned char)*uri++;
+        hash *= UINT32_C(16777619);
+    }
+
+    return hash;
+}
+
+/* Render Last-Modified and ETag headers for a file */
+/* Done on a miss, so hits never format dates */
+static void render_validators(file_meta_t *meta) {
+    char date[32];
+    struct tm tm;
+
+    gmtime_r(&meta->mtime, &tm);
+    strftime(date, sizeof date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+    snprintf(meta->validators, sizeof meta->validators,
+             "Last-Modified: %s\r\nETag: \"%lx-%lx\"\r\n", date,
+             (unsigned long)meta->mtime, (unsigned long)meta->size);
+}
+
+/* Set up the cache */
+void filecache_init(unsigned negative_ttl) {
+    memset(cache.counts, '\0', sizeof cache.counts);
+    cache.enabled = false;
+    cache.next_negative = 0;
+    cache.negative_ttl = negative_ttl;
+    atomic_init(&cache.generation, 0);
+
+    return;
+}
+
+/* Turn serving from the cache on or off */
+void filecache_enable(bool enabled) {
+    pthread_rwlock_wrlock(&cache.lock);
+    cache.enabled = enabled;
+    pthread_rwlock_unlock(&cache.lock);
+
+    if (!enabled) {
+        filecache_flush();
+    }
+
+    return;
+}
+
+/* Unlink and free an entry, write lock held */
+static void remove_entry(cache_entry_t **link) {
+    cache_entry_t *entry = *link;
+
+    *link = entry->next;
+
+    if (entry->kind == RESOLVED_MISSING) {
+        cache.negatives[entry->ring] = NULL;
+    } else {
+        cache.counts[entry->host]--;
+    }
+
+    free(entry->uri);
+    free(entry);
+}
+
+/* Find the link pointing at an entry, write lock held */
+static cache_entry_t **find_link(int host, const char *uri, uint32_t hash) {
+    cache_entry_t **link = &cache.buckets[hash & (FILECACHE_BUCKETS - 1)];
+
+    while (*link) {
+        if ((*link)->hash == hash && (*link)->host == host &&
+            strcmp((*link)->uri, uri) == 0) {
+            return link;
+        }
+        link = &(*link)->next;
+    }
+
+    return NULL;
+}
+
+/* Take the next slot in the negative ring, write lock held */
+/* A full ring evicts its oldest entry, so scans can't pin the cache */
+static size_t take_negative_slot(void) {
+    size_t slot = cache.next_negative;
+    cache_entry_t *oldest = cache.negatives[slot];
+
+    if (oldest) {
+        remove_entry(find_link(oldest->host, oldest->uri, oldest->hash));
+    }
+
+    cache.next_negative = (slot + 1) % FILECACHE_MAX_NEGATIVE;
+
+    return slot;
+}
+
+/* Insert an entry unless the cache changed under us, write lock held */
+static void insert_entry(int host, const char *uri, uint32_t hash,
+                         resolution_t kind, const file_meta_t *meta,
+                         uint64_t generation) {
+    cache_entry_t *entry = NULL, **bucket = NULL, **link = NULL;
+    bool missing = kind == RESOLVED_MISSING;
+
+    if (!cache.enabled || atomic_load(&cache.generation) != generation ||
+        (missing && cache.negative_ttl == 0)) {
+        return;
+    }
+
+    /* Another worker got here first, or an expired negative entry */
+    link = find_link(host, uri, hash);
+    if (link) {
+        if ((*link)->kind != RESOLVED_MISSING) {
+            return;
+        }
+        remove_entry(link);
+    }
+
+    /* One busy host can't push the others out */
+    if (!missing && cache.counts[host] >= vhost_cache_budget(host)) {
+        return;
+    }
+
+    bucket = &cache.buckets[hash & (FILECACHE_BUCKETS - 1)];
+
+    entry = malloc(sizeof *entry);
+    if (!entry) {
+        perror("Error: malloc() failed to allocate cache entry");
+        exit(EXIT_FAILURE);
+    }
+
+    entry->uri = strdup(uri);
+    if (!entry->uri) {
+        perror("Error: strdup() failed to copy URI");
+        exit(EXIT_FAILURE);
+    }
+
+    entry->hash = hash;
+    entry->host = host;
+    entry->kind = kind;
+
+    /* Only files and indexes have metadata */
+    if (kind == RESOLVED_FILE || kind == RESOLVED_INDEX) {
+        entry->meta = *meta;
+    }
+
+    if (!missing) {
+        cache.counts[host]++;
+    } else {
+        entry->expires = ticker_now_ms() + cache.negative_ttl;
+        entry->ring = take_negative_slot();
+        cache.negatives[entry->ring] = entry;
+    }
+
+    /* Eviction may have unlinked the head of this bucket */
+    entry->next = *bucket;
+    *bucket = entry;
+}
+
+/* Stat what a URI names beneath the webroot */
+/* Returns false with errno set if it can't be opened */
+static bool stat_uri(const char *uri, struct stat *info) {
+    int fd;
+
+    /* O_PATH never blocks, even on a fifo, and needs no read permission */
+    fd = webroot_open(uri, O_PATH);
+    if (fd == ERROR) {
+        return false;
+    }
+
+    if (fstat(fd, info) == ERROR) {
+        close(fd);
+        return false;
+    }
+
+    close(fd);
+
+    return true;
+}
+
+/* Fill in metadata of a regular file */
+static void fill_meta(const char *uri, const struct stat *info,
+                      file_meta_t *meta) {
+    meta->size = info->st_size;
+    meta->mtime = info->st_mtime;
+    meta->mime_type = lookup_mime_type(strrchr(uri, '.'));
+    render_validators(meta);
+}
+
+/* Resolve a URI on the filesystem */
+/* Returns false for a failure that says nothing about the URI, so it -
+   isn't cached */
+static bool resolve_uncached(const char *uri, resolution_t *kind,
+                             file_meta_t *meta) {
+    char index[PATH_MAX];
+    struct stat info;
+    size_t length = strlen(uri);
+
+    *kind = RESOLVED_MISSING;
+
+    /* Only remember a path that isn't there, not a transient failure */
+    if (!stat_uri(uri, &info)) {
+        return errno == ENOENT || errno == ENOTDIR;
+    }
+
+    if (S_ISREG(info.st_mode)) {
+        fill_meta(uri, &info, meta);
+        *kind = RESOLVED_FILE;
+        return true;
+    }
+
+    if (!S_ISDIR(info.st_mode)) {
+        return false;
+    }
+
+    /* Relative links in the directory need the slash to resolve */
+    if (uri[length - 1] != '/') {
+        *kind = RESOLVED_REDIRECT;
+        return true;
+    }
+
+    if (length + strlen(INDEX_FILE) >= sizeof index) {
+        return false;
+    }
+    memcpy(index, uri, length);
+    strcpy(index + length, INDEX_FILE);
+
+    /* No index file, or something else by that name */
+    if (!stat_uri(index, &info)) {
+        *kind = RESOLVED_LISTING;
+        return errno == ENOENT;
+    }
+
+    if (!S_ISREG(info.st_mode)) {
+        *kind = RESOLVED_LISTING;
+        return true;
+    }
+
+    fill_meta(index, &info, meta);
+    *kind = RESOLVED_INDEX;
+
+    return true;
+}
+
+/* Resolve a URI */
+resolution_t filecache_resolve(const char *uri, file_meta_t *meta) {
+    cache_entry_t *entry = NULL;
+    int host = vhost_current();
+    uint32_t hash = hash_uri(host, uri);
+    uint64_t generation;
+    resolution_t kind;
+
+    /* Hot path, a shared lock and no system calls */
+    pthread_rwlock_rdlock(&cache.lock);
+
+    for (entry = cache.buckets[hash & (FILECACHE_BUCKETS - 1)]; entry;
+         entry = entry->next) {
+        if (entry->hash == hash && entry->host == host &&
+            strcmp(entry->uri, uri) == 0) {
+            if (entry->kind != RESOLVED_MISSING) {
+                *meta = entry->meta;
+                kind = entry->kind;
+                pthread_rwlock_unlock(&cache.lock);
+                STAT_INC(meta_hits);
+                return kind;
+            }
+
+            /* Known missing, answered without a path lookup */
+            if (entry->expires > ticker_now_ms()) {
+                pthread_rwlock_unlock(&cache.lock);
+                STAT_INC(negative_hits);
+                return RESOLVED_MISSING;
+            }
+
+            break;
+        }
+    }
+
+    pthread_rwlock_unlock(&cache.lock);
+    STAT_INC(meta_misses);
+
+    /* Miss, go to the filesystem */
+    generation = atomic_load(&cache.generation);
+
+    if (resolve_uncached(uri, &kind, meta) && is_canonical_uri(uri)) {
+        pthread_rwlock_wrlock(&cache.lock);
+        insert_entry(host, uri, hash, kind, meta, generation);
+        pthread_rwlock_unlock(&cache.lock);
+    }
+
+    return kind;
+}
+
+/* Drop the entry for the directory holding a path, write lock held */
+static void remove_parent(int host, const char *path) {
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    cache_entry_t **link = NULL;
+    size_t length;
+
+    if (!slash || (size_t)(slash - path) + 1 >= sizeof dir) {
+        return;
+    }
+
+    /* Directory entries are keyed with their trailing slash */
+    length = (size_t)(slash - path) + 1;
+    memcpy(dir, path, length);
+    dir[length] = '\0';
+
+    link = find_link(host, dir, hash_uri(host, dir));
+    if (link) {
+        remove_entry(link);
+    }
+}
+
+/* Drop one entry */
+/* Also clears a negative entry once the path is created */
+void filecache_invalidate(const char *path) {
+    cache_entry_t **link = NULL;
+    int host = vhost_current();
+
+    pthread_rwlock_wrlock(&cache.lock);
+    atomic_fetch_add(&cache.generation, 1);
+
+    link = find_link(host, path, hash_uri(host, path));
+    if (link) {
+        remove_entry(link);
+    }
+    remove_parent(host, path);
+
+    pthread_rwlock_unlock(&cache.lock);
+
+    return;
+}
+
+/* Drop a directory and every entry under it */
+/* Directory changes are rare, so a full scan is fine */
+void filecache_invalidate_prefix(const char *dir) {
+    cache_entry_t **link = NULL;
+    size_t length = strlen(dir);
+    int host = vhost_current();
+
+    pthread_rwlock_wrlock(&cache.lock);
+    atomic_fetch_add(&cache.generation, 1);
+
+    for (size_t i = 0; i < FILECACHE_BUCKETS; i++) {
+        link = &cache.buckets[i];
+        while (*link) {
+            if ((*link)->host == host &&
+                strncmp((*link)->uri, dir, length) == 0 &&
+                ((*link)->uri[length] == '/' ||
+                 (*link)->uri[length] == '\0')) {
+                remove_entry(link);
+            } else {
+                link = &(*link)->next;
+            }
+        }
+    }
+    remove_parent(host, dir);
+
+    pthread_rwlock_unlock(&cache.lock);
+
+    return;
+}
+
+/* Drop everything */
+void filecache_flush(void) {
+    pthread_rwlock_wrlock(&cache.lock);
+    atomic_fetch_add(&cache.generation, 1);
+
+    for (size_t i = 0; i < FILECACHE_BUCKETS; i++) {
+        while (cache.buckets[i]) {
+            remove_entry(&cache.buckets[i]);
+        }
+    }
+
+    pthread_rwlock_unlock(&cache.lock);
+
+    return;
+}
@@ -0,0 +1,77 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: filecache.h
+ * Purpose: file metadata cache header file. Defines the cache of served file -
+            metadata, kept fresh by the webroot watcher
+ */
+
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+/* Number of buckets, power of two */
+#define FILECACHE_BUCKETS 1024
+
+/* Most entries held at once per virtual host, unless it sets its own */
+#define FILECACHE_MAX_ENTRIES 8192
+
+/* Most URIs remembered as missing, the oldest is evicted past this */
+#define FILECACHE_MAX_NEGATIVE 4096
+
+/* File served for a URI naming a directory */
+#define INDEX_FILE "index.html"
+
+/* Room for the pre-rendered Last-Modified and ETag headers */
+#define VALIDATORS_SIZE 96
+
+/* Metadata of a served file */
+typedef struct {
+    off_t size;
+    time_t mtime;
+    const char *mime_type;
+
+    /* Validator headers, rendered once when the entry is filled */
+    char validators[VALIDATORS_SIZE];
+} file_meta_t;
+
+/* What a URI resolves to */
+typedef enum {
+    RESOLVED_MISSING,
+    RESOLVED_FILE,
+    RESOLVED_INDEX,
+    RESOLVED_REDIRECT,
+    RESOLVED_LISTING
+} resolution_t;
+
+/* Set up the cache, misses are resolved through the webroot module */
+/* Missing URIs are remembered for negative_ttl ms, 0 disables that */
+void filecache_init(unsigned negative_ttl);
+
+/* Only serve from the cache while the watcher can keep it fresh */
+void filecache_enable(bool enabled);
+
+/* Resolve a URI of the current host, filling in metadata of the file it -
+   names */
+/* A directory URI ending in / resolves to its index file, with meta of -
+   that, or to a listing if it has none. Without the / it resolves to a -
+   redirect. Missing URIs are cached too, a later create clears them via -
+   invalidation */
+resolution_t filecache_resolve(const char *uri, file_meta_t *meta);
+
+/* Drop the entry for one path, relative to the current host's webroot */
+/* The directory holding it goes too, its index may have changed */
+void filecache_invalidate(const char *path);
+
+/* Drop a directory and every entry under it, relative to the current -
+   host's webroot */
+void filecache_invalidate_prefix(const char *dir);
+
+/* Drop everything, of every host */
+void filecache_flush(void);
+
+#endif
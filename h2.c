@@ -0,0 +1,1237 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: h2.c
+ * Purpose: HTTP/2 module. Runs a cleartext HTTP/2 connection on the worker -
+            that picked it up: frames are parsed as they arrive, headers go -
+            through HPACK, and every stream with a body gets one DATA frame -
+            per round, so a page and its assets share one connection. Bodies -
+            go from the page cache with sendfile(), one frame at a time. -
+            Between requests an idle connection waits in the reactor, not -
+            on the worker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+
+#include "h2.h"
+#include "hpack.h"
+#include "config.h"
+#include "sender.h"
+#include "webroot.h"
+#include "ticker.h"
+#include "timer.h"
+#include "stats.h"
+#include "tune.h"
+#include "io.h"
+#include "vhost.h"
+#include "reactor.h"
+
+/* Frame types */
+enum {
+    FRAME_DATA,
+    FRAME_HEADERS,
+    FRAME_PRIORITY,
+    FRAME_RST_STREAM,
+    FRAME_SETTINGS,
+    FRAME_PUSH_PROMISE,
+    FRAME_PING,
+    FRAME_GOAWAY,
+    FRAME_WINDOW_UPDATE,
+    FRAME_CONTINUATION
+};
+
+/* Frame flags, ACK shares its bit with END_STREAM */
+#define FLAG_END_STREAM 0x1
+#define FLAG_ACK 0x1
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED 0x8
+#define FLAG_PRIORITY 0x20
+
+/* Error codes */
+enum {
+    H2_NO_ERROR,
+    H2_PROTOCOL_ERROR,
+    H2_INTERNAL_ERROR,
+    H2_FLOW_CONTROL_ERROR,
+    H2_SETTINGS_TIMEOUT,
+    H2_STREAM_CLOSED,
+    H2_FRAME_SIZE_ERROR,
+    H2_REFUSED_STREAM,
+    H2_CANCEL,
+    H2_COMPRESSION_ERROR,
+    H2_CONNECT_ERROR,
+    H2_ENHANCE_YOUR_CALM
+};
+
+/* Settings identifiers */
+enum {
+    SETTINGS_HEADER_TABLE_SIZE = 1,
+    SETTINGS_ENABLE_PUSH,
+    SETTINGS_MAX_CONCURRENT_STREAMS,
+    SETTINGS_INITIAL_WINDOW_SIZE,
+    SETTINGS_MAX_FRAME_SIZE,
+    SETTINGS_MAX_HEADER_LIST_SIZE
+};
+
+#define FRAME_HEADER_SIZE 9
+#define SETTING_SIZE 6
+
+/* Flow control windows start at this and can't grow past the maximum */
+#define DEFAULT_WINDOW 65535
+#define MAX_WINDOW 0x7fffffff
+
+/* Largest frame size a peer may ask for */
+#define MAX_FRAME_LIMIT 16777215
+
+/* Room for two whole frames, so a read always has space after compacting */
+#define INPUT_SIZE (2 * (FRAME_HEADER_SIZE + H2_FRAME_SIZE))
+
+/* Control and HEADERS frames are batched into one write */
+#define OUTPUT_SIZE 16384
+
+/* Largest header block, across HEADERS and CONTINUATION frames */
+#define BLOCK_SIZE 65536
+
+/* Room for one encoded response header block */
+#define RESPONSE_BLOCK_SIZE 1024
+
+/* Allowed methods, as in the HTTP/1.0 Allow header */
+#define ALLOWED_METHODS "GET, HEAD, OPTIONS"
+
+/* A stream sending its body */
+typedef struct {
+    /* 0 while the slot is free */
+    uint32_t id;
+
+    int file;
+    off_t offset;
+    off_t remaining;
+
+    /* Bytes the client will take on this stream */
+    int64_t window;
+} h2_stream_t;
+
+/* Pseudo-headers of the request being decoded */
+typedef struct {
+    char method[16];
+    char path[PATH_MAX];
+    char authority[VHOST_NAME_SIZE];
+    bool has_method;
+    bool has_path;
+    bool has_authority;
+    bool regular_seen;
+    bool malformed;
+
+    /* Path came from an upgraded HTTP/1.1 request, already normalized */
+    bool normalized;
+} h2_request_t;
+
+/* One HTTP/2 connection */
+typedef struct h2_session {
+    connection_t *conn;
+    int fd;
+
+    uint8_t input[INPUT_SIZE];
+    size_t input_length;
+
+    uint8_t output[OUTPUT_SIZE];
+    size_t output_length;
+
+    /* Header block being assembled from HEADERS and CONTINUATION */
+    uint8_t block[BLOCK_SIZE];
+    size_t block_length;
+    uint32_t block_stream;
+    bool block_new;
+    bool in_block;
+
+    hpack_table_t decoder;
+    hpack_table_t encoder;
+    h2_request_t request;
+
+    h2_stream_t streams[H2_MAX_STREAMS];
+    size_t active;
+    size_t next;
+
+    /* Highest stream the client opened */
+    uint32_t last_stream;
+
+    /* Last request frame or body progress, PINGs and SETTINGS don't count */
+    uint64_t active_since;
+
+    /* Bytes the client will take on the connection, and its settings */
+    int64_t window;
+    int64_t initial_window;
+    uint32_t max_frame;
+
+    bool preface_seen;
+    bool settings_seen;
+    bool peer_done;
+    bool closing;
+} h2_session_t;
+
+/* Set once the server starts draining */
+static atomic_bool draining;
+
+/* Build the HPACK tables */
+void h2_init(void) {
+    hpack_init();
+    atomic_init(&draining, false);
+
+    return;
+}
+
+/* Checks for the preface */
+bool h2_is_preface(const connection_t *conn) {
+    size_t length = conn->length < H2_PREFACE_SIZE ? conn->length
+                                                   : H2_PREFACE_SIZE;
+
+    /* The first line and the blank line after it are enough to tell */
+    return length >= 18 && memcmp(conn->buffer, H2_PREFACE, length) == 0;
+}
+
+/* Stop taking new streams everywhere */
+void h2_drain(void) {
+    atomic_store(&draining, true);
+
+    return;
+}
+
+/* Big endian helpers for frame fields */
+static uint32_t read_u32(const uint8_t *in) {
+    return (uint32_t)in[0] << 24 | (uint32_t)in[1] << 16 |
+           (uint32_t)in[2] << 8 | in[3];
+}
+
+static void write_u32(uint8_t *out, uint32_t value) {
+    out[0] = (uint8_t)(value >> 24);
+    out[1] = (uint8_t)(value >> 16);
+    out[2] = (uint8_t)(value >> 8);
+    out[3] = (uint8_t)value;
+}
+
+/* Fill in a frame header */
+static void write_frame_header(uint8_t *out, size_t length, uint8_t type,
+                               uint8_t flags, uint32_t stream) {
+    out[0] = (uint8_t)(length >> 16);
+    out[1] = (uint8_t)(length >> 8);
+    out[2] = (uint8_t)length;
+    out[3] = type;
+    out[4] = flags;
+    write_u32(out + 5, stream & MAX_WINDOW);
+}
+
+/* Write out everything batched so far */
+static void flush_output(h2_session_t *session) {
+    if (session->output_length > 0 &&
+        !io_write_all(session->fd, session->output,
+                      session->output_length)) {
+        session->closing = true;
+    }
+
+    session->output_length = 0;
+}
+
+/* Add a frame to the output batch */
+/* Payloads are always small, the largest is a response header block */
+static void queue_frame(h2_session_t *session, uint8_t type, uint8_t flags,
+                        uint32_t stream, const void *payload, size_t length) {
+    if (session->output_length + FRAME_HEADER_SIZE + length > OUTPUT_SIZE) {
+        flush_output(session);
+    }
+
+    write_frame_header(session->output + session->output_length, length,
+                       type, flags, stream);
+    session->output_length += FRAME_HEADER_SIZE;
+
+    if (length > 0) {
+        memcpy(session->output + session->output_length, payload, length);
+        session->output_length += length;
+    }
+}
+
+/* End the connection, telling the client why */
+static void connection_error(h2_session_t *session, uint32_t code) {
+    uint8_t payload[8];
+
+    write_u32(payload, session->last_stream);
+    write_u32(payload + 4, code);
+    queue_frame(session, FRAME_GOAWAY, 0, 0, payload, sizeof payload);
+
+    session->closing = true;
+}
+
+/* Find the slot of a stream sending its body */
+static h2_stream_t *find_stream(h2_session_t *session, uint32_t id) {
+    for (size_t i = 0; i < H2_MAX_STREAMS; i++) {
+        if (session->streams[i].id == id) {
+            return &session->streams[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Free a stream's slot */
+static void release_stream(h2_session_t *session, h2_stream_t *stream) {
+    close(stream->file);
+    stream->id = 0;
+    session->active--;
+}
+
+/* End one stream, telling the client why */
+static void reset_stream(h2_session_t *session, uint32_t id, uint32_t code) {
+    h2_stream_t *stream = find_stream(session, id);
+    uint8_t payload[4];
+
+    if (stream) {
+        release_stream(session, stream);
+    }
+
+    write_u32(payload, code);
+    queue_frame(session, FRAME_RST_STREAM, 0, id, payload, sizeof payload);
+}
+
+/* Encode one response field into a header block */
+static void add_field(h2_session_t *session, uint8_t *block, size_t *length,
+                      const char *name, const char *value, bool index) {
+    *length += hpack_encode(&session->encoder, block + *length,
+                            RESPONSE_BLOCK_SIZE - *length, name, value,
+                            index);
+}
+
+/* Queue the response header block for a stream */
+/* Fields that repeat across streams are indexed, per file ones are not */
+static void send_headers(h2_session_t *session, uint32_t id, int status,
+                         const file_meta_t *meta, bool allow,
+                         bool end_stream) {
+    uint8_t block[RESPONSE_BLOCK_SIZE];
+    char date[DATE_HEADER_SIZE], value[VALIDATORS_SIZE], name[32];
+    char *line = NULL, *saveptr = NULL, *separator = NULL;
+    size_t length;
+
+    length = hpack_encode_start(&session->encoder, block);
+
+    snprintf(value, sizeof value, "%d", status);
+    add_field(session, block, &length, ":status", value, true);
+
+    /* Ticker renders "Date: ...\r\n", HPACK only wants the value */
+    ticker_date(date);
+    date[DATE_HEADER_SIZE - 2] = '\0';
+    add_field(session, block, &length, "date", date + strlen("Date: "),
+              true);
+
+    if (allow) {
+        add_field(session, block, &length, "allow", ALLOWED_METHODS, true);
+    }
+
+    if (meta) {
+        add_field(session, block, &length, "content-type", meta->mime_type,
+                  true);
+
+        snprintf(value, sizeof value, "%lld", (long long)meta->size);
+        add_field(session, block, &length, "content-length", value, false);
+
+        /* Validators are pre-rendered for HTTP/1.0, split them back up */
+        snprintf(value, sizeof value, "%s", meta->validators);
+        for (line = strtok_r(value, "\r\n", &saveptr); line;
+             line = strtok_r(NULL, "\r\n", &saveptr)) {
+            separator = strstr(line, ": ");
+            if (!separator || (size_t)(separator - line) >= sizeof name) {
+                continue;
+            }
+
+            for (size_t i = 0; line + i < separator; i++) {
+                name[i] = (char)tolower((unsigned char)line[i]);
+            }
+            name[separator - line] = '\0';
+
+            add_field(session, block, &length, name, separator + 2, false);
+        }
+    } else {
+        add_field(session, block, &length, "content-length", "0", false);
+    }
+
+    queue_frame(session, FRAME_HEADERS,
+                FLAG_END_HEADERS | (end_stream ? FLAG_END_STREAM : 0), id,
+                block, length);
+}
+
+/* Answer a decoded request */
+/* Same answers as HTTP/1.0, file metadata comes from the same cache */
+static void handle_request(h2_session_t *session, uint32_t id) {
+    h2_request_t *request = &session->request;
+    h2_stream_t *stream = NULL;
+    http_method_t method;
+    file_meta_t meta;
+    char path[PATH_MAX];
+    int file;
+
+    if (request->malformed || !request->has_method || !request->has_path) {
+        reset_stream(session, id, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    STAT_INC(h2_streams);
+    method = get_method(request->method);
+
+    /* Streams of one connection may each name a different site */
+    vhost_select(request->has_authority ? request->authority : NULL,
+                 strlen(request->authority));
+
+    if (method == METHOD_OPTIONS) {
+        send_headers(session, id, FOUND, NULL, true, true);
+    } else if (method == METHOD_NOT_ALLOWED) {
+        send_headers(session, id, 405, NULL, true, true);
+    } else if (method == METHOD_NOT_IMPLEMENTED) {
+        send_headers(session, id, 501, NULL, false, true);
+    } else if (!request->normalized && !normalize_uri(request->path)) {
+        send_headers(session, id, 400, NULL, false, true);
+
+    /* Redirects and listings are only answered over HTTP/1.0 */
+    } else if (get_file_status(request->path, &meta) != FOUND) {
+        send_headers(session, id, NOT_FOUND, NULL, false, true);
+
+    /* HEAD and empty files are answered from cached metadata alone */
+    } else if (method == METHOD_HEAD || meta.size == 0) {
+        send_headers(session, id, FOUND, &meta, false, true);
+    } else {
+        /* Directories send their index file */
+        file = webroot_open(get_served_path(request->path, path,
+                                            sizeof path), O_RDONLY);
+        if (file == ERROR) {
+            send_headers(session, id, NOT_FOUND, NULL, false, true);
+            return;
+        }
+
+        send_headers(session, id, FOUND, &meta, false, false);
+
+        /* Body follows in DATA frames, a free slot was checked for */
+        stream = find_stream(session, 0);
+        stream->id = id;
+        stream->file = file;
+        stream->offset = 0;
+        stream->remaining = meta.size;
+        stream->window = session->initial_window;
+        session->active++;
+    }
+}
+
+/* Remember the site a request is for */
+/* Too long a name can't be a configured one, it gets the default host */
+static void set_authority(h2_request_t *request, const char *value) {
+    if (strlen(value) < sizeof request->authority) {
+        snprintf(request->authority, sizeof request->authority, "%s",
+                 value);
+        request->has_authority = true;
+    }
+}
+
+/* Collect the pseudo-headers of a request */
+/* Regular fields aren't needed to serve static files, besides a Host -
+   standing in for :authority */
+static void on_field(void *arg, const char *name, const char *value) {
+    h2_request_t *request = arg;
+
+    if (name[0] != ':') {
+        request->regular_seen = true;
+
+        if (strcmp(name, "host") == 0 && !request->has_authority) {
+            set_authority(request, value);
+        }
+
+        /* Names must be lowercase, and HTTP/1 connection fields are -
+           meaningless here */
+        for (const char *ptr = name; *ptr; ptr++) {
+            if (*ptr >= 'A' && *ptr <= 'Z') {
+                request->malformed = true;
+            }
+        }
+        if (strcmp(name, "connection") == 0) {
+            request->malformed = true;
+        }
+        return;
+    }
+
+    /* Pseudo-headers all come first */
+    if (request->regular_seen) {
+        request->malformed = true;
+    } else if (strcmp(name, ":method") == 0) {
+        request->malformed |= request->has_method ||
+                              strlen(value) >= sizeof request->method;
+        snprintf(request->method, sizeof request->method, "%s", value);
+        request->has_method = true;
+    } else if (strcmp(name, ":path") == 0) {
+        request->malformed |= request->has_path || value[0] != '/' ||
+                              strlen(value) >= sizeof request->path;
+        snprintf(request->path, sizeof request->path, "%s", value);
+        request->has_path = true;
+    } else if (strcmp(name, ":authority") == 0) {
+        request->malformed |= request->has_authority;
+        set_authority(request, value);
+    } else if (strcmp(name, ":scheme") != 0) {
+        request->malformed = true;
+    }
+}
+
+/* Decode a complete header block and answer it if it opened a stream */
+static void finish_block(h2_session_t *session) {
+    memset(&session->request, '\0', sizeof session->request);
+    session->in_block = false;
+
+    /* Decoded even when refused, so both tables stay in step */
+    if (!hpack_decode(&session->decoder, session->block,
+                      session->block_length, on_field, &session->request)) {
+        connection_error(session, H2_COMPRESSION_ERROR);
+        return;
+    }
+
+    session->block_length = 0;
+
+    /* Trailers of a stream already answered */
+    if (!session->block_new) {
+        return;
+    }
+
+    if (atomic_load(&draining)) {
+        reset_stream(session, session->block_stream, H2_REFUSED_STREAM);
+    } else if (session->active == H2_MAX_STREAMS) {
+        reset_stream(session, session->block_stream, H2_REFUSED_STREAM);
+    } else {
+        handle_request(session, session->block_stream);
+    }
+}
+
+/* Add a header block fragment */
+static void append_block(h2_session_t *session, const uint8_t *fragment,
+                         size_t length, uint8_t flags) {
+    if (session->block_length + length > BLOCK_SIZE) {
+        connection_error(session, H2_ENHANCE_YOUR_CALM);
+        return;
+    }
+
+    memcpy(session->block + session->block_length, fragment, length);
+    session->block_length += length;
+
+    if (flags & FLAG_END_HEADERS) {
+        finish_block(session);
+    } else {
+        session->in_block = true;
+    }
+}
+
+/* HEADERS opens a stream, or carries trailers of one */
+static void on_headers(h2_session_t *session, uint8_t flags, uint32_t id,
+                       const uint8_t *payload, size_t length) {
+    size_t padding = 0;
+
+    if (id == 0 || id % 2 == 0) {
+        connection_error(session, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    if (flags & FLAG_PADDED) {
+        if (length < 1) {
+            connection_error(session, H2_FRAME_SIZE_ERROR);
+            return;
+        }
+        padding = payload[0];
+        payload++;
+        length--;
+    }
+
+    /* Priority hints are ignored, every stream gets an equal share */
+    if (flags & FLAG_PRIORITY) {
+        if (length < 5) {
+            connection_error(session, H2_FRAME_SIZE_ERROR);
+            return;
+        }
+        payload += 5;
+        length -= 5;
+    }
+
+    if (padding > length) {
+        connection_error(session, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    session->active_since = timer_now_ms();
+    session->block_stream = id;
+    session->block_new = id > session->last_stream;
+    if (session->block_new) {
+        session->last_stream = id;
+    }
+
+    append_block(session, payload, length - padding, flags);
+}
+
+/* Request bodies aren't used, but their window still has to be given back */
+static void on_data(h2_session_t *session, uint8_t flags, uint32_t id,
+                    size_t length) {
+    uint8_t payload[4];
+
+    if (id == 0 || id > session->last_stream) {
+        connection_error(session, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    session->active_since = timer_now_ms();
+
+    if (length == 0) {
+        return;
+    }
+
+    write_u32(payload, (uint32_t)length);
+    queue_frame(session, FRAME_WINDOW_UPDATE, 0, 0, payload, sizeof payload);
+
+    if (!(flags & FLAG_END_STREAM)) {
+        queue_frame(session, FRAME_WINDOW_UPDATE, 0, id, payload,
+                    sizeof payload);
+    }
+}
+
+/* Apply the client's settings */
+static void apply_settings(h2_session_t *session, const uint8_t *payload,
+                           size_t length) {
+    uint32_t value;
+    int64_t delta;
+
+    for (size_t i = 0; i + SETTING_SIZE <= length; i += SETTING_SIZE) {
+        value = read_u32(payload + i + 2);
+
+        switch (payload[i] << 8 | payload[i + 1]) {
+        case SETTINGS_HEADER_TABLE_SIZE:
+            hpack_set_limit(&session->encoder, value);
+            break;
+        case SETTINGS_ENABLE_PUSH:
+            if (value > 1) {
+                connection_error(session, H2_PROTOCOL_ERROR);
+                return;
+            }
+            break;
+        case SETTINGS_INITIAL_WINDOW_SIZE:
+            if (value > MAX_WINDOW) {
+                connection_error(session, H2_FLOW_CONTROL_ERROR);
+                return;
+            }
+
+            /* Applies to streams already open too */
+            delta = (int64_t)value - session->initial_window;
+            for (size_t j = 0; j < H2_MAX_STREAMS; j++) {
+                session->streams[j].window += delta;
+            }
+            session->initial_window = value;
+            break;
+        case SETTINGS_MAX_FRAME_SIZE:
+            if (value < H2_FRAME_SIZE || value > MAX_FRAME_LIMIT) {
+                connection_error(session, H2_PROTOCOL_ERROR);
+                return;
+            }
+
+            /* Bigger frames would only make streams take longer turns */
+            session->max_frame = H2_FRAME_SIZE;
+            break;
+        default:
+            /* Unknown settings must be ignored */
+            break;
+        }
+    }
+}
+
+/* SETTINGS, acknowledged once applied */
+static void on_settings(h2_session_t *session, uint8_t flags, uint32_t id,
+                        const uint8_t *payload, size_t length) {
+    if (id != 0) {
+        connection_error(session, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    if (flags & FLAG_ACK) {
+        if (length != 0) {
+            connection_error(session, H2_FRAME_SIZE_ERROR);
+        }
+        return;
+    }
+
+    if (length % SETTING_SIZE != 0) {
+        connection_error(session, H2_FRAME_SIZE_ERROR);
+        return;
+    }
+
+    apply_settings(session, payload, length);
+    queue_frame(session, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+}
+
+/* WINDOW_UPDATE lets more of a body out */
+static void on_window_update(h2_session_t *session, uint32_t id,
+                             const uint8_t *payload, size_t length) {
+    h2_stream_t *stream = NULL;
+    uint32_t increment;
+
+    if (length != 4) {
+        connection_error(session, H2_FRAME_SIZE_ERROR);
+        return;
+    }
+
+    increment = read_u32(payload) & MAX_WINDOW;
+
+    if (id == 0) {
+        session->window += increment;
+        if (increment == 0) {
+            connection_error(session, H2_PROTOCOL_ERROR);
+        } else if (session->window > MAX_WINDOW) {
+            connection_error(session, H2_FLOW_CONTROL_ERROR);
+        }
+        return;
+    }
+
+    /* Streams already finished may still get one */
+    stream = find_stream(session, id);
+    if (!stream) {
+        return;
+    }
+
+    stream->window += increment;
+    if (increment == 0) {
+        reset_stream(session, id, H2_PROTOCOL_ERROR);
+    } else if (stream->window > MAX_WINDOW) {
+        reset_stream(session, id, H2_FLOW_CONTROL_ERROR);
+    }
+}
+
+/* Handle one complete frame */
+static void process_frame(h2_session_t *session, uint8_t type, uint8_t flags,
+                          uint32_t id, const uint8_t *payload,
+                          size_t length) {
+    /* Client has to open with its settings */
+    if (!session->settings_seen && type != FRAME_SETTINGS) {
+        connection_error(session, H2_PROTOCOL_ERROR);
+        return;
+    }
+    session->settings_seen = true;
+
+    /* Nothing may interleave with a header block */
+    if (session->in_block &&
+        (type != FRAME_CONTINUATION || id != session->block_stream)) {
+        connection_error(session, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    switch (type) {
+    case FRAME_DATA:
+        on_data(session, flags, id, length);
+        break;
+    case FRAME_HEADERS:
+        on_headers(session, flags, id, payload, length);
+        break;
+    case FRAME_CONTINUATION:
+        if (!session->in_block) {
+            connection_error(session, H2_PROTOCOL_ERROR);
+            return;
+        }
+        append_block(session, payload, length, flags);
+        break;
+    case FRAME_PRIORITY:
+        if (id == 0) {
+            connection_error(session, H2_PROTOCOL_ERROR);
+        } else if (length != 5) {
+            connection_error(session, H2_FRAME_SIZE_ERROR);
+        }
+        break;
+    case FRAME_RST_STREAM:
+        if (id == 0 || id > session->last_stream) {
+            connection_error(session, H2_PROTOCOL_ERROR);
+        } else if (length != 4) {
+            connection_error(session, H2_FRAME_SIZE_ERROR);
+        } else if (find_stream(session, id)) {
+            release_stream(session, find_stream(session, id));
+        }
+        break;
+    case FRAME_SETTINGS:
+        on_settings(session, flags, id, payload, length);
+        break;
+    case FRAME_PING:
+        if (id != 0) {
+            connection_error(session, H2_PROTOCOL_ERROR);
+        } else if (length != 8) {
+            connection_error(session, H2_FRAME_SIZE_ERROR);
+        } else if (!(flags & FLAG_ACK)) {
+            queue_frame(session, FRAME_PING, FLAG_ACK, 0, payload, length);
+        }
+        break;
+    case FRAME_GOAWAY:
+        /* Client opens nothing more, finish what it already asked for */
+        session->peer_done = true;
+        break;
+    case FRAME_WINDOW_UPDATE:
+        on_window_update(session, id, payload, length);
+        break;
+    case FRAME_PUSH_PROMISE:
+        /* Only servers push */
+        connection_error(session, H2_PROTOCOL_ERROR);
+        break;
+    default:
+        /* Unknown frame types must be ignored */
+        break;
+    }
+}
+
+/* Handle every complete frame in the input buffer */
+static void process_input(h2_session_t *session) {
+    const uint8_t *frame = session->input;
+    size_t available = session->input_length, length, compare;
+
+    if (!session->preface_seen) {
+        compare = available < H2_PREFACE_SIZE ? available : H2_PREFACE_SIZE;
+        if (memcmp(frame, H2_PREFACE, compare) != 0) {
+            connection_error(session, H2_PROTOCOL_ERROR);
+            return;
+        }
+
+        if (available < H2_PREFACE_SIZE) {
+            return;
+        }
+
+        frame += H2_PREFACE_SIZE;
+        available -= H2_PREFACE_SIZE;
+        session->preface_seen = true;
+    }
+
+    while (!session->closing && available >= FRAME_HEADER_SIZE) {
+        length = (size_t)frame[0] << 16 | (size_t)frame[1] << 8 | frame[2];
+
+        /* We never raised the frame size above the default */
+        if (length > H2_FRAME_SIZE) {
+            connection_error(session, H2_FRAME_SIZE_ERROR);
+            return;
+        }
+
+        if (available < FRAME_HEADER_SIZE + length) {
+            break;
+        }
+
+        process_frame(session, frame[3], frame[4],
+                      read_u32(frame + 5) & MAX_WINDOW,
+                      frame + FRAME_HEADER_SIZE, length);
+
+        frame += FRAME_HEADER_SIZE + length;
+        available -= FRAME_HEADER_SIZE + length;
+    }
+
+    /* Keep the partial frame at the front */
+    memmove(session->input, frame, available);
+    session->input_length = available;
+}
+
+/* Read whatever has arrived, waiting up to timeout ms for something */
+/* Returns 1 if bytes were read, 0 on timeout, ERROR once the client is -
+   gone */
+static int read_input(h2_session_t *session, int timeout) {
+    struct pollfd ready = { .fd = session->fd, .events = POLLIN };
+    ssize_t bytes;
+    int result;
+
+    result = poll(&ready, 1, timeout);
+    if (result == ERROR) {
+        return errno == EINTR ? 0 : ERROR;
+    }
+    if (result == 0) {
+        return 0;
+    }
+
+    bytes = read(session->fd, session->input + session->input_length,
+                 INPUT_SIZE - session->input_length);
+    if (bytes == ERROR) {
+        return errno == EAGAIN || errno == EINTR ? 0 : ERROR;
+    }
+    if (bytes == 0) {
+        return ERROR;
+    }
+
+    session->input_length += (size_t)bytes;
+
+    return 1;
+}
+
+/* Bytes a stream may send in its next frame */
+static size_t sendable(const h2_session_t *session,
+                       const h2_stream_t *stream) {
+    int64_t length = stream->remaining;
+
+    if (length > stream->window) {
+        length = stream->window;
+    }
+    if (length > session->window) {
+        length = session->window;
+    }
+    if (length > session->max_frame) {
+        length = session->max_frame;
+    }
+
+    return length > 0 ? (size_t)length : 0;
+}
+
+/* Checks if any stream can send right now */
+static bool any_sendable(const h2_session_t *session) {
+    for (size_t i = 0; i < H2_MAX_STREAMS; i++) {
+        if (session->streams[i].id && sendable(session, &session->streams[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Send part of a file with sendfile(), or splice where that isn't -
+   supported */
+/* Returns bytes sent, less than length if the client or file went away */
+static size_t send_range(int client, int file, off_t *offset, size_t length) {
+    size_t sent = 0;
+    ssize_t bytes;
+
+    while (sent < length) {
+        bytes = sendfile(client, file, offset, length - sent);
+        if (bytes == ERROR && errno == EINTR) {
+            continue;
+        }
+
+        if (bytes == ERROR && errno == EAGAIN && io_wait(client, POLLOUT)) {
+            continue;
+        }
+
+        if (bytes == ERROR && (errno == EINVAL || errno == ENOSYS) &&
+            sent == 0) {
+            return splice_to_socket(client, file, offset, length);
+        }
+
+        if (bytes <= 0) {
+            break;
+        }
+
+        sent += (size_t)bytes;
+    }
+
+    return sent;
+}
+
+/* One DATA frame for each stream that can send, in turn */
+static void send_round(h2_session_t *session) {
+    uint8_t header[FRAME_HEADER_SIZE];
+    h2_stream_t *stream = NULL;
+    size_t length;
+    bool end;
+
+    /* Response headers go out before any body */
+    flush_output(session);
+
+    for (size_t i = 0; i < H2_MAX_STREAMS && !session->closing; i++) {
+        stream = &session->streams[(session->next + i) % H2_MAX_STREAMS];
+        if (!stream->id) {
+            continue;
+        }
+
+        length = sendable(session, stream);
+        if (length == 0) {
+            continue;
+        }
+
+        end = (off_t)length == stream->remaining;
+        write_frame_header(header, length, FRAME_DATA,
+                           end ? FLAG_END_STREAM : 0, stream->id);
+
+        /* A short body can't be patched up once the frame length is out */
+        if (!io_write_all(session->fd, header, sizeof header) ||
+            send_range(session->fd, stream->file, &stream->offset,
+                       length) != length) {
+            session->closing = true;
+            break;
+        }
+
+        stream->remaining -= (off_t)length;
+        stream->window -= (int64_t)length;
+        session->window -= (int64_t)length;
+        session->active_since = timer_now_ms();
+
+        if (end) {
+            release_stream(session, stream);
+        }
+    }
+
+    /* Next round starts one stream further on */
+    session->next = (session->next + 1) % H2_MAX_STREAMS;
+}
+
+/* Send the server preface, our only non-default setting */
+static void start_session(h2_session_t *session) {
+    uint8_t settings[SETTING_SIZE];
+
+    STAT_INC(h2_connections);
+
+    settings[0] = 0;
+    settings[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+    write_u32(settings + 2, H2_MAX_STREAMS);
+    queue_frame(session, FRAME_SETTINGS, 0, 0, settings, sizeof settings);
+}
+
+/* Run a connection until it ends, idles out or goes quiet */
+/* Returns true if it was parked in the reactor, the connection stays -
+   open and the session lives on in it */
+static bool run_session(h2_session_t *session) {
+    connection_t *conn = session->conn;
+    int result;
+
+    process_input(session);
+
+    while (!session->closing) {
+        /* Bodies have to go out before the write deadline */
+        if (any_sendable(session)) {
+            timer_add(&conn->timer, config.write_timeout, conn_expired,
+                      conn);
+            tune_cork(conn, true);
+            send_round(session);
+            tune_cork(conn, false);
+            timer_cancel(&conn->timer);
+        }
+
+        flush_output(session);
+
+        /* Finished everything the client or a drain will let it ask for */
+        if (session->active == 0 &&
+            (session->peer_done || atomic_load(&draining))) {
+            connection_error(session, H2_NO_ERROR);
+            break;
+        }
+
+        /* No request or body progress for a whole header timeout. PINGs -
+           alone can't keep a worker, or a stalled stream, forever */
+        if (timer_now_ms() - session->active_since >=
+            (uint64_t)config.header_timeout) {
+            connection_error(session, H2_NO_ERROR);
+            break;
+        }
+
+        /* Check for frames without stopping while bodies can go out */
+        result = read_input(session,
+                            any_sendable(session) ? 0 : H2_POLL_MS);
+        if (result == ERROR) {
+            session->closing = true;
+        } else if (result > 0) {
+            process_input(session);
+        } else if (session->active == 0 && session->output_length == 0) {
+            /* Quiet with nothing to send, wait for the next frame in -
+               the reactor and give the worker back */
+            conn->h2 = session;
+            reactor_park_session(conn, session->active_since);
+            return true;
+        }
+    }
+
+    flush_output(session);
+
+    return false;
+}
+
+/* Set up a connection, input starts with whatever was already buffered */
+static h2_session_t *create_session(connection_t *conn, const char *input,
+                                    size_t length) {
+    h2_session_t *session = NULL;
+
+    session = calloc(1, sizeof *session);
+    if (!session) {
+        perror("Error: calloc() failed to allocate HTTP/2 session");
+        exit(EXIT_FAILURE);
+    }
+
+    session->conn = conn;
+    session->fd = conn->fd;
+    session->active_since = timer_now_ms();
+    session->window = DEFAULT_WINDOW;
+    session->initial_window = DEFAULT_WINDOW;
+    session->max_frame = H2_FRAME_SIZE;
+
+    hpack_table_init(&session->decoder);
+    hpack_table_init(&session->encoder);
+
+    memcpy(session->input, input, length);
+    session->input_length = length;
+
+    return session;
+}
+
+/* Close every body still open and free the connection */
+static void destroy_session(h2_session_t *session) {
+    for (size_t i = 0; i < H2_MAX_STREAMS; i++) {
+        if (session->streams[i].id) {
+            release_stream(session, &session->streams[i]);
+        }
+    }
+
+    hpack_table_free(&session->decoder);
+    hpack_table_free(&session->encoder);
+    free(session);
+}
+
+/* Run a session, closing the connection unless it was parked */
+static void serve_session(h2_session_t *session) {
+    connection_t *conn = session->conn;
+
+    if (!run_session(session)) {
+        destroy_session(session);
+        conn_close(conn);
+    }
+}
+
+/* Serve a prior knowledge connection */
+void h2_serve(connection_t *conn) {
+    h2_session_t *session = create_session(conn, conn->buffer, conn->length);
+
+    start_session(session);
+    serve_session(session);
+
+    return;
+}
+
+/* Pick a parked connection back up */
+void h2_resume(connection_t *conn) {
+    h2_session_t *session = conn->h2;
+
+    conn->h2 = NULL;
+    serve_session(session);
+
+    return;
+}
+
+/* Give up on a parked connection */
+/* Runs under the wheel lock too, so the GOAWAY is never waited on */
+void h2_abandon(connection_t *conn) {
+    h2_session_t *session = conn->h2;
+    uint8_t frame[FRAME_HEADER_SIZE + 8];
+
+    write_frame_header(frame, 8, FRAME_GOAWAY, 0, 0);
+    write_u32(frame + FRAME_HEADER_SIZE, session->last_stream);
+    write_u32(frame + FRAME_HEADER_SIZE + 4, H2_NO_ERROR);
+    send(conn->fd, frame, sizeof frame, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    conn->h2 = NULL;
+    destroy_session(session);
+
+    return;
+}
+
+/* Value of one base64url character, ERROR if it isn't one */
+static int base64url_value(char c) {
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A';
+    } else if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 26;
+    } else if (c >= '0' && c <= '9') {
+        return c - '0' + 52;
+    } else if (c == '-') {
+        return 62;
+    } else if (c == '_') {
+        return 63;
+    }
+
+    return ERROR;
+}
+
+/* Decode unpadded base64url */
+/* Returns decoded bytes, or ERROR if malformed or too long for out */
+static int base64url_decode(const char *in, size_t length, uint8_t *out,
+                            size_t space) {
+    uint32_t bits = 0;
+    size_t count = 0;
+    int value, held = 0;
+
+    for (size_t i = 0; i < length && in[i] != '='; i++) {
+        value = base64url_value(in[i]);
+        if (value == ERROR) {
+            return ERROR;
+        }
+
+        bits = bits << 6 | (uint32_t)value;
+        held += 6;
+
+        if (held >= 8) {
+            held -= 8;
+            if (count == space) {
+                return ERROR;
+            }
+            out[count++] = (uint8_t)(bits >> held);
+        }
+    }
+
+    return (int)count;
+}
+
+/* Upgrade an HTTP/1.1 request */
+bool h2_serve_upgrade(connection_t *conn, const http_request_t *request,
+                      const char *settings, size_t length) {
+    static const char switching[] = "HTTP/1.1 101 Switching Protocols\r\n"
+                                    "Connection: Upgrade\r\n"
+                                    "Upgrade: h2c\r\n\r\n";
+    uint8_t payload[SETTING_SIZE * 16];
+    h2_session_t *session = NULL;
+    const char *end = NULL;
+    int decoded;
+
+    decoded = base64url_decode(settings, length, payload, sizeof payload);
+    if (decoded == ERROR || decoded % SETTING_SIZE != 0 ||
+        strlen(request->URI) >= sizeof session->request.path) {
+        return false;
+    }
+
+    /* Anything after the HTTP/1.1 header is already HTTP/2 */
+    end = strstr(conn->buffer, "\r\n\r\n");
+    end = end ? end + 4 : conn->buffer + conn->length;
+
+    session = create_session(conn, end,
+                             conn->length - (size_t)(end - conn->buffer));
+
+    if (!io_write_all(conn->fd, switching, strlen(switching))) {
+        destroy_session(session);
+        conn_close(conn);
+        return true;
+    }
+
+    /* Settings in the header count as the client's first SETTINGS, -
+       without an acknowledgement */
+    apply_settings(session, payload, (size_t)decoded);
+
+    /* Request becomes stream 1, already closed from the client's side */
+    session->last_stream = 1;
+    session->request.has_method = true;
+    session->request.has_path = true;
+    session->request.normalized = true;
+    session->request.malformed = strlen(request->method) >=
+                                 sizeof session->request.method;
+    snprintf(session->request.method, sizeof session->request.method, "%s",
+             request->method);
+    snprintf(session->request.path, sizeof session->request.path, "%s",
+             request->URI);
+
+    /* Same site the HTTP/1.1 request asked for */
+    if (request->headers[HEADER_HOST]) {
+        snprintf(session->request.authority,
+                 sizeof session->request.authority, "%.*s",
+                 (int)request->header_lengths[HEADER_HOST],
+                 request->headers[HEADER_HOST]);
+        session->request.has_authority = true;
+    }
+
+    start_session(session);
+    handle_request(session, 1);
+    serve_session(session);
+
+    return true;
+}
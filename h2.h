@@ -0,0 +1,61 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: h2.h
+ * Purpose: HTTP/2 header file. Defines cleartext HTTP/2 connections, -
+            started with prior knowledge or by upgrading an HTTP/1.1 request
+ */
+
+#ifndef H2_H
+#define H2_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "conn.h"
+#include "http.h"
+
+/* Every HTTP/2 client opens with this */
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_SIZE 24
+
+/* Streams sending a body at once, advertised to clients */
+#define H2_MAX_STREAMS 100
+
+/* Largest frame payload, the protocol default, used in both directions */
+#define H2_FRAME_SIZE 16384
+
+/* How long a connection with nothing to send waits on its worker for the -
+   next frame, before it is parked in the reactor */
+#define H2_POLL_MS 250
+
+/* Build the HPACK tables, once at startup */
+void h2_init(void);
+
+/* Checks if a connection opened with the HTTP/2 preface */
+/* Only needs the first line, the rest may still be on its way */
+bool h2_is_preface(const connection_t *conn);
+
+/* Serve a prior knowledge HTTP/2 connection until it ends or idles out */
+/* Closes the connection, or parks it in the reactor between requests */
+void h2_serve(connection_t *conn);
+
+/* Carry on serving a parked connection that became readable */
+/* Closes or parks it again, like h2_serve() */
+void h2_resume(connection_t *conn);
+
+/* Send GOAWAY to a parked connection without blocking and free its -
+   session, the caller closes it */
+void h2_abandon(connection_t *conn);
+
+/* Switch an HTTP/1.1 request asking for h2c over to HTTP/2, and answer it -
+   as stream 1. settings is the HTTP2-Settings header value */
+/* Returns false, having sent nothing, if the settings are malformed. -
+   Otherwise the connection is closed or parked, like h2_serve() */
+bool h2_serve_upgrade(connection_t *conn, const http_request_t *request,
+                      const char *settings, size_t length);
+
+/* Ask every connection to finish its streams and close, for shutdown */
+void h2_drain(void);
+
+#endif
@@ -0,0 +1,263 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: handoff.c
+ * Purpose: listening socket handoff module. The old server execs the new -
+            binary, sends it the listening sockets with SCM_RIGHTS and waits -
+            for it to start accepting. The sockets are never closed in -
+            between, so the kernel accept backlog survives the restart
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "handoff.h"
+#include "http.h"
+
+extern char **environ;
+
+/* Channel back to the old server, while the handoff is in progress */
+static int channel = ERROR;
+
+/* Build a copy of the environment with the channel added */
+static char **handoff_environment(int fd) {
+    char **envp = NULL;
+    size_t count = 0, i = 0;
+
+    while (environ[count]) {
+        count++;
+    }
+
+    envp = malloc((count + 2) * sizeof *envp);
+    if (!envp) {
+        perror("Error: malloc() failed to allocate environment");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Copy everything except a stale channel from an earlier handoff */
+    for (size_t j = 0; j < count; j++) {
+        if (strncmp(environ[j], HANDOFF_ENV "=", strlen(HANDOFF_ENV) + 1)) {
+            envp[i++] = environ[j];
+        }
+    }
+
+    envp[i] = malloc(strlen(HANDOFF_ENV) + 16);
+    if (!envp[i]) {
+        perror("Error: malloc() failed to allocate environment");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(envp[i], "%s=%d", HANDOFF_ENV, fd);
+    envp[i + 1] = NULL;
+
+    return envp;
+}
+
+/* Free an environment built by handoff_environment() */
+static void free_environment(char **envp) {
+    size_t i = 0;
+
+    while (envp[i + 1]) {
+        i++;
+    }
+
+    /* Only the last entry is ours */
+    free(envp[i]);
+    free(envp);
+}
+
+/* Send listening sockets down the channel */
+static bool send_fds(int sock, const int *fds, size_t count) {
+    char control[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+    char payload = 'F';
+    struct iovec iov = { .iov_base = &payload, .iov_len = 1 };
+    struct msghdr msg;
+    struct cmsghdr *cmsg = NULL;
+
+    memset(control, '\0', sizeof control);
+    memset(&msg, '\0', sizeof msg);
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+}
+
+/* Find the path to exec the new server from */
+/* A bare name was found through PATH, so it's looked up as the running -
+   binary instead. Returns false if it can't be */
+static bool executable_path(const char *name, char *path, size_t size) {
+    static const char deleted[] = " (deleted)";
+    size_t deleted_length = sizeof deleted - 1;
+    ssize_t length;
+
+    if (strchr(name, '/')) {
+        snprintf(path, size, "%s", name);
+        return true;
+    }
+
+    length = readlink("/proc/self/exe", path, size - 1);
+    if (length == ERROR) {
+        perror("Error: cannot find the server binary for handoff");
+        return false;
+    }
+    path[length] = '\0';
+
+    /* Binary replaced by a new deploy, which is the one wanted */
+    if ((size_t)length > deleted_length &&
+        strcmp(path + length - deleted_length, deleted) == 0) {
+        path[length - deleted_length] = '\0';
+    }
+
+    return true;
+}
+
+/* Exec a new server and hand it the listening sockets */
+bool handoff_start(char *argv[], const int *fds, size_t count) {
+    struct pollfd ack = { .events = POLLIN };
+    char **envp = NULL, reply, path[PATH_MAX];
+    int pair[2];
+    sigset_t none;
+    pid_t pid;
+
+    if (count == 0 || count > HANDOFF_MAX_FDS ||
+        !executable_path(argv[0], path, sizeof path)) {
+        return false;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) == ERROR) {
+        perror("Error: socketpair() failed for handoff");
+        return false;
+    }
+
+    /* Everything the child needs is prepared before forking, only -
+       async signal safe calls are allowed between fork() and exec() */
+    envp = handoff_environment(pair[1]);
+    sigemptyset(&none);
+
+    pid = fork();
+    if (pid == ERROR) {
+        perror("Error: fork() failed for handoff");
+        close(pair[0]);
+        close(pair[1]);
+        free_environment(envp);
+        return false;
+    }
+
+    if (pid == 0) {
+        /* Don't leak client sockets into the new server, only the channel */
+        close_range(3, ~0U, CLOSE_RANGE_CLOEXEC);
+        fcntl(pair[1], F_SETFD, 0);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+
+        /* Same path and arguments, so a freshly deployed binary is used */
+        execve(path, argv, envp);
+        _exit(EXIT_FAILURE);
+    }
+
+    close(pair[1]);
+    free_environment(envp);
+
+    /* Pass the sockets, then wait until the new server is accepting */
+    ack.fd = pair[0];
+    if (!send_fds(pair[0], fds, count) ||
+        poll(&ack, 1, HANDOFF_TIMEOUT) != 1 ||
+        read(pair[0], &reply, 1) != 1) {
+
+        fprintf(stderr, "Error: new server did not take over, "
+                        "carrying on\n");
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        close(pair[0]);
+        return false;
+    }
+
+    close(pair[0]);
+
+    return true;
+}
+
+/* Receive listening sockets from an old server */
+size_t handoff_receive(int *fds, size_t max) {
+    char control[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+    char payload;
+    struct iovec iov = { .iov_base = &payload, .iov_len = 1 };
+    struct msghdr msg;
+    struct cmsghdr *cmsg = NULL;
+    const char *value = getenv(HANDOFF_ENV);
+    size_t count;
+
+    /* Normal startup */
+    if (!value) {
+        return 0;
+    }
+
+    channel = atoi(value);
+    unsetenv(HANDOFF_ENV);
+    fcntl(channel, F_SETFD, FD_CLOEXEC);
+
+    memset(&msg, '\0', sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+
+    /* Received sockets are close on exec, a later handoff passes them on -
+       explicitly */
+    if (recvmsg(channel, &msg, MSG_CMSG_CLOEXEC) != 1) {
+        perror("Error: recvmsg() failed to receive listening sockets");
+        exit(EXIT_FAILURE);
+    }
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS) {
+        fprintf(stderr, "Error: handoff carried no listening sockets\n");
+        exit(EXIT_FAILURE);
+    }
+
+    count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    if (count > max) {
+        fprintf(stderr, "Error: too many listening sockets handed over\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+    printf("Took over %zu listening socket(s).\n", count);
+
+    return count;
+}
+
+/* Let the old server know we are accepting */
+void handoff_complete(void) {
+    char reply = 'A';
+
+    if (channel == ERROR) {
+        return;
+    }
+
+    if (write(channel, &reply, 1) != 1) {
+        perror("Error: cannot acknowledge handoff");
+    }
+
+    close(channel);
+    channel = ERROR;
+
+    return;
+}
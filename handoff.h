@@ -0,0 +1,35 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: handoff.h
+ * Purpose: listening socket handoff header file. Defines passing listening -
+            sockets to a freshly exec'd server over a unix socket
+ */
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Environment variable naming the handoff channel in the new server */
+#define HANDOFF_ENV "SERVER_HANDOFF_FD"
+
+/* Most listening sockets passed in one handoff */
+#define HANDOFF_MAX_FDS 16
+
+/* How long the old server waits for the new one to come up */
+#define HANDOFF_TIMEOUT 10000
+
+/* Exec a new server and pass it the listening sockets */
+/* Returns true once the new server has taken them over */
+bool handoff_start(char *argv[], const int *fds, size_t count);
+
+/* Receive listening sockets from an old server, if started by one */
+/* Returns number of sockets received, 0 if not started by a handoff */
+size_t handoff_receive(int *fds, size_t max);
+
+/* Tell the old server this one is accepting, so it can start draining */
+void handoff_complete(void);
+
+#endif
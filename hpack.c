@@ -0,0 +1,630 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: hpack.c
+ * Purpose: HPACK module. Decodes request header blocks against the static -
+            and the peer's dynamic table, and encodes responses so fields -
+            repeated across streams, like Date and Content-Type, shrink to a -
+            byte or two. Strings are Huffman coded whenever that is shorter
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hpack.h"
+#include "http.h"
+
+/* Huffman code of one symbol, right aligned */
+typedef struct {
+    uint32_t code;
+    uint8_t bits;
+} huffman_code_t;
+
+/* Static table, index 1 onwards (RFC 7541 Appendix A) */
+static const struct {
+    const char *name;
+    const char *value;
+} static_table[] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"},
+    {":path", "/"}, {":path", "/index.html"}, {":scheme", "http"},
+    {":scheme", "https"}, {":status", "200"}, {":status", "204"},
+    {":status", "206"}, {":status", "304"}, {":status", "400"},
+    {":status", "404"}, {":status", "500"}, {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"}, {"accept-language", ""},
+    {"accept-ranges", ""}, {"accept", ""},
+    {"access-control-allow-origin", ""}, {"age", ""}, {"allow", ""},
+    {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""},
+    {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""},
+    {"content-type", ""}, {"cookie", ""}, {"date", ""}, {"etag", ""},
+    {"expect", ""}, {"expires", ""}, {"from", ""}, {"host", ""},
+    {"if-match", ""}, {"if-modified-since", ""}, {"if-none-match", ""},
+    {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+    {"link", ""}, {"location", ""}, {"max-forwards", ""},
+    {"proxy-authenticate", ""}, {"proxy-authorization", ""},
+    {"range", ""}, {"referer", ""}, {"refresh", ""}, {"retry-after", ""},
+    {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+    {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""},
+    {"via", ""}, {"www-authenticate", ""}
+};
+
+/* Huffman codes by symbol, 256 is end of string (RFC 7541 Appendix B) */
+static const huffman_code_t huffman_codes[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30}
+};
+
+/* Decoding tree, children of each internal node by bit */
+/* Positive is another node, negative is a symbol, -(symbol + 1) */
+static int16_t huffman_tree[256][2];
+
+/* Build the decoding tree from the code table */
+void hpack_init(void) {
+    int16_t nodes = 1, node, *child;
+
+    for (int symbol = 0; symbol < 257; symbol++) {
+        node = 0;
+
+        for (int bit = huffman_codes[symbol].bits - 1; bit >= 0; bit--) {
+            child = &huffman_tree[node][(huffman_codes[symbol].code >> bit) &
+                                        1];
+
+            if (bit == 0) {
+                *child = (int16_t)-(symbol + 1);
+            } else {
+                /* Root is never a child, so 0 means not built yet */
+                if (*child == 0) {
+                    *child = nodes++;
+                }
+                node = *child;
+            }
+        }
+    }
+
+    return;
+}
+
+/* Decode a Huffman string into out, which holds space bytes */
+/* Padding must be under a byte of ones, the prefix of end of string */
+static bool huffman_decode(const uint8_t *in, size_t length, char *out,
+                           size_t space, size_t *written) {
+    int16_t node = 0, next;
+    size_t count = 0;
+    int depth = 0;
+    bool ones = true;
+    int bit;
+
+    for (size_t i = 0; i < length; i++) {
+        for (int shift = 7; shift >= 0; shift--) {
+            bit = (in[i] >> shift) & 1;
+            next = huffman_tree[node][bit];
+
+            if (next >= 0) {
+                node = next;
+                depth++;
+                ones = ones && bit;
+                continue;
+            }
+
+            /* Explicit end of string is an error */
+            if (next == -257 || count == space) {
+                return false;
+            }
+
+            out[count++] = (char)(-next - 1);
+            node = 0;
+            depth = 0;
+            ones = true;
+        }
+    }
+
+    if (depth > 7 || !ones) {
+        return false;
+    }
+
+    *written = count;
+
+    return true;
+}
+
+/* Length of a string once Huffman coded */
+static size_t huffman_length(const char *string, size_t length) {
+    size_t bits = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        bits += huffman_codes[(unsigned char)string[i]].bits;
+    }
+
+    return (bits + 7) / 8;
+}
+
+/* Huffman code a string, padding the last byte with ones */
+static size_t huffman_encode(const char *string, size_t length,
+                             uint8_t *out) {
+    const huffman_code_t *code = NULL;
+    uint64_t pending = 0;
+    size_t count = 0;
+    int bits = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        code = &huffman_codes[(unsigned char)string[i]];
+        pending = (pending << code->bits) | code->code;
+        bits += code->bits;
+
+        while (bits >= 8) {
+            bits -= 8;
+            out[count++] = (uint8_t)(pending >> bits);
+        }
+        pending &= (UINT64_C(1) << bits) - 1;
+    }
+
+    if (bits > 0) {
+        out[count++] = (uint8_t)((pending << (8 - bits)) |
+                                 ((1u << (8 - bits)) - 1));
+    }
+
+    return count;
+}
+
+/* Encode an integer behind a prefix of the given bits */
+static size_t encode_integer(uint8_t *out, uint8_t first, int prefix,
+                             size_t value) {
+    size_t max = ((size_t)1 << prefix) - 1, count = 1;
+
+    if (value < max) {
+        out[0] = (uint8_t)(first | value);
+        return 1;
+    }
+
+    out[0] = (uint8_t)(first | max);
+    value -= max;
+
+    while (value >= 128) {
+        out[count++] = (uint8_t)((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out[count++] = (uint8_t)value;
+
+    return count;
+}
+
+/* Decode an integer behind a prefix of the given bits */
+static bool decode_integer(const uint8_t **ptr, const uint8_t *end,
+                           int prefix, size_t *value) {
+    size_t max = ((size_t)1 << prefix) - 1;
+    int shift = 0;
+    uint8_t byte;
+
+    if (*ptr >= end) {
+        return false;
+    }
+
+    *value = *(*ptr)++ & max;
+    if (*value < max) {
+        return true;
+    }
+
+    do {
+        /* Nothing legitimate needs more than 28 bits */
+        if (*ptr >= end || shift > 21) {
+            return false;
+        }
+
+        byte = *(*ptr)++;
+        *value += (size_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    return true;
+}
+
+/* Decode a string literal into out, NUL terminated */
+static bool decode_string(const uint8_t **ptr, const uint8_t *end, char *out,
+                          size_t space) {
+    size_t length, written;
+    bool huffman;
+
+    if (*ptr >= end) {
+        return false;
+    }
+
+    huffman = **ptr & 0x80;
+    if (!decode_integer(ptr, end, 7, &length) ||
+        length > (size_t)(end - *ptr)) {
+        return false;
+    }
+
+    if (huffman) {
+        if (!huffman_decode(*ptr, length, out, space - 1, &written)) {
+            return false;
+        }
+    } else {
+        if (length >= space) {
+            return false;
+        }
+        memcpy(out, *ptr, length);
+        written = length;
+    }
+
+    /* Fields can never carry a NUL */
+    if (memchr(out, '\0', written)) {
+        return false;
+    }
+
+    out[written] = '\0';
+    *ptr += length;
+
+    return true;
+}
+
+/* Encode a string literal, Huffman coded if that's shorter */
+/* Returns 0 if it doesn't fit in space */
+static size_t encode_string(uint8_t *out, size_t space, const char *string) {
+    size_t length = strlen(string), coded = huffman_length(string, length);
+    uint8_t prefix[8];
+    size_t count;
+
+    if (coded < length) {
+        count = encode_integer(prefix, 0x80, 7, coded);
+    } else {
+        count = encode_integer(prefix, 0x00, 7, length);
+        coded = length;
+    }
+
+    if (count + coded > space) {
+        return 0;
+    }
+
+    memcpy(out, prefix, count);
+    if (coded < length) {
+        huffman_encode(string, length, out + count);
+    } else {
+        memcpy(out + count, string, length);
+    }
+
+    return count + coded;
+}
+
+/* Start an empty table */
+void hpack_table_init(hpack_table_t *table) {
+    table->first = 0;
+    table->count = 0;
+    table->size = 0;
+    table->max_size = HPACK_TABLE_SIZE;
+    table->limit = HPACK_TABLE_SIZE;
+    table->low = HPACK_TABLE_SIZE;
+    table->update_pending = false;
+
+    return;
+}
+
+/* Dynamic entry by 1-based index, newest first */
+static hpack_entry_t *dynamic_entry(hpack_table_t *table, size_t index) {
+    return &table->entries[(table->first + index - 1) % HPACK_MAX_ENTRIES];
+}
+
+/* Evict the oldest entries until the table fits a bound */
+static void evict_to(hpack_table_t *table, size_t bound) {
+    hpack_entry_t *oldest = NULL;
+
+    while (table->size > bound) {
+        oldest = dynamic_entry(table, table->count);
+        table->size -= oldest->size;
+        table->count--;
+
+        free(oldest->name);
+        free(oldest->value);
+    }
+}
+
+/* Free every entry */
+void hpack_table_free(hpack_table_t *table) {
+    evict_to(table, 0);
+
+    return;
+}
+
+/* Insert a field as the newest entry */
+/* One bigger than the whole table just leaves it empty */
+static void add_entry(hpack_table_t *table, const char *name,
+                      const char *value) {
+    size_t size = strlen(name) + strlen(value) + HPACK_ENTRY_OVERHEAD;
+    hpack_entry_t *entry = NULL;
+
+    if (size > table->max_size) {
+        evict_to(table, 0);
+        return;
+    }
+
+    evict_to(table, table->max_size - size);
+
+    table->first = (table->first + HPACK_MAX_ENTRIES - 1) % HPACK_MAX_ENTRIES;
+    table->count++;
+    table->size += size;
+
+    entry = &table->entries[table->first];
+    entry->size = size;
+    entry->name = strdup(name);
+    entry->value = strdup(value);
+    if (!entry->name || !entry->value) {
+        perror("Error: strdup() failed to copy header field");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Look up a field by index across both tables */
+static bool lookup_field(hpack_table_t *table, size_t index,
+                         const char **name, const char **value) {
+    hpack_entry_t *entry = NULL;
+
+    if (index == 0) {
+        return false;
+    }
+
+    if (index <= ARRAY_LENGTH(static_table)) {
+        *name = static_table[index - 1].name;
+        *value = static_table[index - 1].value;
+        return true;
+    }
+
+    index -= ARRAY_LENGTH(static_table);
+    if (index > table->count) {
+        return false;
+    }
+
+    entry = dynamic_entry(table, index);
+    *name = entry->name;
+    *value = entry->value;
+
+    return true;
+}
+
+/* Change the peer's bound on an encoding table */
+/* The peer has to hear about the smallest bound since the last block, or -
+   it could keep entries we already evicted */
+void hpack_set_limit(hpack_table_t *table, size_t limit) {
+    if (limit > HPACK_TABLE_SIZE) {
+        limit = HPACK_TABLE_SIZE;
+    }
+
+    if (!table->update_pending) {
+        table->low = table->max_size;
+    }
+    if (limit < table->low) {
+        table->low = limit;
+    }
+
+    table->limit = limit;
+    table->max_size = limit;
+    table->update_pending = true;
+    evict_to(table, limit);
+
+    return;
+}
+
+/* Decode a header block */
+bool hpack_decode(hpack_table_t *table, const uint8_t *block, size_t length,
+                  hpack_field_t field, void *arg) {
+    char name[HPACK_MAX_STRING], value[HPACK_MAX_STRING];
+    const uint8_t *ptr = block, *end = block + length;
+    const char *known_name = NULL, *known_value = NULL;
+    bool fields_seen = false, indexing;
+    size_t index;
+
+    while (ptr < end) {
+        /* Indexed field */
+        if (*ptr & 0x80) {
+            if (!decode_integer(&ptr, end, 7, &index) ||
+                !lookup_field(table, index, &known_name, &known_value)) {
+                return false;
+            }
+
+            field(arg, known_name, known_value);
+            fields_seen = true;
+            continue;
+        }
+
+        /* Table size update, only allowed before the first field */
+        if ((*ptr & 0xe0) == 0x20) {
+            if (fields_seen || !decode_integer(&ptr, end, 5, &index) ||
+                index > table->limit) {
+                return false;
+            }
+
+            table->max_size = index;
+            evict_to(table, index);
+            continue;
+        }
+
+        /* Literal, added to the table or not */
+        indexing = (*ptr & 0xc0) == 0x40;
+        if (!decode_integer(&ptr, end, indexing ? 6 : 4, &index)) {
+            return false;
+        }
+
+        if (index == 0) {
+            if (!decode_string(&ptr, end, name, sizeof name)) {
+                return false;
+            }
+        } else {
+            /* Copied, adding the entry could evict the one it names */
+            if (!lookup_field(table, index, &known_name, &known_value)) {
+                return false;
+            }
+            snprintf(name, sizeof name, "%s", known_name);
+        }
+
+        if (!decode_string(&ptr, end, value, sizeof value)) {
+            return false;
+        }
+
+        field(arg, name, value);
+        fields_seen = true;
+
+        if (indexing) {
+            add_entry(table, name, value);
+        }
+    }
+
+    return true;
+}
+
+/* Start a header block */
+size_t hpack_encode_start(hpack_table_t *table, uint8_t *out) {
+    size_t count = 0;
+
+    if (!table->update_pending) {
+        return 0;
+    }
+
+    if (table->low < table->max_size) {
+        count = encode_integer(out, 0x20, 5, table->low);
+    }
+    count += encode_integer(out + count, 0x20, 5, table->max_size);
+    table->update_pending = false;
+
+    return count;
+}
+
+/* Encode a field both sides already have in a table */
+static size_t encode_indexed(uint8_t *out, size_t space, size_t index) {
+    uint8_t prefix[8];
+    size_t count = encode_integer(prefix, 0x80, 7, index);
+
+    if (count > space) {
+        return 0;
+    }
+    memcpy(out, prefix, count);
+
+    return count;
+}
+
+/* Encode one header field */
+size_t hpack_encode(hpack_table_t *table, uint8_t *out, size_t space,
+                    const char *name, const char *value, bool index) {
+    size_t name_index = 0, count, string;
+    hpack_entry_t *entry = NULL;
+    uint8_t prefix[8];
+
+    /* Whole field already known, one integer does it */
+    for (size_t i = 0; i < ARRAY_LENGTH(static_table); i++) {
+        if (strcmp(static_table[i].name, name) == 0) {
+            if (strcmp(static_table[i].value, value) == 0) {
+                return encode_indexed(out, space, i + 1);
+            }
+            if (name_index == 0) {
+                name_index = i + 1;
+            }
+        }
+    }
+
+    for (size_t i = 1; i <= table->count; i++) {
+        entry = dynamic_entry(table, i);
+        if (strcmp(entry->name, name) == 0) {
+            if (strcmp(entry->value, value) == 0) {
+                return encode_indexed(out, space,
+                                      i + sizeof static_table /
+                                          sizeof *static_table);
+            }
+            if (name_index == 0) {
+                name_index = i + ARRAY_LENGTH(static_table);
+            }
+        }
+    }
+
+    /* Only worth a table slot if it fits the table at all */
+    index = index && strlen(name) + strlen(value) + HPACK_ENTRY_OVERHEAD <=
+                     table->max_size;
+
+    count = index ? encode_integer(prefix, 0x40, 6, name_index)
+                  : encode_integer(prefix, 0x00, 4, name_index);
+    if (count > space) {
+        return 0;
+    }
+    memcpy(out, prefix, count);
+
+    if (name_index == 0) {
+        string = encode_string(out + count, space - count, name);
+        if (string == 0) {
+            return 0;
+        }
+        count += string;
+    }
+
+    string = encode_string(out + count, space - count, value);
+    if (string == 0) {
+        return 0;
+    }
+    count += string;
+
+    if (index) {
+        add_entry(table, name, value);
+    }
+
+    return count;
+}
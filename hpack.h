@@ -0,0 +1,84 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: hpack.h
+ * Purpose: HPACK header file. Defines the header compression tables and -
+            coder used by HTTP/2 (RFC 7541)
+ */
+
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Dynamic table size both sides start with, and the most we accept */
+#define HPACK_TABLE_SIZE 4096
+
+/* Every entry costs its name and value plus this much */
+#define HPACK_ENTRY_OVERHEAD 32
+
+/* Most entries a full table can hold */
+#define HPACK_MAX_ENTRIES (HPACK_TABLE_SIZE / HPACK_ENTRY_OVERHEAD)
+
+/* Longest decoded name or value, longer ones fail the header block */
+#define HPACK_MAX_STRING 8192
+
+/* One dynamic table entry */
+typedef struct {
+    char *name;
+    char *value;
+    size_t size;
+} hpack_entry_t;
+
+/* Dynamic table, newest entry first */
+/* Each connection has one for decoding and one for encoding */
+typedef struct {
+    hpack_entry_t entries[HPACK_MAX_ENTRIES];
+    size_t first;
+    size_t count;
+
+    /* Octets in use, current bound, and the bound the peer allows */
+    size_t size;
+    size_t max_size;
+    size_t limit;
+
+    /* Smallest bound since the last size update was sent */
+    size_t low;
+
+    /* Encoder owes the peer a size update at the next header block */
+    bool update_pending;
+} hpack_table_t;
+
+/* Called for every decoded header field, in order */
+typedef void (*hpack_field_t)(void *arg, const char *name,
+                              const char *value);
+
+/* Build the Huffman decoding tree, once at startup */
+void hpack_init(void);
+
+/* Start an empty table */
+void hpack_table_init(hpack_table_t *table);
+
+/* Free every entry */
+void hpack_table_free(hpack_table_t *table);
+
+/* Change the bound the peer allows on an encoding table */
+void hpack_set_limit(hpack_table_t *table, size_t limit);
+
+/* Decode a whole header block, calling field for each header */
+/* Returns false on a compression error, the connection can't go on */
+bool hpack_decode(hpack_table_t *table, const uint8_t *block, size_t length,
+                  hpack_field_t field, void *arg);
+
+/* Start a header block, emitting any pending table size update */
+/* Returns bytes written to out, which needs room for 8 */
+size_t hpack_encode_start(hpack_table_t *table, uint8_t *out);
+
+/* Encode one header field, indexing it if asked and worthwhile */
+/* Returns bytes written to out, or 0 if it didn't fit in space */
+size_t hpack_encode(hpack_table_t *table, uint8_t *out, size_t space,
+                    const char *name, const char *value, bool index);
+
+#endif
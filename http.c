@@ -9,21 +9,80 @@
  #include <stdio.h>
  #include <stdlib.h>
  #include <string.h>
+ #include <strings.h>
+ #include <ctype.h>
  #include <stdbool.h>
+ #include <stdint.h>
  #include <unistd.h>
+ #include <fcntl.h>
+ #include <sys/socket.h>
+ #include <sys/uio.h>
 
  #include "http.h"
+ #include "filecache.h"
+ #include "webroot.h"
+ #include "ticker.h"
+ #include "io.h"
+ #include "scan.h"
+ #include "vhost.h"
 
  /* 200 Header boilterplate strings */
 const char found[] = "HTTP/1.0 200 OK\r\n";
 const char content_header[] = "Content-Type: %s\r\n";
 const char length_header[] = "Content-Length: %s\r\n\r\n";
 
-/* 404 Header responses strings */
-/* Could combine these together, but more easier to keep them seperated */
-const char not_found[] = "HTTP/1.0 404 Not Found\r\n";
+/* Content type for files without a served extension */
 const char not_supported[] = "Content-Type: application/octet-stream\r\n";
-const char no_content[] = "Content-Length: 0\r\n\r\n";
+
+/* Fixed responses, rendered into immutable blobs once at startup */
+/* The status line is kept in its own iovec, so the Date header can be -
+   slotted in behind it without copying */
+static const struct {
+    const char *status;
+    const char *headers;
+} response_table[NUM_RESPONSES] = {
+    [RESPONSE_OPTIONS] = {"HTTP/1.0 200 OK\r\n",
+                          "Allow: GET, HEAD, OPTIONS\r\n"},
+    [RESPONSE_BAD_REQUEST] = {"HTTP/1.0 400 Bad Request\r\n", ""},
+    [RESPONSE_NOT_FOUND] = {"HTTP/1.0 404 Not Found\r\n", ""},
+    [RESPONSE_NOT_ALLOWED] = {"HTTP/1.0 405 Method Not Allowed\r\n",
+                              "Allow: GET, HEAD, OPTIONS\r\n"},
+    [RESPONSE_TIMEOUT] = {"HTTP/1.0 408 Request Timeout\r\n", ""},
+    [RESPONSE_TOO_LARGE] = {"HTTP/1.0 413 Payload Too Large\r\n", ""},
+    [RESPONSE_NOT_IMPLEMENTED] = {"HTTP/1.0 501 Not Implemented\r\n", ""},
+    [RESPONSE_UNAVAILABLE] = {"HTTP/1.0 503 Service Unavailable\r\n", ""},
+    [RESPONSE_BAD_GATEWAY] = {"HTTP/1.0 502 Bad Gateway\r\n", ""}
+};
+
+/* Rendered responses, status line then the rest of the header block */
+static struct iovec responses[NUM_RESPONSES][2];
+
+/* Names of the well-known headers */
+static const char *const header_names[NUM_HEADERS] = {
+    [HEADER_HOST] = "Host",
+    [HEADER_CONNECTION] = "Connection",
+    [HEADER_CONTENT_LENGTH] = "Content-Length",
+    [HEADER_TRANSFER_ENCODING] = "Transfer-Encoding",
+    [HEADER_UPGRADE] = "Upgrade",
+    [HEADER_HTTP2_SETTINGS] = "HTTP2-Settings",
+    [HEADER_RANGE] = "Range",
+    [HEADER_ACCEPT_ENCODING] = "Accept-Encoding",
+    [HEADER_IF_MODIFIED_SINCE] = "If-Modified-Since",
+    [HEADER_IF_NONE_MATCH] = "If-None-Match",
+    [HEADER_USER_AGENT] = "User-Agent",
+    [HEADER_COOKIE] = "Cookie"
+};
+
+/* Open addressed table from name hash to ID, filled by init_headers() */
+static struct {
+    uint32_t hash;
+    int id;
+} header_slots[HEADER_SLOTS];
+
+/* Methods that exist but are never allowed on static files */
+static const char *const disallowed_methods[] = {
+    "POST", "PUT", "DELETE", "PATCH", "TRACE", "CONNECT"
+};
 
 /* Hardcoded mime types */
 /* Added .txt for easy creation and testing of big files */
@@ -35,103 +94,574 @@ const file_properties_t file_map[] = {
     {".txt", "text/plain"}
 };
 
- /* Parses HTTP request header */
- /* Gets method, URI and version and inserts them in struct */
- void parse_request(http_request_t *parameters, const char *response) {
-     char *saveptr = NULL, *path = NULL, *copy = NULL;
-
-     /* Copy over the response */
-     copy = strdup(response);
-     if (!copy) {
-         perror("Error: strdup() failed to copy response");
-         exit(EXIT_FAILURE);
+ /* Render every fixed response */
+ /* Called once before any client is served, never changes after */
+ void init_responses(void) {
+     const char tail[] = "Content-Length: 0\r\n\r\n";
+     char *blob = NULL;
+     size_t length;
+
+     for (size_t i = 0; i < NUM_RESPONSES; i++) {
+         length = strlen(response_table[i].headers) + strlen(tail);
+
+         blob = malloc(length + 1);
+         if (!blob) {
+             perror("Error: malloc() failed to allocate response");
+             exit(EXIT_FAILURE);
+         }
+
+         strcpy(blob, response_table[i].headers);
+         strcat(blob, tail);
+
+         responses[i][0].iov_base = (void *)response_table[i].status;
+         responses[i][0].iov_len = strlen(response_table[i].status);
+         responses[i][1].iov_base = blob;
+         responses[i][1].iov_len = length;
      }
 
-     /* Extract just the first line */
-     path = strtok_r(copy, "\n", &saveptr);
+     return;
+ }
 
-     /* Extract the method */
-     path = strtok_r(copy, " ", &saveptr);
+ /* Case insensitive FNV-1a hash of a header name */
+ static uint32_t hash_header_name(const char *name, size_t length) {
+     uint32_t hash = UINT32_C(2166136261);
+     unsigned char c;
 
-     /* Extract this just in case I want handle multiple methods-
-        in the future. */
-     parameters->method = strdup(path);
-     if (!parameters->method) {
-         perror("Error: strdup() failed to copy path");
-         exit(EXIT_FAILURE);
+     for (size_t i = 0; i < length; i++) {
+         c = (unsigned char)name[i];
+         hash ^= c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+         hash *= UINT32_C(16777619);
      }
 
-     /* Extract the URI */
-     path = strtok_r(NULL, " ", &saveptr);
+     return hash;
+ }
 
-     parameters->URI = strdup(path);
-     if (!parameters->URI) {
-         perror("Error: strdup() failed to copy URI");
-         exit(EXIT_FAILURE);
+ /* Hash every well-known header name into its slot */
+ /* Called once before any request is parsed, never changes after */
+ void init_headers(void) {
+     uint32_t hash, slot;
+
+     for (size_t i = 0; i < HEADER_SLOTS; i++) {
+         header_slots[i].id = ERROR;
+     }
+
+     for (int id = 0; id < NUM_HEADERS; id++) {
+         hash = hash_header_name(header_names[id], strlen(header_names[id]));
+
+         slot = hash & (HEADER_SLOTS - 1);
+         while (header_slots[slot].id != ERROR) {
+             slot = (slot + 1) & (HEADER_SLOTS - 1);
+         }
+
+         header_slots[slot].hash = hash;
+         header_slots[slot].id = id;
+     }
+
+     return;
+ }
+
+ /* Gets the ID of a well-known header name */
+ /* Returns ERROR for any other name */
+ int find_header_id(const char *name, size_t length) {
+     uint32_t hash = hash_header_name(name, length);
+     uint32_t slot = hash & (HEADER_SLOTS - 1);
+     int id;
+
+     /* Table is mostly empty, probes end at the first free slot */
+     while ((id = header_slots[slot].id) != ERROR) {
+         if (header_slots[slot].hash == hash &&
+             strlen(header_names[id]) == length &&
+             strncasecmp(header_names[id], name, length) == 0) {
+             return id;
+         }
+         slot = (slot + 1) & (HEADER_SLOTS - 1);
+     }
+
+     return ERROR;
+ }
+
+ /* Gets a well-known header of a parsed request */
+ /* Returns its value with length set, or NULL if it wasn't sent */
+ const char *request_header(const http_request_t *request, header_id_t id,
+                            size_t *length) {
+     *length = request->header_lengths[id];
+
+     return request->headers[id];
+ }
+
+ /* Send a fixed response with a single system call */
+ /* These are small enough to always fit an empty socket buffer, so the -
+    send never blocks, even from the reactor */
+ void send_response(int client, response_t response) {
+     char date[DATE_HEADER_SIZE];
+     struct iovec iov[] = {
+         responses[response][0],
+         {date, sizeof date},
+         responses[response][1]
+     };
+     struct msghdr msg;
+
+     ticker_date(date);
+
+     memset(&msg, '\0', sizeof msg);
+     msg.msg_iov = iov;
+     msg.msg_iovlen = ARRAY_LENGTH(iov);
+
+     sendmsg(client, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+     return;
+ }
+
+ /* Checks a URI has a single spelling */
+ /* Only these are cached, so invalidating by path always finds the entry. -
+    Paths out of normalize_uri() always pass, they are already decoded, so -
+    a % or ? left in one is part of a file name */
+ bool is_canonical_uri(const char *uri) {
+     return uri[0] == '/' && !strstr(uri, "//") && !strstr(uri, "/./") &&
+            !strstr(uri, "/../");
+ }
+
+ /* Value of a hex digit, or ERROR */
+ static int hex_value(char digit) {
+     if (digit >= '0' && digit <= '9') {
+         return digit - '0';
+     } else if (digit >= 'a' && digit <= 'f') {
+         return digit - 'a' + 10;
+     } else if (digit >= 'A' && digit <= 'F') {
+         return digit - 'A' + 10;
+     }
+
+     return ERROR;
+ }
+
+ /* Normalizes a request path in place, in a single pass */
+ /* Percent decodes it, removes . and .. segments and duplicate slashes and -
+    cuts off the query, so every spelling of a file becomes one cache key. -
+    Returns false for a bad escape, an encoded NUL or a .. above the root */
+ bool normalize_uri(char *uri) {
+     char *in = uri, *out = uri, *segment = NULL;
+     int high, low;
+     char c;
+
+     if (*in != '/') {
+         return false;
+     }
+
+     /* Output never overtakes input, decoding and dropping only shrink */
+     *out++ = *in++;
+     segment = out;
+
+     while (true) {
+         c = *in;
+
+         /* Path ends at the query, or a fragment a client sent anyway */
+         if (c == '\0' || c == '?' || c == '#') {
+             c = '\0';
+         } else if (c == '%') {
+             high = hex_value(in[1]);
+             low = high == ERROR ? ERROR : hex_value(in[2]);
+             if (low == ERROR || (high == 0 && low == 0)) {
+                 return false;
+             }
+             c = (char)(high * 16 + low);
+             in += 3;
+         } else {
+             in++;
+         }
+
+         if (c != '/' && c != '\0') {
+             *out++ = c;
+             continue;
+         }
+
+         /* Segment just ended, drop it if it's a dot segment */
+         if (out - segment == 1 && segment[0] == '.') {
+             out = segment;
+         } else if (out - segment == 2 && segment[0] == '.' &&
+                    segment[1] == '.') {
+             /* Nothing above the root to go back to */
+             if (segment == uri + 1) {
+                 return false;
+             }
+
+             /* Back over the segment before it too */
+             out = segment - 1;
+             while (out[-1] != '/') {
+                 out--;
+             }
+         }
+
+         if (c == '\0') {
+             break;
+         }
+
+         /* Empty and dropped segments leave a slash already there */
+         if (out[-1] != '/') {
+             *out++ = '/';
+         }
+         segment = out;
      }
 
-     /* Extract the http version */
-     /* Not needed but extracted it anyways */
-     parameters->httpversion = strdup(saveptr);
-     if (!parameters->httpversion) {
-         perror("Error: strdup() failed to copy http version");
+     *out = '\0';
+
+     return true;
+ }
+
+ /* Checks a path starts with prefix, in whole segments */
+ /* /api takes /api and /api/x but not /apiary, a prefix ending in a -
+    slash already ends its segment */
+ bool path_has_prefix(const char *path, const char *prefix, size_t length) {
+     return strncmp(path, prefix, length) == 0 &&
+            (length == 0 || prefix[length - 1] == '/' ||
+             path[length] == '/' || path[length] == '\0');
+ }
+
+ /* Writes a normalized path back out as a request target */
+ /* Percent encodes anything that isn't allowed bare in a path, so a -
+    decoded space, ? or line break can't end up in a request line, then -
+    adds the query as it was sent. Returns false if it didn't fit */
+ bool encode_uri(char *out, size_t size, const char *path, const char *query,
+                 size_t query_length) {
+     static const char hex[] = "0123456789ABCDEF";
+     size_t length = 0;
+     unsigned char c;
+
+     for (; *path; path++) {
+         c = (unsigned char)*path;
+         if (length + 4 > size) {
+             return false;
+         }
+
+         if (isalnum(c) || strchr("-._~!$&'()*+,;=:@/", c)) {
+             out[length++] = (char)c;
+         } else {
+             out[length++] = '%';
+             out[length++] = hex[c >> 4];
+             out[length++] = hex[c & 0x0f];
+         }
+     }
+
+     if (query) {
+         if (length + query_length + 2 > size) {
+             return false;
+         }
+         out[length++] = '?';
+         memcpy(out + length, query, query_length);
+         length += query_length;
+     }
+     out[length] = '\0';
+
+     return true;
+ }
+
+ /* Copies a token out of the request */
+ static char *copy_token(const char *start, const char *end) {
+     char *token = strndup(start, (size_t)(end - start));
+
+     if (!token) {
+         perror("Error: strndup() failed to copy request line");
          exit(EXIT_FAILURE);
      }
 
-     parameters->httpversion[strlen(saveptr)-1] = '\0';
+     return token;
+ }
+
+ /* Index the well-known header lines after the request line */
+ /* The first of a repeated header wins */
+ static void parse_headers(http_request_t *parameters, const char *line,
+                           const char *end) {
+     const char *colon = NULL, *value = NULL, *value_end = NULL;
+     int id;
+
+     while ((line = scan_find(line, end, "\n")) < end) {
+         line++;
+
+         /* Blank line ends the header */
+         if (line == end || *line == '\r' || *line == '\n') {
+             break;
+         }
+
+         /* Name runs up to the colon, lines without one are skipped */
+         colon = scan_find(line, end, ":\n");
+         if (colon == end || *colon != ':') {
+             line = colon;
+             continue;
+         }
+
+         value = colon + 1;
+         while (value < end && (*value == ' ' || *value == '\t')) {
+             value++;
+         }
+
+         /* One hash and at most one compare per line */
+         id = find_header_id(line, (size_t)(colon - line));
+
+         line = value_end = scan_find(value, end, "\r\n");
+         while (value_end > value &&
+                (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+             value_end--;
+         }
+
+         if (id != ERROR && !parameters->headers[id]) {
+             parameters->headers[id] = value;
+             parameters->header_lengths[id] = (size_t)(value_end - value);
+         }
+     }
+ }
+
+ /* Parses HTTP request header */
+ /* Gets method, URI and version and inserts them in struct, along with -
+    the well-known headers */
+ /* Returns false for anything that isn't a well formed request line */
+ bool parse_request(http_request_t *parameters, const char *request,
+                    size_t length) {
+     const char *end = request + length, *line_end = NULL;
+     const char *starts[3], *ends[3], *query = NULL, *fragment = NULL;
+
+     memset(parameters, '\0', sizeof *parameters);
+
+     /* Blank lines before the request line are skipped */
+     while (request < end && (*request == '\r' || *request == '\n')) {
+         request++;
+     }
+
+     /* Scanned in place, the buffer is never copied or split up */
+     line_end = scan_find(request, end, "\r\n");
+
+     /* Method, URI and version are separated by runs of spaces */
+     for (size_t i = 0; i < ARRAY_LENGTH(starts); i++) {
+         while (request < line_end && *request == ' ') {
+             request++;
+         }
+
+         starts[i] = request;
+         ends[i] = request = scan_find(request, line_end, " ");
+     }
+
+     /* Anything missing or malformed is a bad request */
+     if (ends[0] == starts[0] || ends[1] == starts[1] ||
+         starts[1][0] != '/' || ends[2] - starts[2] < 5 ||
+         strncmp(starts[2], "HTTP/", 5) != 0) {
+         return false;
+     }
+
+     parse_headers(parameters, line_end, end);
+
+     parameters->method = copy_token(starts[0], ends[0]);
+     parameters->URI = copy_token(starts[1], ends[1]);
+     parameters->httpversion = copy_token(starts[2], ends[2]);
 
-     free(copy);
+     /* Query is kept apart, normalizing the URI drops it */
+     fragment = memchr(starts[1], '#', (size_t)(ends[1] - starts[1]));
+     fragment = fragment ? fragment : ends[1];
+     query = memchr(starts[1], '?', (size_t)(fragment - starts[1]));
+     if (query) {
+         parameters->query = query + 1;
+         parameters->query_length = (size_t)(fragment - query - 1);
+     }
+
+     return true;
  }
 
- /* Checks if a given extension is served */
- /* Verifies that it is either .js, .jpg, .css or .html */
- static bool supported_file(const char *extension) {
-     /* Go over the file types supported */
-     for (size_t i = 0; i < ARRAY_LENGTH(file_map); i++) {
+ /* Parses a Content-Length value */
+ /* Returns false unless it's all digits and fits in a size_t */
+ bool parse_content_length(const char *value, size_t length, size_t *out) {
+     size_t digit;
 
-         /* If extension is the same here, return */
-         if (strcmp(file_map[i].extension, extension) == 0) {
+     if (length == 0) {
+         return false;
+     }
+
+     *out = 0;
+     for (size_t i = 0; i < length; i++) {
+         if (value[i] < '0' || value[i] > '9') {
+             return false;
+         }
+
+         digit = (size_t)(value[i] - '0');
+         if (*out > (SIZE_MAX - digit) / 10) {
+             return false;
+         }
+         *out = *out * 10 + digit;
+     }
+
+     return true;
+ }
+
+ /* Finds a header field in a buffered request */
+ /* Returns its value, trimmed, with length set, or NULL if it's missing */
+ const char *get_header(const char *request, const char *name,
+                        size_t *length) {
+     const char *end = request + strlen(request);
+     const char *line = scan_find(request, end, "\n");
+     const char *colon = NULL, *value = NULL, *value_end = NULL;
+     size_t name_length = strlen(name);
+
+     /* Skip the request line, stop at the blank line */
+     while (line < end && line[1] != '\r' && line[1] != '\n' &&
+            line[1] != '\0') {
+         line++;
+
+         /* Name runs up to the colon, lines without one are skipped */
+         colon = scan_find(line, end, ":\n");
+         if (colon < end && *colon == ':' &&
+             (size_t)(colon - line) == name_length &&
+             strncasecmp(line, name, name_length) == 0) {
+             value = colon + 1;
+             value += strspn(value, " \t");
+
+             value_end = scan_find(value, end, "\r\n");
+             while (value_end > value &&
+                    (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+                 value_end--;
+             }
+
+             *length = (size_t)(value_end - value);
+             return value;
+         }
+
+         line = scan_find(colon, end, "\n");
+     }
+
+     return NULL;
+ }
+
+ /* Checks a comma separated header value for a token */
+ bool header_has_token(const char *value, size_t length, const char *token) {
+     size_t token_length = strlen(token), span;
+     const char *end = value + length;
+
+     while (value < end) {
+         value += strspn(value, " \t,");
+         span = strcspn(value, " \t,\r\n");
+         if (span == 0) {
+             break;
+         }
+         if (value + span > end) {
+             span = (size_t)(end - value);
+         }
+
+         if (span == token_length &&
+             strncasecmp(value, token, token_length) == 0) {
              return true;
          }
+
+         value += span;
      }
 
-     /* Otherwise, no matching extension was found */
      return false;
  }
 
- /* Gets full path of requested file */
- /* Return the absolute path */
- char *get_full_path(const char *path, const char *webroot, int *status) {
-     char *full_path = NULL, *extension = NULL;
+ /* Classifies a request method */
+ http_method_t get_method(const char *method) {
+     if (strcmp(method, "GET") == 0) {
+         return METHOD_GET;
+     } else if (strcmp(method, "HEAD") == 0) {
+         return METHOD_HEAD;
+     } else if (strcmp(method, "OPTIONS") == 0) {
+         return METHOD_OPTIONS;
+     }
 
-     /* Initialise reponse as not found */
-     *status = NOT_FOUND;
+     for (size_t i = 0; i < ARRAY_LENGTH(disallowed_methods); i++) {
+         if (strcmp(disallowed_methods[i], method) == 0) {
+             return METHOD_NOT_ALLOWED;
+         }
+     }
 
-     /* Create an array big enough for the web root and path */
-     full_path = malloc(strlen(webroot) + strlen(path) + 1);
-     if (!full_path) {
-         perror("Error: malloc() failed allocate full path");
-         exit(EXIT_FAILURE);
+     return METHOD_NOT_IMPLEMENTED;
+ }
+
+ /* Gets mime type served for an extension */
+ /* The current virtual host can override the built in types and serve -
+    more. Returns NULL if the extension is not served */
+ const char *lookup_mime_type(const char *extension) {
+     const char *mime_type = NULL;
+
+     if (!extension) {
+         return NULL;
      }
 
-     /* Combine web root and path */
-     strcpy(full_path, webroot);
-     strcat(full_path, path);
+     mime_type = vhost_mime_type(extension);
+     if (mime_type) {
+         return mime_type;
+     }
+
+     for (size_t i = 0; i < ARRAY_LENGTH(file_map); i++) {
+         if (strcmp(file_map[i].extension, extension) == 0) {
+             return file_map[i].mime_type;
+         }
+     }
+
+     return NULL;
+ }
+
+ /* Gets status of requested file */
+ /* Fills in its metadata when it can be served. Directories are FOUND -
+    when they have an index file, with its metadata, MOVED when the -
+    trailing slash is missing and LISTING when there is no index */
+ int get_file_status(const char *path, file_meta_t *meta) {
+     char *extension = NULL;
+     resolution_t resolution;
 
      /* Get string after last occurence of the dot character */
-     extension = strrchr(full_path, '.');
+     extension = strrchr(path, '.');
+
+     /* Existence comes from the metadata cache, which only touches the -
+        filesystem on a miss, and then only beneath the webroot. It -
+        remembers directories too, so an index costs no more than a file */
+     resolution = filecache_resolve(path, meta);
+
+     /* If extension is valid and file is supported and exists */
+     if (resolution == RESOLVED_FILE) {
+         return lookup_mime_type(extension) ? FOUND : NOT_FOUND;
+     } else if (resolution == RESOLVED_INDEX) {
+         return FOUND;
+     } else if (resolution == RESOLVED_REDIRECT) {
+         return MOVED;
+     } else if (resolution == RESOLVED_LISTING) {
+         return LISTING;
+     }
+
+     return NOT_FOUND;
+ }
 
-     /* If extension is valid and path is accessible and file is supported */
-     if (extension &&
-         access(full_path, F_OK) == 0 &&
-         supported_file(extension)) {
+ /* Gets the file actually sent for a URI that was FOUND */
+ /* A directory URI names its index file, anything else itself */
+ const char *get_served_path(const char *uri, char *buffer, size_t size) {
+     size_t length = strlen(uri);
 
-         /* update status to 200 */
-         *status = FOUND;
+     if (length == 0 || uri[length - 1] != '/') {
+         return uri;
      }
 
-     /* Return the absolute path either way */
-     return full_path;
+     snprintf(buffer, size, "%s%s", uri, INDEX_FILE);
+
+     return buffer;
+ }
+
+ /* Send a 301 to the directory URI with its trailing slash */
+ /* Location echoes the request, so unlike the fixed responses it can't -
+    be rendered up front */
+ void send_redirect(int client, const char *uri) {
+     const char status[] = "HTTP/1.0 301 Moved Permanently\r\n";
+     const char location[] = "Location: ";
+     const char tail[] = "/\r\nContent-Length: 0\r\n\r\n";
+     char date[DATE_HEADER_SIZE];
+     struct iovec iov[] = {
+         {(void *)status, sizeof status - 1},
+         {date, sizeof date},
+         {(void *)location, sizeof location - 1},
+         {(void *)uri, strlen(uri)},
+         {(void *)tail, sizeof tail - 1}
+     };
+
+     ticker_date(date);
+
+     if (!io_writev_all(client, iov, ARRAY_LENGTH(iov))) {
+         perror("Error: cannot write to socket");
+     }
+
+     return;
  }
 
  /* Write 200 response headers */
@@ -150,9 +680,9 @@ const file_properties_t file_map[] = {
      sprintf(buffer, defaults, data);
 
      /* Write buffer to client socket */
-     if (write(client, buffer, strlen(buffer)) == ERROR) {
+     /* Client may have gone away or hit its deadline, not fatal */
+     if (!io_write_all(client, buffer, strlen(buffer))) {
          perror("Error: cannot write to socket");
-         exit(EXIT_FAILURE);
      }
 
      /* Done with the buffer */
@@ -176,7 +706,7 @@ const file_properties_t file_map[] = {
 
  /* Write content length for requested file */
  /* Only applicable to 200 response headers */
- static void write_content_length(int client, size_t bytes_read) {
+ void write_content_length(int client, size_t bytes_read) {
      char *content_length = NULL;
      size_t length_bytes, total_bytes;
 
@@ -203,95 +733,88 @@ const file_properties_t file_map[] = {
      return;
  }
 
- /* Write file requested from 200 response */
- void read_write_file(int client, const char *path) {
-     FILE *requested_file = NULL;
-     unsigned char *buffer = NULL;
-     size_t  bytes_read, buffer_size;
-     long file_size;
+ /* Write Date, Last-Modified and ETag headers for requested file */
+ /* All pre-rendered, by the ticker and the metadata cache, so this is a -
+    single write */
+ void write_cache_headers(int client, const file_meta_t *meta) {
+     char date[DATE_HEADER_SIZE];
+     struct iovec iov[] = {
+         {date, sizeof date},
+         {(void *)meta->validators, strlen(meta->validators)}
+     };
 
-     /* Open contents of file in binary mode */
-     requested_file = fopen(path, "rb");
-     if (!requested_file) {
-         perror("Error: fopen() failed to open requested file");
-         exit(EXIT_FAILURE);
+     ticker_date(date);
+
+     if (!io_writev_all(client, iov, ARRAY_LENGTH(iov))) {
+         perror("Error: cannot write to socket");
      }
 
-     /* Get size of file */
-     fseek(requested_file, 0, SEEK_END);
-     file_size = ftell(requested_file);
-     fseek(requested_file, 0, SEEK_SET);
+     return;
+ }
+
+ /* Write file requested from 200 response */
+ /* The caller opened it before any header went out, and closes it */
+ void read_write_file(int client, const char *path, int requested_file,
+                      const file_meta_t *meta) {
+     unsigned char *buffer = NULL;
+     size_t bytes_read = 0, buffer_size;
+     ssize_t bytes;
+
+     (void)path;
 
      /* Allocate buffer big enough to hold file */
-     /* Since a file size can be anything, getting the file size beforehand -
-        avoids the danger of buffer overflow */
-     /* Having a sized buffer could be dangerous here */
-     buffer_size = (size_t)file_size;
+     /* Size comes from the cached metadata, so no seeking around first */
+     buffer_size = (size_t)meta->size;
      buffer = malloc(buffer_size + 1);
      if (!buffer) {
          perror("Error: malloc() failed to allocate buffer");
          exit(EXIT_FAILURE);
      }
 
-     /* Set everything to null terminating characters */
-     /* Avoids having to null terminate the buffer later on */
-     memset(buffer, '\0', buffer_size + 1);
-
      /* Write contents of file to buffer */
-     while ((bytes_read = fread(buffer, 1, file_size, requested_file)) > 0) {
+     /* Stops early if the file shrank underneath us */
+     while (bytes_read < buffer_size) {
+         bytes = read(requested_file, buffer + bytes_read,
+                      buffer_size - bytes_read);
+         if (bytes <= 0) {
+             break;
+         }
+         bytes_read += (size_t)bytes;
+     }
 
-         /* Write content length header */
-         write_content_length(client, bytes_read);
+     /* Write content length header, even for an empty file */
+     write_content_length(client, bytes_read);
 
-         /* Write body of header to client socket */
-         if (write(client, buffer, bytes_read) == ERROR) {
-             perror("Error: cannot write to socket");
-             exit(EXIT_FAILURE);
-         }
+     /* Write body of header to client socket */
+     /* A failed write only loses this client */
+     if (bytes_read > 0 && !io_write_all(client, buffer, bytes_read)) {
+         perror("Error: cannot write to socket");
      }
 
      /* Buffer has served its purpose, free it up */
      free(buffer);
 
-     /* Close the file, just in case */
-     fclose(requested_file);
-
      return;
  }
 
  void construct_file_response(int client, const char *path,
                                           const char *status) {
-     char *requested_file_extension = NULL;
-     bool found = false;
+     const char *mime_type = NULL;
 
      /* Write the status header */
-     write(client, status, strlen(status));
+     io_write_all(client, status, strlen(status));
 
-     /* Get the file extension */
-     requested_file_extension = strrchr(path, '.');
+     /* See if the extension is served, by this host */
+     mime_type = lookup_mime_type(strrchr(path, '.'));
 
-     /* If no extension exists, write appropriate response and exit */
-     if (!requested_file_extension) {
-         write(client, not_supported, strlen(not_supported));
+     /* No extension, or not a served one, write not supported response */
+     if (!mime_type) {
+         io_write_all(client, not_supported, strlen(not_supported));
          return;
-
      }
 
-     /* otherwise, see if extension is served */
-     for (size_t i = 0; i < ARRAY_LENGTH(file_map); i++) {
-         if (strcmp(file_map[i].extension, requested_file_extension) == 0) {
-
-             /* Write http content type */
-             write_headers(client, file_map[i].mime_type, content_header);
-             found = true;
-             break;
-         }
-     }
-
-     /* No extension was found, write not supported response */
-     if (!found) {
-         write(client, not_supported, strlen(not_supported));
-     }
+     /* Write http content type */
+     write_headers(client, mime_type, content_header);
 
      return;
  }
@@ -9,9 +9,18 @@
 #ifndef HTTP_H
 #define HTTP_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "filecache.h"
+
 /* Status code flags */
 #define NOT_FOUND 404
 #define FOUND 200
+#define MOVED 301
+
+/* Directory without an index file, not a status code */
+#define LISTING 1
 #define ERROR -1
 
 /* Array length macro for calculating length */
@@ -19,17 +28,68 @@
 
 /* Header constants, used as boilerplates for http responses */
 extern const char found[];
-extern const char not_found[];
 extern const char content_header[];
 extern const char length_header[];
 extern const char not_supported[];
-extern const char no_content[];
+
+/* Fixed responses, pre-rendered by init_responses() */
+typedef enum {
+    RESPONSE_OPTIONS,
+    RESPONSE_BAD_REQUEST,
+    RESPONSE_NOT_FOUND,
+    RESPONSE_NOT_ALLOWED,
+    RESPONSE_TIMEOUT,
+    RESPONSE_TOO_LARGE,
+    RESPONSE_NOT_IMPLEMENTED,
+    RESPONSE_UNAVAILABLE,
+    RESPONSE_BAD_GATEWAY,
+    NUM_RESPONSES
+} response_t;
+
+/* Request methods, grouped by how they are answered */
+typedef enum {
+    METHOD_GET,
+    METHOD_HEAD,
+    METHOD_OPTIONS,
+    METHOD_NOT_ALLOWED,
+    METHOD_NOT_IMPLEMENTED
+} http_method_t;
+
+/* Well-known request headers, given IDs once at parse time */
+typedef enum {
+    HEADER_HOST,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_UPGRADE,
+    HEADER_HTTP2_SETTINGS,
+    HEADER_RANGE,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_IF_NONE_MATCH,
+    HEADER_USER_AGENT,
+    HEADER_COOKIE,
+    NUM_HEADERS
+} header_id_t;
+
+/* Slots in the name hash table, power of two well above NUM_HEADERS */
+#define HEADER_SLOTS 64
 
 /* HTTP request information struct */
 typedef struct {
     char *method;
     char *URI;
     char *httpversion;
+
+    /* Query string as sent, between the ? and any #, pointing into the -
+       request buffer, NULL when there wasn't one */
+    const char *query;
+    size_t query_length;
+
+    /* Well-known header values by ID, trimmed and pointing into the -
+       request buffer, NULL when the header wasn't sent */
+    const char *headers[NUM_HEADERS];
+    size_t header_lengths[NUM_HEADERS];
 } http_request_t;
 
 /* Served file properties, including extension and mime type */
@@ -41,9 +101,32 @@ typedef struct {
 extern const file_properties_t file_map[];
 
 /* Function prototypes */
-void parse_request(http_request_t *parameters, const char *response);
-char *get_full_path(const char *path, const char *webroot, int *status);
-void read_write_file(int client, const char *path);
+void init_responses(void);
+void init_headers(void);
+void send_response(int client, response_t response);
+bool is_canonical_uri(const char *uri);
+bool normalize_uri(char *uri);
+bool path_has_prefix(const char *path, const char *prefix, size_t length);
+bool encode_uri(char *out, size_t size, const char *path, const char *query,
+                size_t query_length);
+bool parse_request(http_request_t *parameters, const char *request,
+                   size_t length);
+bool parse_content_length(const char *value, size_t length, size_t *out);
+const char *get_header(const char *request, const char *name,
+                       size_t *length);
+int find_header_id(const char *name, size_t length);
+const char *request_header(const http_request_t *request, header_id_t id,
+                           size_t *length);
+bool header_has_token(const char *value, size_t length, const char *token);
+http_method_t get_method(const char *method);
+const char *lookup_mime_type(const char *extension);
+int get_file_status(const char *path, file_meta_t *meta);
+const char *get_served_path(const char *uri, char *buffer, size_t size);
+void send_redirect(int client, const char *uri);
+void write_content_length(int client, size_t bytes_read);
+void write_cache_headers(int client, const file_meta_t *meta);
+void read_write_file(int client, const char *path, int requested_file,
+                     const file_meta_t *meta);
 void construct_file_response(int client, const char *path, const char *status);
 
 #endif
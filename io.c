@@ -0,0 +1,92 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: io.c
+ * Purpose: socket I/O module. Clients are accepted non-blocking, so every -
+            write has to cope with a full socket buffer. These helpers poll -
+            and retry, so workers keep their straight line code
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "io.h"
+#include "http.h"
+
+/* Wait until ready */
+bool io_wait(int fd, short events) {
+    struct pollfd ready = { .fd = fd, .events = events };
+
+    while (poll(&ready, 1, -1) == ERROR) {
+        if (errno != EINTR) {
+            perror("Error: poll() failed");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Write a whole buffer */
+bool io_write_all(int fd, const void *buffer, size_t length) {
+    const char *ptr = buffer;
+    ssize_t written;
+
+    while (length > 0) {
+        written = write(fd, ptr, length);
+        if (written == ERROR) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) &&
+                io_wait(fd, POLLOUT)) {
+                continue;
+            }
+
+            return false;
+        }
+
+        ptr += written;
+        length -= (size_t)written;
+    }
+
+    return true;
+}
+
+/* Write a whole iovec array */
+bool io_writev_all(int fd, struct iovec *iov, int count) {
+    ssize_t written;
+
+    while (count > 0) {
+        written = writev(fd, iov, count);
+        if (written == ERROR) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) &&
+                io_wait(fd, POLLOUT)) {
+                continue;
+            }
+
+            return false;
+        }
+
+        /* Skip what went out */
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,29 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: io.h
+ * Purpose: socket I/O header file. Defines blocking style helpers for the -
+            non-blocking client sockets
+ */
+
+#ifndef IO_H
+#define IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+/* Wait until a non-blocking descriptor is ready for events */
+/* There is no timeout, deadlines shut the socket down which ends the wait */
+/* Returns false if poll() itself failed */
+bool io_wait(int fd, short events);
+
+/* Write a whole buffer, waiting whenever the socket is full */
+/* Returns false if the client is gone */
+bool io_write_all(int fd, const void *buffer, size_t length);
+
+/* Write a whole iovec array, which is consumed as it goes out */
+/* Returns false if the client is gone */
+bool io_writev_all(int fd, struct iovec *iov, int count);
+
+#endif
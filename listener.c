@@ -0,0 +1,253 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: listener.c
+ * Purpose: listener module. Parses listen addresses and sets up listening -
+            sockets for them. A bare port listens on IPv6 with IPv4 mapped -
+            in, falling back to IPv4 alone on hosts without IPv6
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "listener.h"
+#include "tune.h"
+#include "http.h"
+
+/* Print the address format and exit */
+static void bad_address(const char *address) {
+    fprintf(stderr, "Error: cannot parse address %s, expected PORT, "
+                    "IPV4:PORT, [IPV6]:PORT, unix:/path or unix:@name\n",
+            address);
+    exit(EXIT_FAILURE);
+}
+
+/* Convert a port number */
+static in_port_t parse_port(const char *address, const char *port) {
+    char *end = NULL;
+    long number;
+
+    number = strtol(port, &end, 10);
+    if (*port == '\0' || *end != '\0' || number < 0 || number > 65535) {
+        bad_address(address);
+    }
+
+    return htons((in_port_t)number);
+}
+
+/* Fill in a unix socket address */
+/* Returns the address length, abstract names aren't NUL terminated */
+static socklen_t parse_unix(const char *address, struct sockaddr_un *un) {
+    const char *path = address + strlen(UNIX_PREFIX);
+    size_t length = strlen(path);
+
+    memset(un, '\0', sizeof *un);
+    un->sun_family = AF_UNIX;
+
+    if (length == 0 || length >= sizeof un->sun_path) {
+        bad_address(address);
+    }
+
+    memcpy(un->sun_path, path, length);
+
+    /* Abstract namespace, nothing on disk to clean up */
+    if (path[0] == '@') {
+        un->sun_path[0] = '\0';
+        return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + length);
+    }
+
+    return (socklen_t)sizeof *un;
+}
+
+/* Fill in a TCP address */
+/* Returns the address length */
+static socklen_t parse_inet(const char *address,
+                            struct sockaddr_storage *addr) {
+    struct sockaddr_in6 *v6 = (struct sockaddr_in6 *)addr;
+    struct sockaddr_in *v4 = (struct sockaddr_in *)addr;
+    char host[INET6_ADDRSTRLEN];
+    const char *colon = NULL, *close = NULL;
+    size_t length;
+
+    memset(addr, '\0', sizeof *addr);
+
+    /* Bare port, any address on both stacks */
+    if (!strchr(address, ':')) {
+        v6->sin6_family = AF_INET6;
+        v6->sin6_addr = in6addr_any;
+        v6->sin6_port = parse_port(address, address);
+        return sizeof *v6;
+    }
+
+    /* [IPV6]:PORT */
+    if (address[0] == '[') {
+        close = strchr(address, ']');
+        if (!close || close[1] != ':' ||
+            (length = (size_t)(close - address - 1)) >= sizeof host) {
+            bad_address(address);
+        }
+
+        memcpy(host, address + 1, length);
+        host[length] = '\0';
+
+        v6->sin6_family = AF_INET6;
+        v6->sin6_port = parse_port(address, close + 2);
+        if (inet_pton(AF_INET6, host, &v6->sin6_addr) != 1) {
+            bad_address(address);
+        }
+        return sizeof *v6;
+    }
+
+    /* IPV4:PORT */
+    colon = strrchr(address, ':');
+    length = (size_t)(colon - address);
+    if (length >= sizeof host) {
+        bad_address(address);
+    }
+
+    memcpy(host, address, length);
+    host[length] = '\0';
+
+    v4->sin_family = AF_INET;
+    v4->sin_port = parse_port(address, colon + 1);
+    if (inet_pton(AF_INET, host, &v4->sin_addr) != 1) {
+        bad_address(address);
+    }
+
+    return sizeof *v4;
+}
+
+/* Parse any address form */
+socklen_t listener_parse(const char *address, struct sockaddr_storage *addr) {
+    if (strncmp(address, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0) {
+        return parse_unix(address, (struct sockaddr_un *)addr);
+    }
+
+    return parse_inet(address, addr);
+}
+
+/* Create a socket, falling back from dual-stack to IPv4 */
+static int open_socket(struct sockaddr_storage *addr, socklen_t *length) {
+    struct sockaddr_in6 *v6 = (struct sockaddr_in6 *)addr;
+    struct sockaddr_in *v4 = (struct sockaddr_in *)addr;
+    in_port_t port;
+    int sock;
+
+    sock = socket(addr->ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+    /* No IPv6 on this host, a bare port still gets IPv4 */
+    if (sock == ERROR && errno == EAFNOSUPPORT &&
+        addr->ss_family == AF_INET6 &&
+        IN6_IS_ADDR_UNSPECIFIED(&v6->sin6_addr)) {
+        port = v6->sin6_port;
+        memset(addr, '\0', sizeof *addr);
+        v4->sin_family = AF_INET;
+        v4->sin_addr.s_addr = INADDR_ANY;
+        v4->sin_port = port;
+        *length = sizeof *v4;
+
+        sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    }
+
+    return sock;
+}
+
+/* Open a listener */
+void listener_open(listener_t *listener, const char *address, int backlog) {
+    struct sockaddr_storage addr;
+    struct sockaddr_un *un = (struct sockaddr_un *)&addr;
+    struct stat info;
+    socklen_t length;
+    int sock, reuse = 1, v6only = 0;
+
+    length = listener_parse(address, &addr);
+
+    /* Setup the socket, non-blocking so the acceptor can drain it */
+    sock = open_socket(&addr, &length);
+    if (sock == ERROR) {
+        perror("Error: cannot open socket");
+        exit(EXIT_FAILURE);
+    }
+    printf("Listening socket created.\n");
+
+    if (addr.ss_family == AF_UNIX) {
+        /* A socket file left over from an earlier run blocks bind(), -
+           anything else at that path is left alone */
+        if (un->sun_path[0] != '\0' && lstat(un->sun_path, &info) == 0 &&
+            S_ISSOCK(info.st_mode)) {
+            unlink(un->sun_path);
+        }
+    } else {
+        /* Set socket option SO_REUSEADDR. If a recently closed server -
+           wants to use this port, and some of the leftover chunks is -
+           lingering around we can still use this port */
+        if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR,
+                       &reuse, sizeof reuse) == ERROR) {
+            perror("Error: setting socket option for reusing address");
+            exit(EXIT_FAILURE);
+        }
+
+        /* IPv4 clients arrive as mapped addresses on the IPv6 socket */
+        if (addr.ss_family == AF_INET6 &&
+            setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY,
+                       &v6only, sizeof v6only) == ERROR) {
+            perror("Error: setting socket option for dual-stack");
+        }
+
+        /* Buffer sizes have to be in place before any handshake */
+        tune_listener(sock);
+    }
+
+    /* Bind address to the socket */
+    if (bind(sock, (struct sockaddr *)&addr, length) == ERROR) {
+        perror("Error: cannot bind address to socket");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Binding done.\n");
+    printf("Listening on: %s.\n", address);
+
+    /* Listen on socket - means we're ready to accept connections -
+       incoming connection requests will be queued */
+    if (listen(sock, backlog) == ERROR) {
+        perror("Error: cannot listen on socket");
+        exit(EXIT_FAILURE);
+    }
+
+    listener->fd = sock;
+    listener->family = addr.ss_family;
+
+    return;
+}
+
+/* Take over a listener from a handoff */
+void listener_adopt(listener_t *listener, int fd, int backlog) {
+    struct sockaddr_storage addr;
+    socklen_t length = sizeof addr;
+
+    if (getsockname(fd, (struct sockaddr *)&addr, &length) == ERROR) {
+        perror("Error: getsockname() failed on handed over socket");
+        exit(EXIT_FAILURE);
+    }
+
+    listener->fd = fd;
+    listener->family = addr.ss_family;
+
+    /* Take on this binary's tuning, listen() again resizes the backlog */
+    if (listener->family != AF_UNIX) {
+        tune_listener(fd);
+    }
+    listen(fd, backlog);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return;
+}
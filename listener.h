@@ -0,0 +1,46 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: listener.h
+ * Purpose: listener header file. Defines the listening sockets the server -
+            accepts clients on, over TCP or unix sockets
+ */
+
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <stdbool.h>
+#include <sys/socket.h>
+
+#include "handoff.h"
+
+/* Most addresses listened on at once, all of them can be handed off */
+#define MAX_LISTENERS HANDOFF_MAX_FDS
+
+/* Prefix of unix socket addresses, @ after it for the abstract namespace */
+#define UNIX_PREFIX "unix:"
+
+/* An open listening socket */
+typedef struct {
+    int fd;
+    sa_family_t family;
+
+    /* Clients handshake before sending a request */
+    bool tls;
+} listener_t;
+
+/* Fill in a socket address from any of the forms below, exits if it -
+   can't. Returns the address length */
+/* Also used for addresses the server connects to, where a bare port -
+   means this host */
+socklen_t listener_parse(const char *address, struct sockaddr_storage *addr);
+
+/* Open a non-blocking listener for an address, exits if it can't */
+/* Takes PORT for dual-stack IPv6 and IPv4, IPV4:PORT, [IPV6]:PORT, -
+   unix:/path or unix:@abstract */
+void listener_open(listener_t *listener, const char *address, int backlog);
+
+/* Take over a listener passed in by a handoff, applying our settings */
+void listener_adopt(listener_t *listener, int fd, int backlog);
+
+#endif
@@ -0,0 +1,236 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: listing.c
+ * Purpose: directory listing module. Renders an HTML page of a directory -
+            beneath the webroot, sorted by name. Only the decision that a -
+            directory has no index is cached, the page itself is built -
+            from readdir() each time so it never goes stale
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "listing.h"
+#include "http.h"
+#include "webroot.h"
+#include "ticker.h"
+#include "io.h"
+
+/* One listed name, directories get a trailing slash */
+typedef struct {
+    char *name;
+    bool is_dir;
+} listing_entry_t;
+
+/* Orders entries by name */
+static int compare_entries(const void *a, const void *b) {
+    const listing_entry_t *left = a, *right = b;
+
+    return strcmp(left->name, right->name);
+}
+
+/* Write text with HTML special characters escaped */
+static void write_escaped(FILE *out, const char *text) {
+    for (; *text; text++) {
+        switch (*text) {
+        case '&':
+            fputs("&amp;", out);
+            break;
+        case '<':
+            fputs("&lt;", out);
+            break;
+        case '>':
+            fputs("&gt;", out);
+            break;
+        case '"':
+            fputs("&quot;", out);
+            break;
+        default:
+            fputc(*text, out);
+            break;
+        }
+    }
+}
+
+/* Write a name as a relative link, percent encoding anything unsafe */
+static void write_href(FILE *out, const char *name) {
+    for (; *name; name++) {
+        if (isalnum((unsigned char)*name) ||
+            strchr("-._~!$'()*+,;=:@", *name)) {
+            fputc(*name, out);
+        } else {
+            fprintf(out, "%%%02X", (unsigned char)*name);
+        }
+    }
+}
+
+/* Checks if a directory entry is worth listing */
+static bool listable(DIR *dir, const struct dirent *entry, bool *is_dir) {
+    struct stat info;
+    unsigned char type = entry->d_type;
+
+    /* Hidden files stay hidden */
+    if (entry->d_name[0] == '.') {
+        return false;
+    }
+
+    /* Some filesystems don't fill in d_type */
+    if (type == DT_UNKNOWN) {
+        if (fstatat(dirfd(dir), entry->d_name, &info,
+                    AT_SYMLINK_NOFOLLOW) == ERROR) {
+            return false;
+        }
+        type = S_ISDIR(info.st_mode) ? DT_DIR :
+               S_ISREG(info.st_mode) ? DT_REG : DT_UNKNOWN;
+    }
+
+    *is_dir = type == DT_DIR;
+
+    /* Files only if a request for them would be served */
+    return *is_dir ||
+           ((type == DT_REG || type == DT_LNK) &&
+            lookup_mime_type(strrchr(entry->d_name, '.')));
+}
+
+/* Read the listable names of a directory */
+/* Returns how many were read, or ERROR if it can't be opened */
+static int read_entries(const char *uri, listing_entry_t *entries) {
+    struct dirent *entry = NULL;
+    DIR *dir = NULL;
+    bool is_dir;
+    int fd, count = 0;
+
+    fd = webroot_open(uri, O_RDONLY | O_DIRECTORY);
+    if (fd == ERROR) {
+        return ERROR;
+    }
+
+    dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+        return ERROR;
+    }
+
+    while (count < LISTING_MAX_ENTRIES && (entry = readdir(dir))) {
+        if (!listable(dir, entry, &is_dir)) {
+            continue;
+        }
+
+        entries[count].name = strdup(entry->d_name);
+        if (!entries[count].name) {
+            perror("Error: strdup() failed to copy directory entry");
+            exit(EXIT_FAILURE);
+        }
+        entries[count].is_dir = is_dir;
+        count++;
+    }
+
+    /* Closes fd too */
+    closedir(dir);
+
+    qsort(entries, (size_t)count, sizeof *entries, compare_entries);
+
+    return count;
+}
+
+/* Render the page for a directory */
+/* Returns the page, which the caller frees */
+static char *render_page(const char *uri, const listing_entry_t *entries,
+                         int count, size_t *length) {
+    char *page = NULL;
+    FILE *out = NULL;
+
+    out = open_memstream(&page, length);
+    if (!out) {
+        perror("Error: open_memstream() failed to allocate listing");
+        exit(EXIT_FAILURE);
+    }
+
+    fputs("<!DOCTYPE html>\n<html>\n<head><title>Index of ", out);
+    write_escaped(out, uri);
+    fputs("</title></head>\n<body>\n<h1>Index of ", out);
+    write_escaped(out, uri);
+    fputs("</h1>\n<ul>\n", out);
+
+    /* The webroot has no parent to go up to */
+    if (strcmp(uri, "/") != 0) {
+        fputs("<li><a href=\"../\">../</a></li>\n", out);
+    }
+
+    for (int i = 0; i < count; i++) {
+        fputs("<li><a href=\"", out);
+        write_href(out, entries[i].name);
+        fputs(entries[i].is_dir ? "/\">" : "\">", out);
+        write_escaped(out, entries[i].name);
+        fputs(entries[i].is_dir ? "/</a></li>\n" : "</a></li>\n", out);
+    }
+
+    fputs("</ul>\n</body>\n</html>\n", out);
+
+    if (fclose(out) == EOF) {
+        perror("Error: cannot render listing");
+        exit(EXIT_FAILURE);
+    }
+
+    return page;
+}
+
+/* Send a directory listing */
+void listing_send(int client, const char *uri, bool head) {
+    listing_entry_t *entries = NULL;
+    char date[DATE_HEADER_SIZE], header[128], *page = NULL;
+    struct iovec iov[4];
+    size_t length = 0;
+    int count;
+
+    entries = malloc(LISTING_MAX_ENTRIES * sizeof *entries);
+    if (!entries) {
+        perror("Error: malloc() failed to allocate listing entries");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Directory went away since it was resolved */
+    count = read_entries(uri, entries);
+    if (count == ERROR) {
+        free(entries);
+        send_response(client, RESPONSE_NOT_FOUND);
+        return;
+    }
+
+    page = render_page(uri, entries, count, &length);
+
+    for (int i = 0; i < count; i++) {
+        free(entries[i].name);
+    }
+    free(entries);
+
+    snprintf(header, sizeof header,
+             "Content-Type: text/html\r\nContent-Length: %zu\r\n\r\n",
+             length);
+    ticker_date(date);
+
+    iov[0].iov_base = (void *)found;
+    iov[0].iov_len = strlen(found);
+    iov[1].iov_base = date;
+    iov[1].iov_len = sizeof date;
+    iov[2].iov_base = header;
+    iov[2].iov_len = strlen(header);
+    iov[3].iov_base = page;
+    iov[3].iov_len = head ? 0 : length;
+
+    if (!io_writev_all(client, iov, ARRAY_LENGTH(iov))) {
+        perror("Error: cannot write to socket");
+    }
+
+    free(page);
+
+    return;
+}
@@ -0,0 +1,22 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: listing.h
+ * Purpose: directory listing header file. Defines the generated page -
+            served for directories without an index file
+ */
+
+#ifndef LISTING_H
+#define LISTING_H
+
+#include <stdbool.h>
+
+/* Most entries shown on one page, the rest are left off */
+#define LISTING_MAX_ENTRIES 4096
+
+/* Send a listing of the directory a URI ending in / names */
+/* Only subdirectories and files with a served extension are listed. -
+   HEAD gets the header alone. Answers 404 if the directory is gone */
+void listing_send(int client, const char *uri, bool head);
+
+#endif
@@ -0,0 +1,305 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: mapcache.c
+ * Purpose: mapping cache module. Maps each served file once and shares the -
+            mapping between workers, so bodies are sent straight from the -
+            page cache without a copy. Mappings are refcounted, an -
+            invalidated one is unmapped once the last send from it is -
+            done. Mappings are keyed by virtual host as well as by URI
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mapcache.h"
+#include "http.h"
+#include "vhost.h"
+
+static struct {
+    pthread_mutex_t mutex;
+    mapping_t *buckets[MAPCACHE_BUCKETS];
+    size_t mapped_bytes;
+    bool enabled;
+    bool populate;
+} cache = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+/* FNV-1a hash of a host and a URI */
+static uint32_t hash_uri(int host, const char *uri) {
+    uint32_t hash = UINT32_C(2166136261) ^ (uint32_t)host;
+
+    while (*uri) {
+        hash ^= (unsigned char)*uri++;
+        hash *= UINT32_C(16777619);
+    }
+
+    return hash;
+}
+
+/* Set up the cache */
+void mapcache_init(bool populate) {
+    cache.mapped_bytes = 0;
+    cache.enabled = false;
+    cache.populate = populate;
+
+    return;
+}
+
+/* Turn caching of mappings on or off */
+void mapcache_enable(bool enabled) {
+    pthread_mutex_lock(&cache.mutex);
+    cache.enabled = enabled;
+    pthread_mutex_unlock(&cache.mutex);
+
+    if (!enabled) {
+        mapcache_flush();
+    }
+
+    return;
+}
+
+/* Drop a reference, mutex held */
+/* Returns the mapping if that was the last one, so it is unmapped unlocked */
+static mapping_t *release(mapping_t *mapping) {
+    return --mapping->refs == 0 ? mapping : NULL;
+}
+
+/* Unmap and free a mapping nobody holds any more */
+static void destroy(mapping_t *mapping) {
+    if (!mapping) {
+        return;
+    }
+
+    munmap(mapping->addr, mapping->length);
+    free(mapping->uri);
+    free(mapping);
+}
+
+/* Unlink a mapping from its bucket, mutex held */
+/* Returns the mapping if the cache held the last reference */
+static mapping_t *unlink_mapping(mapping_t **link) {
+    mapping_t *mapping = *link;
+
+    *link = mapping->next;
+    mapping->linked = false;
+    cache.mapped_bytes -= mapping->length;
+
+    return release(mapping);
+}
+
+/* Map an open file */
+/* Returns NULL if it is empty or changed size */
+static mapping_t *map_file(const char *uri, int fd, const file_meta_t *meta,
+                           bool cached) {
+    mapping_t *mapping = NULL;
+    struct stat info;
+    void *addr = NULL;
+    int flags = MAP_SHARED;
+
+    if (meta->size <= 0) {
+        return NULL;
+    }
+
+    /* Mapping past the end of a file that shrank would raise SIGBUS */
+    if (fstat(fd, &info) == ERROR || info.st_size != meta->size) {
+        return NULL;
+    }
+
+    /* Hot files pay for the page faults once, up front */
+    if (cached && cache.populate) {
+        flags |= MAP_POPULATE;
+    }
+
+    addr = mmap(NULL, (size_t)meta->size, PROT_READ, flags, fd, 0);
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+
+    /* One-off mappings still start readahead without blocking on it */
+    if (!cached && cache.populate) {
+        madvise(addr, (size_t)meta->size, MADV_WILLNEED);
+    }
+
+    mapping = malloc(sizeof *mapping);
+    if (!mapping) {
+        perror("Error: malloc() failed to allocate mapping");
+        exit(EXIT_FAILURE);
+    }
+
+    mapping->uri = strdup(uri);
+    if (!mapping->uri) {
+        perror("Error: strdup() failed to copy URI");
+        exit(EXIT_FAILURE);
+    }
+
+    mapping->host = vhost_current();
+    mapping->addr = addr;
+    mapping->length = (size_t)meta->size;
+    mapping->mtime = meta->mtime;
+    mapping->refs = 1;
+    mapping->linked = false;
+    mapping->next = NULL;
+
+    return mapping;
+}
+
+/* Get a referenced mapping */
+mapping_t *mapcache_get(const char *uri, int fd, const file_meta_t *meta) {
+    mapping_t *mapping = NULL, *stale = NULL, **link = NULL;
+    int host = vhost_current();
+    uint32_t hash = hash_uri(host, uri);
+    bool cacheable;
+
+    pthread_mutex_lock(&cache.mutex);
+
+    link = &cache.buckets[hash & (MAPCACHE_BUCKETS - 1)];
+    while (*link) {
+        mapping = *link;
+        if (mapping->hash == hash && mapping->host == host &&
+            strcmp(mapping->uri, uri) == 0) {
+            /* Metadata moved on, this mapping is of an older file */
+            if (mapping->length != (size_t)meta->size ||
+                mapping->mtime != meta->mtime) {
+                stale = unlink_mapping(link);
+                break;
+            }
+
+            mapping->refs++;
+            pthread_mutex_unlock(&cache.mutex);
+            return mapping;
+        }
+        link = &mapping->next;
+    }
+
+    cacheable = cache.enabled && is_canonical_uri(uri) &&
+                (size_t)meta->size <= MAPCACHE_MAX_FILE;
+
+    pthread_mutex_unlock(&cache.mutex);
+
+    destroy(stale);
+
+    /* Miss, map outside the lock, populating can take a while */
+    mapping = map_file(uri, fd, meta, cacheable);
+    if (!mapping || !cacheable) {
+        return mapping;
+    }
+
+    mapping->hash = hash;
+
+    pthread_mutex_lock(&cache.mutex);
+
+    /* Cache only while there's room, and nobody beat us to it */
+    if (cache.enabled &&
+        cache.mapped_bytes + mapping->length <= MAPCACHE_MAX_BYTES) {
+        for (stale = cache.buckets[hash & (MAPCACHE_BUCKETS - 1)]; stale;
+             stale = stale->next) {
+            if (stale->hash == hash && stale->host == host &&
+                strcmp(stale->uri, uri) == 0) {
+                break;
+            }
+        }
+
+        if (!stale) {
+            link = &cache.buckets[hash & (MAPCACHE_BUCKETS - 1)];
+            mapping->next = *link;
+            *link = mapping;
+            mapping->linked = true;
+            mapping->refs++;
+            cache.mapped_bytes += mapping->length;
+        }
+    }
+
+    pthread_mutex_unlock(&cache.mutex);
+
+    return mapping;
+}
+
+/* Drop a reference */
+void mapcache_put(mapping_t *mapping) {
+    pthread_mutex_lock(&cache.mutex);
+    mapping = release(mapping);
+    pthread_mutex_unlock(&cache.mutex);
+
+    destroy(mapping);
+
+    return;
+}
+
+/* Drop the mapping of one path */
+void mapcache_invalidate(const char *path) {
+    mapping_t *dead = NULL, **link = NULL;
+    int host = vhost_current();
+    uint32_t hash = hash_uri(host, path);
+
+    pthread_mutex_lock(&cache.mutex);
+
+    link = &cache.buckets[hash & (MAPCACHE_BUCKETS - 1)];
+    while (*link) {
+        if ((*link)->hash == hash && (*link)->host == host &&
+            strcmp((*link)->uri, path) == 0) {
+            dead = unlink_mapping(link);
+            break;
+        }
+        link = &(*link)->next;
+    }
+
+    pthread_mutex_unlock(&cache.mutex);
+
+    destroy(dead);
+
+    return;
+}
+
+/* Drop mappings of the current host whose URI matches, all of them -
+   of every host when dir is NULL */
+static void invalidate_matching(const char *dir) {
+    mapping_t *dead = NULL, *mapping = NULL, **link = NULL;
+    size_t length = dir ? strlen(dir) : 0;
+    int host = vhost_current();
+
+    pthread_mutex_lock(&cache.mutex);
+
+    for (size_t i = 0; i < MAPCACHE_BUCKETS; i++) {
+        link = &cache.buckets[i];
+        while (*link) {
+            if (!dir || ((*link)->host == host &&
+                         strncmp((*link)->uri, dir, length) == 0 &&
+                         (*link)->uri[length] == '/')) {
+                /* Chain the ones to unmap through next, already unlinked */
+                mapping = unlink_mapping(link);
+                if (mapping) {
+                    mapping->next = dead;
+                    dead = mapping;
+                }
+            } else {
+                link = &(*link)->next;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&cache.mutex);
+
+    while (dead) {
+        mapping = dead->next;
+        destroy(dead);
+        dead = mapping;
+    }
+}
+
+/* Drop every mapping under a directory */
+void mapcache_invalidate_prefix(const char *dir) {
+    invalidate_matching(dir);
+
+    return;
+}
+
+/* Drop every mapping */
+void mapcache_flush(void) {
+    invalidate_matching(NULL);
+
+    return;
+}
@@ -0,0 +1,69 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: mapcache.h
+ * Purpose: mapping cache header file. Defines the refcounted cache of -
+            memory mapped files shared by every worker
+ */
+
+#ifndef MAPCACHE_H
+#define MAPCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "filecache.h"
+
+/* Number of buckets, power of two */
+#define MAPCACHE_BUCKETS 256
+
+/* Most bytes kept mapped by the cache at once, shared by every host */
+#define MAPCACHE_MAX_BYTES ((size_t)256 << 20)
+
+/* Files bigger than this are mapped per request, never cached */
+#define MAPCACHE_MAX_FILE ((size_t)16 << 20)
+
+/* A mapped file, held by the cache and every worker sending from it */
+typedef struct mapping {
+    char *uri;
+    uint32_t hash;
+    int host;
+    void *addr;
+    size_t length;
+    time_t mtime;
+
+    /* References, the cache holds one while the mapping is linked */
+    unsigned refs;
+    bool linked;
+
+    struct mapping *next;
+} mapping_t;
+
+/* Set up the cache, populate prefaults cached mappings for hot files */
+void mapcache_init(bool populate);
+
+/* Only cache mappings while the watcher can keep them fresh */
+void mapcache_enable(bool enabled);
+
+/* Get a referenced mapping of a file of the current host, matching its -
+   metadata */
+/* fd is the file opened for reading, mapped on a miss and left open. -
+   Returns NULL if the file can't be mapped */
+mapping_t *mapcache_get(const char *uri, int fd, const file_meta_t *meta);
+
+/* Drop a reference, the last one unmaps the file */
+void mapcache_put(mapping_t *mapping);
+
+/* Drop the mapping of one path, relative to the current host's webroot */
+void mapcache_invalidate(const char *path);
+
+/* Drop every mapping under a directory, relative to the current host's -
+   webroot */
+void mapcache_invalidate_prefix(const char *dir);
+
+/* Drop every mapping, of every host */
+void mapcache_flush(void);
+
+#endif
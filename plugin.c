@@ -0,0 +1,334 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: plugin.c
+ * Purpose: plugin module. Loads handler plugins with dlopen() at startup -
+            and copies their entry points into a flat table, so checking a -
+            request is a loop over plain function pointers with no -
+            symbol lookups. Requests are shown to plugins as slices of the -
+            connection buffer, nothing is copied
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <netinet/in.h>
+#include <sys/uio.h>
+
+#include "plugin.h"
+#include "config.h"
+#include "ticker.h"
+#include "timer.h"
+#include "tune.h"
+#include "stats.h"
+#include "http.h"
+#include "io.h"
+
+/* One loaded plugin, in the order it was given */
+typedef struct {
+    bool (*match)(void *state, const plugin_request_t *request);
+    void (*handle)(void *state, const plugin_request_t *request,
+                   plugin_response_t *response);
+    void *state;
+} dispatch_entry_t;
+
+/* What a request view points back to */
+typedef struct {
+    const connection_t *conn;
+    const http_request_t *parsed;
+} request_host_t;
+
+/* What a response has built up before its first write */
+typedef struct {
+    plugin_response_t api;
+    connection_t *conn;
+
+    int status;
+    const char *reason;
+    char headers[PLUGIN_HEADER_SIZE];
+    size_t header_length;
+
+    bool started;
+    bool failed;
+} response_state_t;
+
+/* Hot table first, only touched on dispatch */
+static dispatch_entry_t table[MAX_PLUGINS];
+static size_t num_entries = 0;
+
+/* Kept for teardown */
+static const plugin_handler_t *handlers[MAX_PLUGINS];
+static void *libraries[MAX_PLUGINS];
+
+/* Load the plugins */
+void plugin_init(const char *const *specs, int count) {
+    const plugin_handler_t *handler = NULL;
+    const char *equals = NULL, *argument = NULL;
+    char *path = NULL;
+    void *library = NULL, *state = NULL;
+
+    for (int i = 0; i < count; i++) {
+        /* Everything after the first = is the plugin's own */
+        equals = strchr(specs[i], '=');
+        argument = equals ? equals + 1 : NULL;
+        path = equals ? strndup(specs[i], (size_t)(equals - specs[i]))
+                      : strdup(specs[i]);
+        if (!path) {
+            perror("Error: strdup() failed to copy plugin path");
+            exit(EXIT_FAILURE);
+        }
+
+        library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        if (!library) {
+            fprintf(stderr, "Error: cannot load plugin: %s\n", dlerror());
+            exit(EXIT_FAILURE);
+        }
+
+        handler = dlsym(library, PLUGIN_SYMBOL);
+        if (!handler || handler->abi_version != PLUGIN_ABI_VERSION ||
+            !handler->match || !handler->handle) {
+            fprintf(stderr, "Error: %s is not a plugin for ABI version %d\n",
+                    path, PLUGIN_ABI_VERSION);
+            exit(EXIT_FAILURE);
+        }
+
+        state = handler->init ? handler->init(argument) : NULL;
+        if (handler->init && !state) {
+            fprintf(stderr, "Error: plugin %s refused to start\n",
+                    handler->name ? handler->name : path);
+            exit(EXIT_FAILURE);
+        }
+
+        table[num_entries].match = handler->match;
+        table[num_entries].handle = handler->handle;
+        table[num_entries].state = state;
+        handlers[num_entries] = handler;
+        libraries[num_entries] = library;
+        num_entries++;
+
+        printf("Loaded plugin %s\n", handler->name ? handler->name : path);
+        free(path);
+    }
+
+    return;
+}
+
+/* Header lookup for plugins */
+/* Well-known names come straight from the parsed table */
+static bool find_header(const plugin_request_t *request, const char *name,
+                        plugin_slice_t *value) {
+    const request_host_t *host = request->host;
+    int id = find_header_id(name, strlen(name));
+
+    value->data = id != ERROR
+                      ? request_header(host->parsed, id, &value->length)
+                      : get_header(host->conn->buffer, name, &value->length);
+
+    return value->data != NULL;
+}
+
+/* Slice from start up to the first of stop, or the end */
+static plugin_slice_t slice_until(const char *start, const char *end,
+                                  const char *stop) {
+    plugin_slice_t slice = { .data = start, .length = 0 };
+
+    while (start + slice.length < end &&
+           !strchr(stop, start[slice.length])) {
+        slice.length++;
+    }
+
+    return slice;
+}
+
+/* Point a request view into the connection buffer */
+/* The request line was already parsed, so its three parts are there, -
+   and the header was checked to end in a blank line */
+static void view_request(const request_host_t *host,
+                         plugin_request_t *request, char *peer,
+                         size_t peer_size) {
+    const connection_t *conn = host->conn;
+    const char *buffer = conn->buffer, *body = conn_body(conn), *end = NULL;
+    const char *line_end = strchr(buffer, '\n'), *next = NULL;
+
+    memset(request, '\0', sizeof *request);
+    request->host = host;
+    request->header = find_header;
+
+    request->method = slice_until(buffer, line_end, " ");
+    next = request->method.data + request->method.length + 1;
+    request->uri = slice_until(next, line_end, " ");
+    next = request->uri.data + request->uri.length + 1;
+    request->version = slice_until(next, line_end, "\r\n");
+
+    /* Path is the normalized one the other handlers match */
+    request->path.data = host->parsed->URI;
+    request->path.length = strlen(host->parsed->URI);
+    request->query.data = host->parsed->query;
+    request->query.length = host->parsed->query_length;
+
+    /* Header lines run up to the blank line, the body after it */
+    end = strstr(buffer, "\r\n\r\n");
+    end = end ? end : strstr(buffer, "\n\n");
+
+    request->headers.data = line_end + 1;
+    request->headers.length = end > line_end ? (size_t)(end - line_end - 1)
+                                             : 0;
+    request->body.data = body;
+    request->body.length = conn->length - (size_t)(body - buffer);
+
+    request->peer = conn_peer_address(conn, peer, peer_size) ? peer : "";
+}
+
+/* Set the status */
+static void set_status(plugin_response_t *response, int code,
+                       const char *reason) {
+    response_state_t *state = response->host;
+
+    if (!state->started) {
+        state->status = code;
+        state->reason = reason;
+    }
+}
+
+/* Add a header */
+static bool add_header(plugin_response_t *response, const char *name,
+                       const char *value) {
+    response_state_t *state = response->host;
+    int written;
+
+    if (state->started) {
+        return false;
+    }
+
+    written = snprintf(state->headers + state->header_length,
+                       sizeof state->headers - state->header_length,
+                       "%s: %s\r\n", name, value);
+    if (written < 0 ||
+        (size_t)written >= sizeof state->headers - state->header_length) {
+        return false;
+    }
+    state->header_length += (size_t)written;
+
+    return true;
+}
+
+/* Send the status line, Date and the plugin's headers */
+static bool start_response(response_state_t *state) {
+    char status[64], date[DATE_HEADER_SIZE];
+    struct iovec iov[4];
+    int length;
+
+    state->started = true;
+
+    length = snprintf(status, sizeof status, "HTTP/1.0 %d %s\r\n",
+                      state->status, state->reason);
+    if (length < 0 || (size_t)length >= sizeof status) {
+        length = (int)sizeof status - 1;
+    }
+    ticker_date(date);
+
+    iov[0].iov_base = status;
+    iov[0].iov_len = (size_t)length;
+    iov[1].iov_base = date;
+    iov[1].iov_len = sizeof date;
+    iov[2].iov_base = state->headers;
+    iov[2].iov_len = state->header_length;
+    iov[3].iov_base = (void *)"\r\n";
+    iov[3].iov_len = 2;
+
+    state->failed = !io_writev_all(state->conn->fd, iov, 4);
+
+    return !state->failed;
+}
+
+/* Write body bytes */
+static bool write_body(plugin_response_t *response, const void *data,
+                       size_t length) {
+    response_state_t *state = response->host;
+
+    if (!state->started && !start_response(state)) {
+        return false;
+    }
+
+    if (!state->failed && length > 0) {
+        state->failed = !io_write_all(state->conn->fd, data, length);
+    }
+
+    return !state->failed;
+}
+
+/* Dispatch a request */
+bool plugin_dispatch(connection_t *conn, const http_request_t *parsed) {
+    request_host_t host = { .conn = conn, .parsed = parsed };
+    plugin_request_t request;
+    response_state_t response;
+    char peer[INET6_ADDRSTRLEN];
+    size_t i;
+
+    if (num_entries == 0) {
+        return false;
+    }
+
+    /* Client stopped sending before the blank line, there's no header -
+       or body for a plugin to see, and no other handler takes it either */
+    if (!conn_body(conn)) {
+        send_response(conn->fd, RESPONSE_BAD_REQUEST);
+        return true;
+    }
+
+    view_request(&host, &request, peer, sizeof peer);
+
+    for (i = 0; i < num_entries; i++) {
+        if (table[i].match(table[i].state, &request)) {
+            break;
+        }
+    }
+
+    if (i == num_entries) {
+        return false;
+    }
+
+    STAT_INC(plugin_requests);
+
+    response.api.status = set_status;
+    response.api.header = add_header;
+    response.api.write = write_body;
+    response.api.host = &response;
+    response.conn = conn;
+    response.status = 200;
+    response.reason = "OK";
+    response.header_length = 0;
+    response.started = false;
+    response.failed = false;
+
+    /* Whole response has to go out before the write deadline */
+    timer_add(&conn->timer, config.write_timeout, conn_expired, conn);
+    tune_cork(conn, true);
+
+    table[i].handle(table[i].state, &request, &response.api);
+
+    /* Nothing written, the response is just the header */
+    if (!response.started) {
+        start_response(&response);
+    }
+
+    tune_cork(conn, false);
+    timer_cancel(&conn->timer);
+
+    return true;
+}
+
+/* Tear plugins down in reverse load order */
+void plugin_teardown(void) {
+    while (num_entries > 0) {
+        num_entries--;
+
+        if (handlers[num_entries]->teardown) {
+            handlers[num_entries]->teardown(table[num_entries].state);
+        }
+        dlclose(libraries[num_entries]);
+    }
+
+    return;
+}
@@ -0,0 +1,36 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: plugin.h
+ * Purpose: plugin header file. Defines loading of handler plugins and -
+            the dispatch table requests are checked against
+ */
+
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include <stdbool.h>
+
+#include "conn.h"
+#include "http.h"
+#include "plugin_api.h"
+
+/* Most plugins loaded at once */
+#define MAX_PLUGINS 16
+
+/* Largest response header block a plugin can build */
+#define PLUGIN_HEADER_SIZE 4096
+
+/* Load every PATH[=ARG] plugin and build the dispatch table */
+/* Exits if one can't be loaded or refuses to start */
+void plugin_init(const char *const *specs, int count);
+
+/* Offer a request to each plugin in load order */
+/* Returns true if one matched and answered it, or the header never -
+   ended and it got a 400, the caller still closes the connection */
+bool plugin_dispatch(connection_t *conn, const http_request_t *parsed);
+
+/* Tear every plugin down, once no request can reach them */
+void plugin_teardown(void);
+
+#endif
@@ -0,0 +1,97 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: plugin_api.h
+ * Purpose: plugin ABI header file. The only header a handler plugin -
+            includes. Plugins are shared objects exporting a -
+            plugin_handler_t named plugin_handler, and reach the server -
+            only through the pointers handed to them here
+ */
+
+#ifndef PLUGIN_API_H
+#define PLUGIN_API_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Bumped whenever anything below changes layout or meaning */
+#define PLUGIN_ABI_VERSION 1
+
+/* Symbol every plugin exports */
+#define PLUGIN_SYMBOL "plugin_handler"
+
+/* Bytes inside the server's request buffer, not NUL terminated */
+typedef struct {
+    const char *data;
+    size_t length;
+} plugin_slice_t;
+
+/* Request as it arrived, every slice but the normalized path points -
+   into the connection buffer, all are only valid during match and handle */
+typedef struct plugin_request plugin_request_t;
+struct plugin_request {
+    plugin_slice_t method;
+    plugin_slice_t uri;
+    plugin_slice_t path;
+    plugin_slice_t query;
+    plugin_slice_t version;
+
+    /* Header lines after the request line, and whatever of the body -
+       came in with them */
+    plugin_slice_t headers;
+    plugin_slice_t body;
+
+    /* Client address, empty for unix socket clients */
+    const char *peer;
+
+    /* Find a header by name, case insensitively */
+    bool (*header)(const plugin_request_t *request, const char *name,
+                   plugin_slice_t *value);
+
+    /* Server's own, plugins leave it alone */
+    const void *host;
+};
+
+/* Response writer, the status and headers go out with the first write */
+/* Responses end when handle returns, the connection is then closed, so -
+   Content-Length is optional */
+typedef struct plugin_response plugin_response_t;
+struct plugin_response {
+    /* 200 OK unless set, only before the first write */
+    void (*status)(plugin_response_t *response, int code, const char *reason);
+
+    /* Add a header, only before the first write */
+    /* Returns false if the header block is full */
+    bool (*header)(plugin_response_t *response, const char *name,
+                   const char *value);
+
+    /* Write body bytes, returns false once the client is gone */
+    bool (*write)(plugin_response_t *response, const void *data,
+                  size_t length);
+
+    /* Server's own, plugins leave it alone */
+    void *host;
+};
+
+/* What a plugin exports as plugin_handler */
+/* match and handle run on worker threads, concurrently */
+typedef struct {
+    int abi_version;
+    const char *name;
+
+    /* Called once at startup with the text after = in --plugin, or NULL */
+    /* Returns the state passed to the others, NULL refuses to load */
+    void *(*init)(const char *argument);
+
+    /* Checks if the plugin takes a request, keep it cheap */
+    bool (*match)(void *state, const plugin_request_t *request);
+
+    /* Answer a request the plugin matched */
+    void (*handle)(void *state, const plugin_request_t *request,
+                   plugin_response_t *response);
+
+    /* Called once at shutdown, after every request is done */
+    void (*teardown)(void *state);
+} plugin_handler_t;
+
+#endif
@@ -0,0 +1,96 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: plugin_status.c
+ * Purpose: example handler plugin. Answers GET on one path, /status -
+            unless another is given with --plugin=plugin_status.so=/PATH, -
+            with a small JSON document. Built with make plugin_status.so
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#include "plugin_api.h"
+
+/* Everything the plugin keeps between requests */
+typedef struct {
+    char *path;
+    size_t path_length;
+    time_t started;
+    _Atomic unsigned long served;
+} status_state_t;
+
+/* Checks if a slice holds exactly text */
+static bool slice_is(plugin_slice_t slice, const char *text, size_t length) {
+    return slice.length == length && memcmp(slice.data, text, length) == 0;
+}
+
+/* Set up the plugin */
+static void *status_init(const char *argument) {
+    status_state_t *state = calloc(1, sizeof *state);
+
+    if (!state) {
+        return NULL;
+    }
+
+    state->path = strdup(argument && *argument == '/' ? argument : "/status");
+    if (!state->path) {
+        free(state);
+        return NULL;
+    }
+    state->path_length = strlen(state->path);
+    state->started = time(NULL);
+
+    return state;
+}
+
+/* Take GET on the configured path */
+static bool status_match(void *state, const plugin_request_t *request) {
+    status_state_t *status = state;
+
+    return slice_is(request->method, "GET", 3) &&
+           slice_is(request->path, status->path, status->path_length);
+}
+
+/* Answer with uptime and how many times it was asked */
+static void status_handle(void *state, const plugin_request_t *request,
+                          plugin_response_t *response) {
+    status_state_t *status = state;
+    char body[256];
+    int length;
+
+    length = snprintf(body, sizeof body,
+                      "{\"uptime\": %ld, \"served\": %lu, "
+                      "\"client\": \"%s\"}\n",
+                      (long)(time(NULL) - status->started),
+                      atomic_fetch_add(&status->served, 1) + 1, request->peer);
+    if (length < 0 || (size_t)length >= sizeof body) {
+        response->status(response, 500, "Internal Server Error");
+        return;
+    }
+
+    response->header(response, "Content-Type", "application/json");
+    response->header(response, "Cache-Control", "no-store");
+    response->write(response, body, (size_t)length);
+}
+
+/* Free the plugin's state */
+static void status_teardown(void *state) {
+    status_state_t *status = state;
+
+    free(status->path);
+    free(status);
+}
+
+/* What the server looks up */
+const plugin_handler_t plugin_handler = {
+    .abi_version = PLUGIN_ABI_VERSION,
+    .name = "status",
+    .init = status_init,
+    .match = status_match,
+    .handle = status_handle,
+    .teardown = status_teardown
+};
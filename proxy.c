@@ -0,0 +1,707 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: proxy.c
+ * Purpose: proxy module. Forwards requests under a URI prefix to an -
+            upstream over HTTP/1.1 and streams the response back to the -
+            client as HTTP/1.0, closed when it's done. Each worker keeps -
+            its own idle upstream connections per route, so no locks are -
+            taken, and bodies are spliced between sockets wherever their -
+            length is known
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "proxy.h"
+#include "config.h"
+#include "listener.h"
+#include "sender.h"
+#include "stats.h"
+#include "timer.h"
+#include "tune.h"
+#include "io.h"
+
+struct proxy_route {
+    char *prefix;
+    size_t prefix_length;
+
+    /* Upstream, and the Host header for clients that didn't send one */
+    struct sockaddr_storage addr;
+    socklen_t addr_length;
+    const char *host;
+};
+
+/* Upstream connection with what has been read from it but not used */
+typedef struct {
+    int fd;
+    bool reused;
+    bool received;
+
+    char buffer[PROXY_BUFFER_SIZE];
+    size_t start;
+    size_t end;
+} upstream_t;
+
+/* How one attempt at a request went */
+typedef enum {
+    /* Response went out in full */
+    ATTEMPT_DONE,
+
+    /* Nothing reached the client, it can have a 502 */
+    ATTEMPT_FAILED,
+
+    /* Pooled connection was dead before answering, safe to try again */
+    ATTEMPT_STALE,
+
+    /* Failed part way through the response, the client just gets cut off */
+    ATTEMPT_ABORTED
+} attempt_t;
+
+/* Client and upstream of an attempt, for the deadline to shut down */
+typedef struct {
+    connection_t *conn;
+    int upstream;
+} exchange_t;
+
+/* Headers that only mean something for one hop, never forwarded */
+static const char *const hop_headers[] = {
+    "Connection",
+    "Keep-Alive",
+    "Proxy-Connection",
+    "TE",
+    "Trailer",
+    "Transfer-Encoding",
+    "Upgrade",
+    "Expect"
+};
+
+static proxy_route_t routes[MAX_PROXY_ROUTES];
+static int num_routes = 0;
+
+/* Each worker's idle upstream connections, closed when the thread exits */
+static __thread int idle[MAX_PROXY_ROUTES][PROXY_POOL_SIZE];
+static __thread size_t num_idle[MAX_PROXY_ROUTES];
+static pthread_key_t pool_key;
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+
+/* Parse the routes */
+void proxy_init(const char *const *specs, int count) {
+    const char *equals = NULL;
+    proxy_route_t *route = NULL;
+
+    for (int i = 0; i < count; i++) {
+        route = &routes[num_routes++];
+
+        equals = strchr(specs[i], '=');
+        if (!equals || specs[i][0] != '/') {
+            fprintf(stderr, "Error: cannot parse proxy route %s, expected "
+                            "/PREFIX=ADDR\n", specs[i]);
+            exit(EXIT_FAILURE);
+        }
+
+        route->prefix_length = (size_t)(equals - specs[i]);
+        route->prefix = strndup(specs[i], route->prefix_length);
+        if (!route->prefix) {
+            perror("Error: strndup() failed to copy proxy prefix");
+            exit(EXIT_FAILURE);
+        }
+
+        route->addr_length = listener_parse(equals + 1, &route->addr);
+        route->host = route->addr.ss_family == AF_UNIX ? "localhost"
+                                                       : equals + 1;
+    }
+
+    return;
+}
+
+/* Find a route */
+const proxy_route_t *proxy_match(const char *uri) {
+    const proxy_route_t *best = NULL;
+
+    for (int i = 0; i < num_routes; i++) {
+        if (path_has_prefix(uri, routes[i].prefix, routes[i].prefix_length) &&
+            (!best || routes[i].prefix_length > best->prefix_length)) {
+            best = &routes[i];
+        }
+    }
+
+    return best;
+}
+
+/* Close an exiting thread's idle connections */
+static void close_idle(void *arg) {
+    (void)arg;
+
+    for (int i = 0; i < num_routes; i++) {
+        while (num_idle[i] > 0) {
+            close(idle[i][--num_idle[i]]);
+        }
+    }
+}
+
+/* Key whose destructor closes the pool of an exiting thread */
+static void create_pool_key(void) {
+    pthread_key_create(&pool_key, close_idle);
+}
+
+/* Checks a pooled connection wasn't closed by the upstream while idle */
+/* Anything readable is either end of file or a response nobody asked for */
+static bool upstream_alive(int fd) {
+    char byte;
+
+    return recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == ERROR &&
+           (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/* Open a new upstream connection */
+/* Returns ERROR if it couldn't be reached within the write timeout */
+static int connect_upstream(const proxy_route_t *route) {
+    struct pollfd ready;
+    int fd, error = 0, nodelay = 1;
+    socklen_t length = sizeof error;
+
+    fd = socket(route->addr.ss_family,
+                SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == ERROR) {
+        perror("Error: cannot open upstream socket");
+        return ERROR;
+    }
+
+    if (connect(fd, (const struct sockaddr *)&route->addr,
+                route->addr_length) == ERROR) {
+        if (errno != EINPROGRESS) {
+            perror("Error: cannot connect to upstream");
+            close(fd);
+            return ERROR;
+        }
+
+        /* Deadline timer can't interrupt a connect, poll has its own */
+        ready.fd = fd;
+        ready.events = POLLOUT;
+        if (poll(&ready, 1, config.write_timeout) != 1 ||
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) ==
+                ERROR ||
+            error != 0) {
+            fprintf(stderr, "Error: cannot connect to upstream: %s\n",
+                    strerror(error ? error : ETIMEDOUT));
+            close(fd);
+            return ERROR;
+        }
+    }
+
+    /* Requests are written whole, don't hold back their last segment */
+    if (route->addr.ss_family != AF_UNIX) {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof nodelay);
+    }
+
+    STAT_INC(proxy_connects);
+
+    return fd;
+}
+
+/* Take an idle connection for a route, or open a new one */
+static bool take_upstream(const proxy_route_t *route, upstream_t *upstream,
+                          bool pooled) {
+    size_t index = (size_t)(route - routes);
+
+    upstream->start = 0;
+    upstream->end = 0;
+    upstream->received = false;
+
+    while (pooled && num_idle[index] > 0) {
+        upstream->fd = idle[index][--num_idle[index]];
+        if (upstream_alive(upstream->fd)) {
+            upstream->reused = true;
+            STAT_INC(proxy_reused);
+            return true;
+        }
+        close(upstream->fd);
+    }
+
+    upstream->reused = false;
+    upstream->fd = connect_upstream(route);
+
+    return upstream->fd != ERROR;
+}
+
+/* Give a connection back to this worker's pool, closing it if full */
+static void release_upstream(const proxy_route_t *route, int fd) {
+    size_t index = (size_t)(route - routes);
+    if (num_idle[index] == PROXY_POOL_SIZE) {
+        close(fd);
+        return;
+    }
+
+    pthread_once(&pool_key_once, create_pool_key);
+    pthread_setspecific(pool_key, idle);
+
+    idle[index][num_idle[index]++] = fd;
+}
+
+/* Deadline passed, fail both sides of the exchange */
+static void exchange_expired(void *arg) {
+    exchange_t *exchange = arg;
+
+    shutdown(exchange->conn->fd, SHUT_RDWR);
+    shutdown(exchange->upstream, SHUT_RDWR);
+}
+
+/* Read more from the upstream, moving what's left to the front */
+/* Returns false at end of file, on error or if the buffer is full */
+static bool fill(upstream_t *upstream) {
+    ssize_t bytes;
+
+    if (upstream->start > 0) {
+        memmove(upstream->buffer, upstream->buffer + upstream->start,
+                upstream->end - upstream->start);
+        upstream->end -= upstream->start;
+        upstream->start = 0;
+    }
+
+    if (upstream->end == sizeof upstream->buffer) {
+        return false;
+    }
+
+    while (true) {
+        bytes = read(upstream->fd, upstream->buffer + upstream->end,
+                     sizeof upstream->buffer - upstream->end);
+        if (bytes > 0) {
+            upstream->end += (size_t)bytes;
+            upstream->received = true;
+            return true;
+        }
+
+        if (bytes == 0) {
+            return false;
+        }
+
+        if (errno == EINTR ||
+            (errno == EAGAIN && io_wait(upstream->fd, POLLIN))) {
+            continue;
+        }
+
+        return false;
+    }
+}
+
+/* Read one line, without its line ending */
+/* Returns NULL if no whole line came. The line is only good until the -
+   next read */
+static char *read_line(upstream_t *upstream, size_t *length) {
+    char *line = NULL, *newline = NULL;
+
+    while (!(newline = memchr(upstream->buffer + upstream->start, '\n',
+                              upstream->end - upstream->start))) {
+        if (!fill(upstream)) {
+            return NULL;
+        }
+    }
+
+    line = upstream->buffer + upstream->start;
+    *length = (size_t)(newline - line);
+    if (*length > 0 && line[*length - 1] == '\r') {
+        (*length)--;
+    }
+
+    upstream->start = (size_t)(newline + 1 - upstream->buffer);
+
+    return line;
+}
+
+/* Send length body bytes to the client, buffered ones first, then -
+   spliced straight from the upstream socket */
+static bool move_body(upstream_t *upstream, int client, size_t length) {
+    size_t buffered = upstream->end - upstream->start;
+
+    if (buffered > length) {
+        buffered = length;
+    }
+
+    if (buffered > 0 &&
+        !io_write_all(client, upstream->buffer + upstream->start, buffered)) {
+        return false;
+    }
+    upstream->start += buffered;
+    length -= buffered;
+
+    return length == 0 ||
+           splice_to_socket(client, upstream->fd, NULL, length) == length;
+}
+
+/* Append to a header block, false if it doesn't fit */
+static bool append(char *out, size_t space, size_t *length, const char *data,
+                   size_t bytes) {
+    if (*length + bytes > space) {
+        return false;
+    }
+
+    memcpy(out + *length, data, bytes);
+    *length += bytes;
+
+    return true;
+}
+
+/* Checks if a header line is named name */
+static bool header_is(const char *line, size_t length, const char *name) {
+    size_t name_length = strlen(name);
+
+    return length > name_length && line[name_length] == ':' &&
+           strncasecmp(line, name, name_length) == 0;
+}
+
+/* Checks if a header line only applies to one hop */
+static bool is_hop_header(const char *line, size_t length) {
+    for (size_t i = 0; i < ARRAY_LENGTH(hop_headers); i++) {
+        if (header_is(line, length, hop_headers[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Build the upstream request from the client's header */
+/* Returns its length, 0 if it didn't fit */
+static size_t build_request(char *out, size_t space, const connection_t *conn,
+                            const http_request_t *request,
+                            const proxy_route_t *route, const char *end) {
+    char peer[INET6_ADDRSTRLEN];
+    const char *line = NULL, *newline = NULL, *forwarded = NULL;
+    size_t length = 0, line_length, forwarded_length = 0;
+    bool has_host = false, ok = true;
+    int written;
+
+    written = snprintf(out, space, "%s ", request->method);
+    if (written < 0 || (size_t)written >= space) {
+        return 0;
+    }
+    length = (size_t)written;
+
+    /* Canonical path the route matched, with the query as it was sent */
+    if (!encode_uri(out + length, space - length, request->URI,
+                    request->query, request->query_length)) {
+        return 0;
+    }
+    length += strlen(out + length);
+    ok = append(out, space, &length, " HTTP/1.1\r\n", 11);
+
+    /* Copy end to end headers, the request line is already done. The -
+       blank line before end means the request line ends in a newline */
+    line = strchr(conn->buffer, '\n') + 1;
+    while (line < end && (newline = memchr(line, '\n', (size_t)(end - line)))) {
+        line_length = (size_t)(newline - line);
+        if (line_length > 0 && line[line_length - 1] == '\r') {
+            line_length--;
+        }
+
+        /* Blank line ending the header */
+        if (line_length == 0) {
+            break;
+        }
+
+        if (header_is(line, line_length, "X-Forwarded-For")) {
+            /* Added to below, after any earlier proxies */
+            forwarded = line;
+            forwarded_length = line_length;
+        } else if (!is_hop_header(line, line_length)) {
+            has_host = has_host || header_is(line, line_length, "Host");
+            ok = ok && append(out, space, &length, line, line_length) &&
+                 append(out, space, &length, "\r\n", 2);
+        }
+
+        line = newline + 1;
+    }
+
+    if (!has_host) {
+        ok = ok && append(out, space, &length, "Host: ", 6) &&
+             append(out, space, &length, route->host, strlen(route->host)) &&
+             append(out, space, &length, "\r\n", 2);
+    }
+
+    if (conn_peer_address(conn, peer, sizeof peer)) {
+        if (forwarded) {
+            ok = ok && append(out, space, &length, forwarded,
+                              forwarded_length) &&
+                 append(out, space, &length, ", ", 2);
+        } else {
+            ok = ok && append(out, space, &length, "X-Forwarded-For: ", 17);
+        }
+        ok = ok && append(out, space, &length, peer, strlen(peer)) &&
+             append(out, space, &length, "\r\n", 2);
+    }
+
+    ok = ok && append(out, space, &length, "\r\n", 2);
+
+    return ok ? length : 0;
+}
+
+/* Read the response header and pass it on as HTTP/1.0 */
+/* Returns ATTEMPT_DONE with the framing of the body filled in once the -
+   header has gone out */
+static attempt_t forward_header(upstream_t *upstream, int client,
+                                bool *has_body, bool *chunked,
+                                long long *content_length, bool *keep_alive,
+                                bool head) {
+    char out[PROXY_BUFFER_SIZE + 64];
+    char *line = NULL;
+    size_t length, out_length, length_at = 0, length_size = 0;
+    int status;
+
+    /* Interim responses are dropped, clients here never asked for them */
+    do {
+        line = read_line(upstream, &length);
+        if (!line) {
+            return upstream->reused && !upstream->received ? ATTEMPT_STALE
+                                                           : ATTEMPT_FAILED;
+        }
+
+        if (length < 12 || strncmp(line, "HTTP/1.", 7) != 0 ||
+            line[8] != ' ') {
+            return ATTEMPT_FAILED;
+        }
+        status = atoi(line + 9);
+
+        /* Switching protocols was never asked for either */
+        if (status == 101 || status < 100) {
+            return ATTEMPT_FAILED;
+        }
+
+        *keep_alive = line[7] == '1';
+
+        /* Status line, with our own version */
+        out_length = 0;
+        append(out, sizeof out, &out_length, "HTTP/1.0", 8);
+        append(out, sizeof out, &out_length, line + 8, length - 8);
+        append(out, sizeof out, &out_length, "\r\n", 2);
+
+        *chunked = false;
+        *content_length = ERROR;
+
+        while ((line = read_line(upstream, &length)) && length > 0) {
+            if (header_is(line, length, "Connection") &&
+                header_has_token(line + 11, length - 11, "close")) {
+                *keep_alive = false;
+            } else if (header_is(line, length, "Transfer-Encoding")) {
+                *chunked = header_has_token(line + 18, length - 18,
+                                            "chunked");
+            } else if (header_is(line, length, "Content-Length")) {
+                *content_length = strtoll(line + 15, NULL, 10);
+                length_at = out_length;
+                length_size = length + 2;
+            }
+
+            if (!is_hop_header(line, length) &&
+                (!append(out, sizeof out, &out_length, line, length) ||
+                 !append(out, sizeof out, &out_length, "\r\n", 2))) {
+                return ATTEMPT_FAILED;
+            }
+        }
+
+        if (!line) {
+            return ATTEMPT_FAILED;
+        }
+    } while (status < 200);
+
+    if (!append(out, sizeof out, &out_length, "\r\n", 2)) {
+        return ATTEMPT_FAILED;
+    }
+
+    /* Chunks decide where the body ends, a length alongside them can't -
+       be trusted and neither can the connection afterwards */
+    if (*chunked && *content_length != ERROR) {
+        memmove(out + length_at, out + length_at + length_size,
+                out_length - length_at - length_size);
+        out_length -= length_size;
+        *keep_alive = false;
+    }
+
+    *has_body = !head && status != 204 && status != 304;
+
+    return io_write_all(client, out, out_length) ? ATTEMPT_DONE
+                                                 : ATTEMPT_ABORTED;
+}
+
+/* Undo chunked encoding, the client reads to the close instead */
+static bool forward_chunked(upstream_t *upstream, int client) {
+    unsigned long long size;
+    char *line = NULL, *end = NULL;
+    size_t length;
+
+    while (true) {
+        line = read_line(upstream, &length);
+        if (!line || length == 0) {
+            return false;
+        }
+
+        /* Chunk extensions after the size are ignored */
+        size = strtoull(line, &end, 16);
+        if (end == line) {
+            return false;
+        }
+
+        if (size == 0) {
+            break;
+        }
+
+        if (!move_body(upstream, client, (size_t)size)) {
+            return false;
+        }
+
+        /* Every chunk ends with its own line ending */
+        line = read_line(upstream, &length);
+        if (!line || length != 0) {
+            return false;
+        }
+    }
+
+    /* Trailers aren't passed on, a HTTP/1.0 client can't take them */
+    while ((line = read_line(upstream, &length)) && length > 0) {
+    }
+
+    return line != NULL;
+}
+
+/* Make one attempt at a request over one upstream connection */
+static attempt_t attempt(connection_t *conn, upstream_t *upstream,
+                         const char *out, size_t out_length, const char *body,
+                         size_t body_length, bool head, bool *reusable) {
+    size_t buffered = conn->length - (size_t)(body - conn->buffer);
+    long long content_length;
+    bool has_body, chunked, keep_alive, ok;
+    attempt_t result;
+
+    *reusable = false;
+
+    /* Request, whatever of the body came with the header, then the rest -
+       straight from the client socket */
+    if (buffered > body_length) {
+        buffered = body_length;
+    }
+
+    if (!io_write_all(upstream->fd, out, out_length) ||
+        (buffered > 0 && !io_write_all(upstream->fd, body, buffered)) ||
+        (body_length > buffered &&
+         splice_to_socket(upstream->fd, conn->fd, NULL,
+                          body_length - buffered) != body_length - buffered)) {
+        return upstream->reused && body_length == 0 ? ATTEMPT_STALE
+                                                    : ATTEMPT_FAILED;
+    }
+
+    result = forward_header(upstream, conn->fd, &has_body, &chunked,
+                            &content_length, &keep_alive, head);
+    if (result == ATTEMPT_STALE && body_length > 0) {
+        /* Body is gone, it can't be sent again */
+        return ATTEMPT_FAILED;
+    }
+    if (result != ATTEMPT_DONE) {
+        return result;
+    }
+
+    if (!has_body) {
+        ok = true;
+    } else if (chunked) {
+        ok = forward_chunked(upstream, conn->fd);
+    } else if (content_length >= 0) {
+        ok = move_body(upstream, conn->fd, (size_t)content_length);
+    } else {
+        /* Body runs to the close, nothing left to reuse afterwards */
+        move_body(upstream, conn->fd, upstream->end - upstream->start);
+        while (splice_to_socket(conn->fd, upstream->fd, NULL,
+                                SPLICE_PIPE_SIZE) == SPLICE_PIPE_SIZE) {
+        }
+        keep_alive = false;
+        ok = true;
+    }
+
+    /* Anything more than asked for means the connection is out of step */
+    *reusable = ok && keep_alive && upstream->start == upstream->end;
+
+    return ok ? ATTEMPT_DONE : ATTEMPT_ABORTED;
+}
+
+/* Forward a request */
+void proxy_forward(connection_t *conn, const http_request_t *request,
+                   const proxy_route_t *route) {
+    char out[CONN_BUFFER_SIZE + 256];
+    upstream_t upstream;
+    exchange_t exchange = { .conn = conn };
+    const char *body = NULL, *value = NULL;
+    size_t out_length, value_length, body_length = 0;
+    bool reusable, head = strcmp(request->method, "HEAD") == 0;
+    attempt_t result = ATTEMPT_STALE;
+
+    STAT_INC(proxy_requests);
+
+    /* Body starts after the blank line, a client that stopped sending -
+       before it never finished the header */
+    body = conn_body(conn);
+    if (!body) {
+        send_response(conn->fd, RESPONSE_BAD_REQUEST);
+        return;
+    }
+
+    /* Request bodies need a length, there's no chunked upload support */
+    if (request_header(request, HEADER_TRANSFER_ENCODING, &value_length)) {
+        send_response(conn->fd, RESPONSE_NOT_IMPLEMENTED);
+        return;
+    }
+
+    value = request_header(request, HEADER_CONTENT_LENGTH, &value_length);
+    if (value && !parse_content_length(value, value_length, &body_length)) {
+        send_response(conn->fd, RESPONSE_BAD_REQUEST);
+        return;
+    }
+
+    out_length = build_request(out, sizeof out, conn, request, route, body);
+    if (out_length == 0) {
+        send_response(conn->fd, RESPONSE_TOO_LARGE);
+        return;
+    }
+
+    /* A dead pooled connection gets one retry on a fresh one */
+    for (int tries = 0; tries < 2 && result == ATTEMPT_STALE; tries++) {
+        if (!take_upstream(route, &upstream, tries == 0)) {
+            result = ATTEMPT_FAILED;
+            break;
+        }
+
+        /* Whole exchange has to finish before the write deadline */
+        exchange.upstream = upstream.fd;
+        timer_add(&conn->timer, config.write_timeout, exchange_expired,
+                  &exchange);
+        tune_cork(conn, true);
+
+        result = attempt(conn, &upstream, out, out_length, body, body_length,
+                         head, &reusable);
+
+        tune_cork(conn, false);
+
+        /* Deadline shut it down, never reuse it */
+        if (!timer_cancel(&conn->timer)) {
+            reusable = false;
+        }
+
+        if (reusable) {
+            release_upstream(route, upstream.fd);
+        } else {
+            close(upstream.fd);
+        }
+    }
+
+    if (result == ATTEMPT_FAILED || result == ATTEMPT_STALE) {
+        STAT_INC(proxy_errors);
+        send_response(conn->fd, RESPONSE_BAD_GATEWAY);
+    }
+
+    return;
+}
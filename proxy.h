@@ -0,0 +1,40 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: proxy.h
+ * Purpose: proxy header file. Defines routes from URI prefixes to -
+            upstream HTTP servers, reached over pooled connections
+ */
+
+#ifndef PROXY_H
+#define PROXY_H
+
+#include "conn.h"
+#include "http.h"
+
+/* Most prefixes routed upstream */
+#define MAX_PROXY_ROUTES 16
+
+/* Idle upstream connections each worker keeps per route */
+#define PROXY_POOL_SIZE 8
+
+/* Upstream bytes buffered while reading header and chunk lines */
+#define PROXY_BUFFER_SIZE 8192
+
+/* A prefix and where it goes */
+typedef struct proxy_route proxy_route_t;
+
+/* Parse PREFIX=ADDR routes, exits on a malformed one */
+void proxy_init(const char *const *routes, int count);
+
+/* Find the route with the longest prefix of a normalized path */
+/* Returns NULL if the URI is served from the webroot */
+const proxy_route_t *proxy_match(const char *uri);
+
+/* Forward a request upstream and stream the response back */
+/* Answers 502 if the upstream can't be reached or misbehaves before -
+   the response starts. The caller still closes the connection */
+void proxy_forward(connection_t *conn, const http_request_t *request,
+                   const proxy_route_t *route);
+
+#endif
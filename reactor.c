@@ -0,0 +1,322 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: reactor.c
+ * Purpose: reactor module. Parks accepted clients in epoll and reads their -
+            request header as it trickles in, expires the ones that never -
+            finish, and runs the timer wheel for everyone else. Also drives -
+            the once a second ticker
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "reactor.h"
+#include "list.h"
+#include "timer.h"
+#include "ticker.h"
+#include "config.h"
+#include "http.h"
+#include "h2.h"
+
+static struct {
+    thread_pool *pool;
+    pthread_t thread;
+    int epoll_fd;
+    volatile bool stopping;
+
+    /* Clients currently parked, so a drain knows when they are all gone */
+    atomic_size_t parked;
+
+    /* Ready clients waiting for queue room under the block policy, -
+       still counted as parked */
+    List *held;
+
+    /* Held while a client is parked and while events are handled, so -
+       no event finds a client whose deadline isn't armed yet */
+    pthread_mutex_t parking;
+
+    /* Once a second tick, re-armed by the loop since callbacks can't -
+       touch the wheel */
+    timer_entry_t tick;
+    bool tick_due;
+} reactor;
+
+/* A second has passed, the loop refreshes the ticker */
+static void second_elapsed(void *arg) {
+    (void)arg;
+    reactor.tick_due = true;
+}
+
+/* Header deadline expired while parked */
+/* Runs under the wheel lock, so keep it short */
+static void parked_expired(void *arg) {
+    connection_t *conn = arg;
+
+    /* Best effort 408, never blocks the reactor on a slow client. A -
+       client yet to handshake wouldn't understand it, HTTP/2 gets GOAWAY */
+    if (conn->h2) {
+        h2_abandon(conn);
+    } else if (!conn->handshake_pending) {
+        send_response(conn->fd, RESPONSE_TIMEOUT);
+    }
+
+    /* Closing also drops it from the epoll set */
+    conn_close(conn);
+
+    atomic_fetch_sub(&reactor.parked, 1);
+}
+
+/* Client became readable, buffer what it sent */
+/* Returns true once the header is in and it should go to a worker */
+static bool parked_ready(connection_t *conn) {
+    struct epoll_event event;
+
+    /* Deadline fires on this thread too, so it can't have won yet, but -
+       never touch a connection it has recycled. TLS clients handshake on -
+       a worker and HTTP/2 reads its own frames, readable is all they -
+       need to be */
+    switch (conn->handshake_pending || conn->h2 ? HEADER_DONE
+                                                : conn_read_header(conn)) {
+    case HEADER_PENDING:
+        /* Keep waiting for the rest, under the same deadline */
+        memset(&event, '\0', sizeof event);
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        event.data.ptr = conn;
+
+        if (epoll_ctl(reactor.epoll_fd, EPOLL_CTL_MOD, conn->fd,
+                      &event) == 0) {
+            return false;
+        }
+
+        perror("Error: epoll_ctl() failed to re-arm client");
+        break;
+    case HEADER_DONE:
+        if (!timer_cancel(&conn->timer)) {
+            return false;
+        }
+
+        epoll_ctl(reactor.epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+        return true;
+    case HEADER_CLOSED:
+        break;
+    }
+
+    /* Client went away or can't be watched */
+    if (timer_cancel(&conn->timer)) {
+        conn_close(conn);
+        atomic_fetch_sub(&reactor.parked, 1);
+    }
+
+    return false;
+}
+
+/* Queue ready clients, oldest held first */
+/* Under the block policy what doesn't fit is held until there is room, -
+   like the acceptor leaves clients in the backlog */
+static void hand_over(connection_t **conns, size_t count) {
+    connection_t *waiting[POOL_MAX_BATCH];
+    size_t num_waiting, taken;
+
+    if (config.queue_policy != QUEUE_BLOCK) {
+        add_clients_work(reactor.pool, conns, count);
+        atomic_fetch_sub(&reactor.parked, count);
+        return;
+    }
+
+    while (!list_is_empty(reactor.held)) {
+        num_waiting = 0;
+        while (num_waiting < POOL_MAX_BATCH &&
+               !list_is_empty(reactor.held)) {
+            waiting[num_waiting++] = list_remove_start(reactor.held);
+        }
+
+        taken = add_clients_fitting(reactor.pool, waiting, num_waiting);
+        atomic_fetch_sub(&reactor.parked, taken);
+
+        /* Still full, put the rest back in front in their order */
+        if (taken < num_waiting) {
+            while (num_waiting > taken) {
+                list_add_start(reactor.held, waiting[--num_waiting]);
+            }
+            break;
+        }
+    }
+
+    taken = list_is_empty(reactor.held)
+                ? add_clients_fitting(reactor.pool, conns, count)
+                : 0;
+    atomic_fetch_sub(&reactor.parked, taken);
+
+    for (size_t i = taken; i < count; i++) {
+        list_add_end(reactor.held, conns[i]);
+    }
+
+    return;
+}
+
+/* Reactor thread */
+/* Waits for parked clients, waking up at least once per timer tick, or -
+   sooner while clients are held for queue room */
+static void *reactor_loop(void *args) {
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    connection_t *conns[REACTOR_MAX_EVENTS];
+    size_t count;
+    int ready, timeout;
+
+    (void)args;
+
+    while (!reactor.stopping) {
+        timeout = timer_next_timeout();
+        if (!list_is_empty(reactor.held) && timeout > REACTOR_HOLD_MS) {
+            timeout = REACTOR_HOLD_MS;
+        }
+
+        ready = epoll_wait(reactor.epoll_fd, events, REACTOR_MAX_EVENTS,
+                           timeout);
+        if (ready == ERROR && errno != EINTR) {
+            perror("Error: epoll_wait() failed");
+            exit(EXIT_FAILURE);
+        }
+
+        /* Every complete header goes to the pool in one batch */
+        count = 0;
+        pthread_mutex_lock(&reactor.parking);
+        for (int i = 0; i < ready; i++) {
+            if (parked_ready(events[i].data.ptr)) {
+                conns[count++] = events[i].data.ptr;
+            }
+        }
+        pthread_mutex_unlock(&reactor.parking);
+
+        /* Only stop counting them as parked once they are queued, so a -
+           drain never sees them in neither place */
+        if (count > 0 || !list_is_empty(reactor.held)) {
+            hand_over(conns, count);
+        }
+
+        /* Fire deadlines, both for parked clients and for workers */
+        timer_advance();
+
+        if (reactor.tick_due) {
+            reactor.tick_due = false;
+            timer_add(&reactor.tick, ticker_update(), second_elapsed, NULL);
+        }
+    }
+
+    pthread_exit(NULL);
+}
+
+/* Start the reactor */
+void reactor_init(thread_pool *pool) {
+    sigset_t all, old;
+
+    reactor.pool = pool;
+    reactor.stopping = false;
+    reactor.held = list_new();
+    pthread_mutex_init(&reactor.parking, NULL);
+
+    timer_init();
+
+    /* Keep the Date header and coarse clock ticking */
+    reactor.tick_due = false;
+    timer_add(&reactor.tick, ticker_update(), second_elapsed, NULL);
+
+    reactor.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor.epoll_fd == ERROR) {
+        perror("Error: epoll_create1() failed");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Signals are meant for the acceptor, keep them off this thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    if (pthread_create(&reactor.thread, NULL, reactor_loop, NULL)) {
+        perror("Error: cannot create reactor thread");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    return;
+}
+
+/* Park a client until it is readable, or header_timeout after since */
+static void park(connection_t *conn, uint64_t since) {
+    struct epoll_event event;
+    int remaining;
+
+    atomic_fetch_add(&reactor.parked, 1);
+
+    /* One shot, re-armed after each partial read and gone as soon as it -
+       is handed to a worker */
+    memset(&event, '\0', sizeof event);
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.ptr = conn;
+
+    pthread_mutex_lock(&reactor.parking);
+
+    if (epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, conn->fd,
+                  &event) == ERROR) {
+        pthread_mutex_unlock(&reactor.parking);
+        perror("Error: epoll_ctl() failed to park client");
+        conn_close(conn);
+        atomic_fetch_sub(&reactor.parked, 1);
+        return;
+    }
+
+    /* Armed only once it is watched, so a deadline that fires at once -
+       can't recycle it before the add */
+    remaining = config.header_timeout - (int)(timer_now_ms() - since);
+    timer_add(&conn->timer, remaining > 0 ? remaining : 0, parked_expired,
+              conn);
+
+    pthread_mutex_unlock(&reactor.parking);
+
+    return;
+}
+
+/* Park a client until its header is in */
+void reactor_park(connection_t *conn) {
+    /* Header deadline runs from accept, however often it was parked */
+    park(conn, conn->accepted);
+
+    return;
+}
+
+/* Park an idle HTTP/2 connection */
+void reactor_park_session(connection_t *conn, uint64_t active_since) {
+    park(conn, active_since);
+
+    return;
+}
+
+/* Number of clients still parked */
+size_t reactor_parked(void) {
+    return atomic_load(&reactor.parked);
+}
+
+/* Stop the reactor thread */
+void reactor_stop(void) {
+    reactor.stopping = true;
+    pthread_join(reactor.thread, NULL);
+    close(reactor.epoll_fd);
+
+    /* Anything still held past the drain deadline is cut off */
+    while (!list_is_empty(reactor.held)) {
+        conn_close(list_remove_start(reactor.held));
+    }
+    list_free(reactor.held);
+
+    return;
+}
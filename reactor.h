@@ -0,0 +1,39 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: reactor.h
+ * Purpose: reactor header file. Defines the event loop that holds idle -
+            connections and drives the timer wheel
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "threadpool.h"
+
+/* Most events handled per epoll_wait() call */
+#define REACTOR_MAX_EVENTS 64
+
+/* How often clients held for queue room under the block policy retry */
+#define REACTOR_HOLD_MS 10
+
+/* Start the reactor thread, readable clients are handed to pool */
+void reactor_init(thread_pool *pool);
+
+/* Park a client until its whole request header has arrived */
+/* An idle or slow client costs a timer entry here instead of a worker -
+   thread */
+void reactor_park(connection_t *conn);
+
+/* Park an HTTP/2 connection with nothing to send until its next frame */
+/* It is closed once a header timeout passes since active_since, its -
+   last request or body progress */
+void reactor_park_session(connection_t *conn, uint64_t active_since);
+
+/* Number of clients still waiting to send their request */
+size_t reactor_parked(void);
+
+/* Stop the reactor thread */
+void reactor_stop(void);
+
+#endif
@@ -0,0 +1,26 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: scan.h
+ * Purpose: delimiter scanner header file. Defines the search for request -
+            delimiters, vectorised when the CPU allows it
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/* Most delimiters looked for at once, what one SSE4.2 compare takes */
+#define SCAN_MAX_SET 16
+
+/* Pick the fastest scanner this CPU supports, SSE4.2 before AVX2 */
+/* Until called, and on CPUs without SSE4.2, bytes are checked one by one */
+void scan_init(void);
+
+/* Find the first byte in [start, end) that is one of set */
+/* set is NUL terminated with at most SCAN_MAX_SET bytes, NUL itself -
+   can't be looked for. Returns end if there is none */
+const char *scan_find(const char *start, const char *end, const char *set);
+
+#endif
@@ -0,0 +1,190 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: scan_test.c
+ * Purpose: delimiter scanner test, built with make scan_test. Checks the -
+            AVX2 and SSE4.2 scanners against the byte at a time one on -
+            random buffers, then times parse_request() on header heavy -
+            requests with each scanner this CPU supports
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+/* Included whole, the scanners are static */
+#include "scan.c"
+#include "http.h"
+
+#define FUZZ_ROUNDS 200000
+#define FUZZ_MAX_LENGTH 100
+#define BENCH_ROUNDS 200000
+#define BENCH_HEADERS 32
+#define BENCH_REQUEST_SIZE 4096
+
+/* Every set parse_request() and get_header() look for, and a full one */
+static const char *const sets[] = {
+    "\n", ":\n", "\r\n", " ", "\r\n :\t/?#%&=;,.-_",
+};
+
+/* One scanner under test */
+typedef struct {
+    const char *name;
+    scanner_t find;
+    bool supported;
+    int failures;
+} candidate_t;
+
+/* Random byte, mostly the ones the sets look for */
+static char random_byte(void) {
+    static const char common[] = "\r\n: \tGET/Host";
+
+    if (rand() % 4 == 0) {
+        return (char)(rand() % 256);
+    }
+
+    return common[rand() % (int)(sizeof common - 1)];
+}
+
+/* Compare every scanner with find_scalar on random buffers */
+/* Mismatches are counted per scanner */
+static void fuzz(candidate_t *candidates, size_t count) {
+    const char *expected = NULL, *found = NULL, *set = NULL;
+    char *buffer = NULL;
+    size_t length, offset, set_length;
+
+    for (int round = 0; round < FUZZ_ROUNDS; round++) {
+        length = (size_t)(rand() % (FUZZ_MAX_LENGTH + 1));
+        offset = length > 0 ? (size_t)rand() % (length + 1) : 0;
+        set = sets[(size_t)round % ARRAY_LENGTH(sets)];
+        set_length = strlen(set);
+
+        /* Exactly sized, so a read past the end would land off the heap -
+           block instead of on a byte that happens to be there */
+        buffer = malloc(length > 0 ? length : 1);
+        if (!buffer) {
+            perror("Error: malloc() failed for fuzz buffer");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < length; i++) {
+            buffer[i] = random_byte();
+        }
+
+        expected = find_scalar(buffer + offset, buffer + length, set,
+                               set_length);
+
+        for (size_t i = 0; i < count; i++) {
+            if (!candidates[i].supported) {
+                continue;
+            }
+
+            found = candidates[i].find(buffer + offset, buffer + length, set,
+                                       set_length);
+            if (found != expected) {
+                fprintf(stderr, "FAIL: %s length %zu offset %zu set %zu "
+                                "found %td expected %td\n",
+                        candidates[i].name, length, offset,
+                        (size_t)round % ARRAY_LENGTH(sets),
+                        found - buffer, expected - buffer);
+                candidates[i].failures++;
+            }
+        }
+
+        free(buffer);
+    }
+
+    return;
+}
+
+/* Fill in a request with many headers, like a browser sends */
+static size_t build_request(char *request, size_t size) {
+    size_t length;
+
+    length = (size_t)snprintf(request, size,
+                              "GET /assets/app.js?v=123 HTTP/1.1\r\n"
+                              "Host: example.com\r\n"
+                              "User-Agent: Mozilla/5.0 (X11; Linux x86_64) "
+                              "AppleWebKit/537.36 (KHTML, like Gecko)\r\n"
+                              "Accept: */*\r\n"
+                              "Accept-Encoding: gzip, deflate, br\r\n"
+                              "Accept-Language: en-AU,en;q=0.9\r\n"
+                              "Connection: keep-alive\r\n"
+                              "If-None-Match: \"5b0a1f2c-1a2b\"\r\n"
+                              "If-Modified-Since: Sun, 27 May 2018 "
+                              "06:00:00 GMT\r\n");
+
+    for (int i = 0; i < BENCH_HEADERS; i++) {
+        length += (size_t)snprintf(request + length, size - length,
+                                   "X-Custom-Header-%02d: value-%d; "
+                                   "path=/; domain=example.com\r\n", i, i);
+    }
+    length += (size_t)snprintf(request + length, size - length, "\r\n");
+
+    return length;
+}
+
+/* Time parse_request() with one scanner */
+/* Returns nanoseconds per request */
+static double bench(const char *request, size_t length) {
+    http_request_t parsed;
+    struct timespec start, stop;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        if (!parse_request(&parsed, request, length) ||
+            !parsed.headers[HEADER_HOST]) {
+            fprintf(stderr, "FAIL: benchmark request didn't parse\n");
+            exit(EXIT_FAILURE);
+        }
+        free(parsed.method);
+        free(parsed.URI);
+        free(parsed.httpversion);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    return ((double)(stop.tv_sec - start.tv_sec) * 1e9 +
+            (double)(stop.tv_nsec - start.tv_nsec)) / BENCH_ROUNDS;
+}
+
+int main(void) {
+    candidate_t candidates[] = {
+        {"scalar", find_scalar, true, 0},
+        {"sse4.2", find_sse42, false, 0},
+        {"avx2", find_avx2, false, 0},
+    };
+    char request[BENCH_REQUEST_SIZE];
+    size_t length;
+    int failures = 0;
+
+    __builtin_cpu_init();
+    candidates[1].supported = __builtin_cpu_supports("sse4.2");
+    candidates[2].supported = __builtin_cpu_supports("avx2");
+
+    srand((unsigned)time(NULL));
+
+    fuzz(candidates, ARRAY_LENGTH(candidates));
+    for (size_t i = 1; i < ARRAY_LENGTH(candidates); i++) {
+        printf("%s: %s\n", candidates[i].name,
+               !candidates[i].supported   ? "SKIP, not supported"
+               : candidates[i].failures ? "FAIL"
+                                        : "PASS");
+        failures += candidates[i].failures;
+    }
+
+    init_headers();
+    length = build_request(request, sizeof request);
+
+    for (size_t i = 0; i < ARRAY_LENGTH(candidates); i++) {
+        if (candidates[i].supported) {
+            scanner = candidates[i].find;
+            printf("parse_request %s: %.0f ns, %zu byte header\n",
+                   candidates[i].name, bench(request, length), length);
+        }
+    }
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,259 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: sender.c
+ * Purpose: body sender module. Dispatches file bodies to one of read(), -
+            sendfile(), a shared mapping sent with writev(), or splice() -
+            through a per-thread pipe, picked once at startup
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+
+#include "sender.h"
+#include "mapcache.h"
+#include "http.h"
+#include "io.h"
+
+static void sendfile_file(int client, const char *uri, int file,
+                          const file_meta_t *meta);
+static void mmap_file(int client, const char *uri, int file,
+                      const file_meta_t *meta);
+static void splice_file(int client, const char *uri, int file,
+                        const file_meta_t *meta);
+
+/* Senders by mode */
+static const body_sender_t senders[NUM_SEND_MODES] = {
+    [SEND_READ] = read_write_file,
+    [SEND_SENDFILE] = sendfile_file,
+    [SEND_MMAP] = mmap_file,
+    [SEND_SPLICE] = splice_file
+};
+
+static body_sender_t sender = read_write_file;
+
+/* Each thread reuses one pipe, closed when the thread exits */
+static __thread int splice_pipe[2] = {ERROR, ERROR};
+static pthread_key_t pipe_key;
+static pthread_once_t pipe_key_once = PTHREAD_ONCE_INIT;
+
+/* Pick the sender */
+void sender_init(send_mode_t mode) {
+    sender = senders[mode];
+
+    return;
+}
+
+/* Send a file body */
+void send_file_body(int client, const char *uri, int file,
+                    const file_meta_t *meta) {
+    sender(client, uri, file, meta);
+
+    return;
+}
+
+/* Send the body with sendfile(), the kernel copies from the page cache */
+static void sendfile_file(int client, const char *uri, int file,
+                          const file_meta_t *meta) {
+    off_t offset = 0;
+    ssize_t sent;
+
+    (void)uri;
+
+    write_content_length(client, (size_t)meta->size);
+
+    /* Stops early at end of file if it shrank since the metadata was read */
+    while (offset < meta->size) {
+        sent = sendfile(client, file, &offset,
+                        (size_t)(meta->size - offset));
+        if (sent == ERROR && errno == EINTR) {
+            continue;
+        }
+
+        /* Socket buffer full */
+        if (sent == ERROR && errno == EAGAIN &&
+            io_wait(client, POLLOUT)) {
+            continue;
+        }
+
+        /* Filesystem can't sendfile() from this file, splice the rest */
+        if (sent == ERROR && (errno == EINVAL || errno == ENOSYS) &&
+            offset == 0) {
+            splice_to_socket(client, file, &offset, (size_t)meta->size);
+            break;
+        }
+
+        if (sent == ERROR) {
+            perror("Error: cannot write to socket");
+            break;
+        }
+
+        if (sent == 0) {
+            break;
+        }
+    }
+
+    return;
+}
+
+/* Send the body from a shared mapping */
+/* Content-Length and the body go out in the same writev() */
+static void mmap_file(int client, const char *uri, int file,
+                      const file_meta_t *meta) {
+    char length[64];
+    struct iovec iov[2];
+    mapping_t *mapping = NULL;
+
+    /* Empty files can't be mapped, there's nothing to send anyway */
+    if (meta->size == 0) {
+        write_content_length(client, 0);
+        return;
+    }
+
+    mapping = mapcache_get(uri, file, meta);
+    if (!mapping) {
+        read_write_file(client, uri, file, meta);
+        return;
+    }
+
+    iov[0].iov_base = length;
+    iov[0].iov_len = (size_t)snprintf(length, sizeof length,
+                                      "Content-Length: %zu\r\n\r\n",
+                                      mapping->length);
+    iov[1].iov_base = mapping->addr;
+    iov[1].iov_len = mapping->length;
+
+    if (!io_writev_all(client, iov, 2)) {
+        perror("Error: cannot write to socket");
+    }
+
+    mapcache_put(mapping);
+
+    return;
+}
+
+/* Close this thread's pipe, runs at thread exit */
+static void close_pipe(void *arg) {
+    (void)arg;
+
+    if (splice_pipe[0] != ERROR) {
+        close(splice_pipe[0]);
+        close(splice_pipe[1]);
+        splice_pipe[0] = splice_pipe[1] = ERROR;
+    }
+}
+
+/* Key whose destructor closes the pipe of an exiting thread */
+static void create_pipe_key(void) {
+    pthread_key_create(&pipe_key, close_pipe);
+}
+
+/* Get this thread's pipe, creating it on first use */
+/* Returns false if no pipe could be created */
+static bool get_pipe(void) {
+    if (splice_pipe[0] != ERROR) {
+        return true;
+    }
+
+    if (pipe2(splice_pipe, O_CLOEXEC) == ERROR) {
+        perror("Error: pipe2() failed");
+        splice_pipe[0] = splice_pipe[1] = ERROR;
+        return false;
+    }
+
+    /* Bigger pipe, fewer round trips, best effort */
+    fcntl(splice_pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+
+    pthread_once(&pipe_key_once, create_pipe_key);
+    pthread_setspecific(pipe_key, splice_pipe);
+
+    return true;
+}
+
+/* Splice from a descriptor to a socket through this thread's pipe */
+size_t splice_to_socket(int client, int in, loff_t *offset, size_t length) {
+    size_t sent = 0, buffered = 0;
+    ssize_t moved;
+
+    if (!get_pipe()) {
+        return 0;
+    }
+
+    while (sent < length) {
+        /* Fill the pipe */
+        if (buffered == 0) {
+            moved = splice(in, offset, splice_pipe[1], NULL, length - sent,
+                           SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (moved == ERROR && errno == EINTR) {
+                continue;
+            }
+
+            /* Input is a socket with nothing in yet */
+            if (moved == ERROR && errno == EAGAIN && io_wait(in, POLLIN)) {
+                continue;
+            }
+
+            /* End of input, or it failed */
+            if (moved <= 0) {
+                if (moved == ERROR) {
+                    perror("Error: cannot splice from input");
+                }
+                break;
+            }
+
+            buffered = (size_t)moved;
+        }
+
+        /* Drain it into the socket */
+        moved = splice(splice_pipe[0], NULL, client, NULL, buffered,
+                       SPLICE_F_MOVE |
+                       (sent + buffered < length ? SPLICE_F_MORE : 0));
+        if (moved == ERROR && errno == EINTR) {
+            continue;
+        }
+
+        /* Socket buffer full */
+        if (moved == ERROR && errno == EAGAIN &&
+            io_wait(client, POLLOUT)) {
+            continue;
+        }
+
+        if (moved <= 0) {
+            perror("Error: cannot write to socket");
+            break;
+        }
+
+        buffered -= (size_t)moved;
+        sent += (size_t)moved;
+    }
+
+    /* Data stuck in the pipe would leak into the next response */
+    if (buffered > 0) {
+        close_pipe(NULL);
+    }
+
+    return sent;
+}
+
+/* Send the body by splicing the file through a pipe */
+/* Works for files sendfile() refuses and never copies to user space */
+static void splice_file(int client, const char *uri, int file,
+                        const file_meta_t *meta) {
+    loff_t offset = 0;
+
+    (void)uri;
+
+    write_content_length(client, (size_t)meta->size);
+
+    splice_to_socket(client, file, &offset, (size_t)meta->size);
+
+    return;
+}
@@ -0,0 +1,48 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: sender.h
+ * Purpose: body sender header file. Defines the ways a file body can be -
+            sent to a client
+ */
+
+#ifndef SENDER_H
+#define SENDER_H
+
+#include <sys/types.h>
+
+#include "filecache.h"
+
+/* Size asked for each worker pipe, the kernel may give less */
+#define SPLICE_PIPE_SIZE (256 * 1024)
+
+/* How file bodies are sent */
+typedef enum {
+    SEND_READ,
+    SEND_SENDFILE,
+    SEND_MMAP,
+    SEND_SPLICE,
+    NUM_SEND_MODES
+} send_mode_t;
+
+/* Sends Content-Length, ends the header block, then sends the body */
+/* file is the URI already opened for reading, the caller closes it */
+typedef void (*body_sender_t)(int client, const char *uri, int file,
+                              const file_meta_t *meta);
+
+/* Pick the sender used for every response */
+void sender_init(send_mode_t mode);
+
+/* Send the rest of a 200 response for a file */
+/* Open the file before writing any header, so a failed open can still -
+   be answered with an error */
+void send_file_body(int client, const char *uri, int file,
+                    const file_meta_t *meta);
+
+/* Move up to length bytes from any descriptor to a socket through this -
+   thread's pipe, without copying to user space */
+/* offset is advanced for files, NULL for pipes and sockets */
+/* Returns bytes sent, less than length at end of input or on error */
+size_t splice_to_socket(int client, int in, loff_t *offset, size_t length);
+
+#endif
@@ -8,121 +8,262 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <signal.h>
 #include <errno.h>
+#include <poll.h>
 
 /* Helper header files included */
 #include "threadpool.h"
 #include "http.h"
-
-/* size variables for listening queue and buffers */
-#define BACKLOG 100
-#define BUFFER_SIZE 1024
-
-/* Web root global variable */
-/* Dont see an issue with this since it is used for entire server lifetime */
-char *webroot = NULL;
+#include "config.h"
+#include "timer.h"
+#include "reactor.h"
+#include "connlimit.h"
+#include "stats.h"
+#include "handoff.h"
+#include "filecache.h"
+#include "watcher.h"
+#include "ticker.h"
+#include "sender.h"
+#include "mapcache.h"
+#include "webroot.h"
+#include "tune.h"
+#include "conn.h"
+#include "listener.h"
+#include "h2.h"
+#include "tls.h"
+#include "proxy.h"
+#include "fastcgi.h"
+#include "plugin.h"
+#include "listing.h"
+#include "scan.h"
+#include "vhost.h"
+
+/* Most connections taken off the backlog per wakeup */
+#define ACCEPT_BATCH 64
 
 /* signal flag for when server is closed */
 /* Needs to be global since the it checks server signals */
 volatile sig_atomic_t running = false;
 
-/* Sets up listening socket for server */
-static int setup_listening_socket(int portno, int max_clients) {
-    struct sockaddr_in serv_addr;
-    int sock, reuse = 1;
+/* signal flag for when statistics have been asked for */
+volatile sig_atomic_t dump_requested = false;
 
-     /* Setup TCP socket */
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock == ERROR) {
-        perror("Error: cannot open socket");
-        exit(EXIT_FAILURE);
+/* signal flag for when a new server should take over the listening socket */
+volatile sig_atomic_t handoff_requested = false;
+
+/* Upgrade to h2c if the request asks for it */
+/* Returns true if the request was answered over HTTP/2 */
+static bool upgrade_to_h2c(connection_t *conn, const http_request_t *request) {
+    const char *upgrade = NULL, *settings = NULL;
+    size_t upgrade_length, settings_length;
+
+    if (strcmp(request->httpversion, "HTTP/1.1") != 0) {
+        return false;
     }
-    printf("Listening socket created.\n");
 
-    memset(&serv_addr, '\0', sizeof serv_addr);
+    upgrade = request_header(request, HEADER_UPGRADE, &upgrade_length);
+    settings = request_header(request, HEADER_HTTP2_SETTINGS,
+                              &settings_length);
 
-    /* Create address we're going to listen on (given port number) -
-       converted to network byte order & any IP address for -
-       this machine */
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = INADDR_ANY;
-    serv_addr.sin_port = htons(portno);
+    return upgrade && settings &&
+           header_has_token(upgrade, upgrade_length, "h2c") &&
+           h2_serve_upgrade(conn, request, settings, settings_length);
+}
 
-    /* Set socket option SO_REUSEADDR. If a recently closed server wants to -
-       use this port, and some of the leftover chunks is lingering around -
-       we can still use this port */
-    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR,
-                   &reuse, sizeof reuse) == ERROR) {
+/* Process client request */
+/* Function which gets dispatched to worker threads */
+static void process_client_request(connection_t *conn) {
+    http_request_t request;
+    file_meta_t meta;
+    http_method_t method;
+    const proxy_route_t *route = NULL;
+    const char *path = NULL;
+    char index[PATH_MAX];
+    int client = conn->fd, status, file;
+
+    /* TLS clients handshake first, after which the fd carries plaintext */
+    if (conn->handshake_pending && !tls_handshake(conn)) {
+        conn_close(conn);
+        return;
+    }
 
-        perror("Error: setting socket option for reusing address");
-        exit(EXIT_FAILURE);
+    /* HTTP/2 connection back from the reactor, with frames to read */
+    if (conn->h2) {
+        h2_resume(conn);
+        return;
     }
 
-    /* Bind address to the socket */
-    if (bind(sock, (struct sockaddr *)&serv_addr, sizeof serv_addr) == ERROR) {
-        perror("Error: cannot bind address to socket");
-        exit(EXIT_FAILURE);
+    /* Finish reading the header, the reactor may already have all of it */
+    switch (conn_read_header(conn)) {
+    case HEADER_PENDING:
+        /* Rest is still on its way, wait for it without a worker */
+        reactor_park(conn);
+        return;
+    case HEADER_CLOSED:
+        /* Nothing to serve, client went away */
+        conn_close(conn);
+        return;
+    case HEADER_DONE:
+        break;
     }
 
-    printf("Binding done.\n");
-    printf("Listening on port: %d.\n", portno);
+    /* Client knows we speak HTTP/2, it keeps this worker until it's done */
+    if (config.http2 && h2_is_preface(conn)) {
+        h2_serve(conn);
+        return;
+    }
 
-    /* Listen on socket - means we're ready to accept connections -
-       incoming connection requests will be queued */
-    if (listen(sock, max_clients) == ERROR) {
-        perror("Error: cannot listen on socket");
-        exit(EXIT_FAILURE);
+    /* Header filled the whole buffer without ending */
+    if (!conn_header_complete(conn) &&
+        conn->length == sizeof conn->buffer - 1) {
+        send_response(client, RESPONSE_TOO_LARGE);
+        conn_close(conn);
+        return;
     }
-    printf("Waiting for incoming connections...\n");
 
-    return sock;
-}
+    /* Parse request parameters */
+    if (!parse_request(&request, conn->buffer, conn->length)) {
+        send_response(client, RESPONSE_BAD_REQUEST);
+        conn_close(conn);
+        return;
+    }
 
-/* Process client request */
-/* Function which gets dispatched to worker threads */
-static void process_client_request(int client) {
-    char buffer[BUFFER_SIZE] = {0};
-    char *path = NULL;
-    http_request_t request;
-    int status_code;
+    method = get_method(request.method);
+
+    /* Site named by the Host header, everything below serves from it */
+    vhost_select(request.headers[HEADER_HOST],
+                 request.header_lengths[HEADER_HOST]);
+
+    /* Every handler matches the canonical path, so no other spelling of -
+       a route gets past it to the webroot */
+    if (!normalize_uri(request.URI)) {
+        send_response(client, RESPONSE_BAD_REQUEST);
+        free(request.method);
+        free(request.URI);
+        free(request.httpversion);
+        conn_close(conn);
+        return;
+    }
 
-    /* Read in request from client socket */
-    if (read(client, buffer, BUFFER_SIZE - 1) == ERROR) {
-        perror("Error: cannot read request");
-        exit(EXIT_FAILURE);
+    /* Plugins see every request first, before any other handler */
+    if (plugin_dispatch(conn, &request)) {
+        free(request.method);
+        free(request.URI);
+        free(request.httpversion);
+        conn_close(conn);
+        return;
     }
 
-    /* Parse request parameters */
-    parse_request(&request, buffer);
+    /* Prefixes routed upstream take any method, the upstream decides */
+    route = proxy_match(request.URI);
+    if (route) {
+        proxy_forward(conn, &request, route);
+        free(request.method);
+        free(request.URI);
+        free(request.httpversion);
+        conn_close(conn);
+        return;
+    }
 
-    /* Get absolute path of requested file */
-    /* Only needed for body of 200 response */
-    path = get_full_path(request.URI, webroot, &status_code);
+    /* Scripts run on the FastCGI application server */
+    if (fastcgi_match(request.URI)) {
+        fastcgi_forward(conn, &request);
+        free(request.method);
+        free(request.URI);
+        free(request.httpversion);
+        conn_close(conn);
+        return;
+    }
 
-    /* Construct file responses, depending on status code */
-    if (status_code == FOUND) {
-        construct_file_response(client, path, found);
-        read_write_file(client, path);
+    /* HTTP/1.1 client asking to switch, answered over HTTP/2 instead, -
+       which closes or parks the connection itself */
+    if (config.http2 && upgrade_to_h2c(conn, &request)) {
+        free(request.method);
+        free(request.URI);
+        free(request.httpversion);
+        return;
+    }
+
+    /* Whole response has to go out before the write deadline */
+    timer_add(&conn->timer, config.write_timeout, conn_expired, conn);
+
+    /* Methods that never need the file get a pre-rendered response */
+    if (method == METHOD_OPTIONS) {
+        send_response(client, RESPONSE_OPTIONS);
+    } else if (method == METHOD_NOT_ALLOWED) {
+        send_response(client, RESPONSE_NOT_ALLOWED);
+    } else if (method == METHOD_NOT_IMPLEMENTED) {
+        send_response(client, RESPONSE_NOT_IMPLEMENTED);
+
+    /* Check requested file, resolved beneath the webroot */
+    } else if ((status = get_file_status(request.URI, &meta)) == FOUND) {
+        /* Directories are answered with their index file */
+        path = get_served_path(request.URI, index, sizeof index);
+
+        /* Opened before any header goes out, so a file removed since its -
+           metadata was cached still gets a whole 404. HEAD is answered -
+           from cached metadata, file is never opened */
+        file = method == METHOD_HEAD ? ERROR : webroot_open(path, O_RDONLY);
+        if (method != METHOD_HEAD && file == ERROR) {
+            send_response(client, RESPONSE_NOT_FOUND);
+        } else {
+            /* Headers and the start of the body leave in full frames */
+            tune_cork(conn, true);
+
+            construct_file_response(client, path, found);
+            write_cache_headers(client, &meta);
+
+            if (method == METHOD_HEAD) {
+                write_content_length(client, (size_t)meta.size);
+            } else {
+                send_file_body(client, path, file, &meta);
+                close(file);
+            }
+
+            tune_cork(conn, false);
+        }
+    } else if (status == MOVED) {
+        /* Directory asked for without its trailing slash */
+        send_redirect(client, request.URI);
+    } else if (status == LISTING && config.dir_listing) {
+        listing_send(client, request.URI, method == METHOD_HEAD);
     } else {
-        construct_file_response(client, path, not_found);
-        write(client, no_content, strlen(no_content));
+        /* Misses are a single pre-rendered write */
+        send_response(client, RESPONSE_NOT_FOUND);
     }
 
+    timer_cancel(&conn->timer);
+
     /* Free up all the pointers allocated */
     free(request.method);
     free(request.URI);
     free(request.httpversion);
 
-    free(path);
+    /* Close the client socket and recycle the connection */
+    conn_close(conn);
 
-    /* Close the client socket */
-    close(client);
+    return;
+}
+
+/* Turn a client away without serving it */
+/* Used by the thread pool when the queue is full or too slow */
+static void reject_client(connection_t *conn) {
+    /* Single pre-rendered write, never blocks on a client we are shedding. -
+       A client yet to handshake just gets closed, HTTP/2 gets GOAWAY */
+    if (conn->h2) {
+        h2_abandon(conn);
+    } else if (!conn->handshake_pending) {
+        send_response(conn->fd, RESPONSE_UNAVAILABLE);
+    }
+    conn_close(conn);
 
     return;
 }
@@ -130,6 +271,18 @@ static void process_client_request(int client) {
 /* signal handling function */
 /* Updates running variables when SIGINT, SIGTERM or SIGUIT is triggered */
 static void signal_handler(int signum) {
+    /* Statistics only, the server keeps going */
+    if (signum == SIGUSR1) {
+        dump_requested = true;
+        return;
+    }
+
+    /* Acceptor hands the listening socket over on its next iteration */
+    if (signum == SIGUSR2) {
+        handoff_requested = true;
+        return;
+    }
+
     running = true;
 
     if (signum == SIGINT) {
@@ -141,30 +294,175 @@ static void signal_handler(int signum) {
     return;
 }
 
+/* Finish queued and in flight clients, up to the drain deadline */
+/* Parked clients are still served if they send before their own deadline */
+static void drain_clients(thread_pool *pool) {
+    uint64_t deadline = timer_now_ms() + (uint64_t)config.drain_timeout;
+
+    fprintf(stderr, "Draining clients...\n");
+
+    while (timer_now_ms() < deadline) {
+        if (wait_for_idle(pool, QUEUE_WAIT_MS)) {
+            if (reactor_parked() == 0) {
+                return;
+            }
+
+            /* Pool is quiet but parked clients may still turn up */
+            usleep(QUEUE_WAIT_MS * 1000);
+        }
+    }
+
+    fprintf(stderr, "Drain deadline passed, cutting off remaining "
+                    "clients\n");
+
+    return;
+}
+
+/* Take every waiting connection off a backlog, up to max */
+/* Clients come out non-blocking and close-on-exec, each in a pooled -
+   connection. Returns how many were accepted into conns */
+static size_t accept_batch(const listener_t *listener, connection_t **conns,
+                           size_t max) {
+    struct sockaddr_storage client_addr;
+    socklen_t client_len;
+    connection_t *conn = NULL;
+    size_t count = 0;
+    int client;
+
+    while (count < max) {
+        client_len = sizeof client_addr;
+        client = accept4(listener->fd, (struct sockaddr *)&client_addr,
+                         &client_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client == ERROR) {
+            /* Backlog drained, or a signal for the main loop to look at */
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Error: cannot accept connection");
+            }
+            break;
+        }
+
+        /* Turn away addresses already holding too many connections, -
+           with a 503 if it would be understood */
+        if (!connlimit_acquire(client, (struct sockaddr *)&client_addr)) {
+            if (!listener->tls) {
+                send_response(client, RESPONSE_UNAVAILABLE);
+            }
+            close(client);
+            continue;
+        }
+
+        /* Every connection is in use, shed this one, with a 503 if it -
+           would be understood */
+        conn = conn_get(client, (struct sockaddr *)&client_addr, client_len);
+        if (!conn) {
+            if (!listener->tls) {
+                send_response(client, RESPONSE_UNAVAILABLE);
+            }
+            connlimit_release(client);
+            close(client);
+            continue;
+        }
+
+        /* Unix sockets have no TCP options to tune */
+        if (listener->family != AF_UNIX) {
+            tune_client(client);
+        }
+        conn->handshake_pending = listener->tls;
+        conns[count++] = conn;
+    }
+
+    return count;
+}
+
 int main(int argc, char *argv[]) {
-    int sockfd, client, portno;
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof client_addr;
+    connection_t *conns[ACCEPT_BATCH];
+    listener_t listeners[MAX_LISTENERS];
+    struct pollfd ready[MAX_LISTENERS];
+    int fds[MAX_LISTENERS];
+    size_t count, space, num_listeners;
     thread_pool *pool = NULL;
     struct sigaction action;
 
-    /* Check if enough command line arguements were given */
-    if (argc != 3) {
-        fprintf(stderr, "Usage: ./server [port number] [path to webroot]\n");
-        exit(EXIT_FAILURE);
-    }
+    /* Read port, webroot and options */
+    parse_config(argc, argv);
 
-    /* Convert port number to a digit */
-    /* Assumes port number is valid */
-    portno = atoi(argv[1]);
+    /* Widest request scanner this CPU has, and the header name table it -
+       feeds */
+    scan_init();
+    init_headers();
 
-    /* Update global webroot */
-    webroot = argv[2];
+    /* Render fixed responses and the Date header before anything can -
+       send one */
+    init_responses();
+    ticker_init();
+    h2_init();
 
-    pool = initialise_threadpool(process_client_request);
+    /* Certificate has to load before any TLS listener opens */
+    if (config.tls_cert) {
+        tls_init(config.tls_cert, config.tls_key);
+    }
 
-    /* Construct socket */
-    sockfd = setup_listening_socket(portno, BACKLOG);
+    connlimit_init(config.max_conns_per_ip);
+    conn_pool_init();
+    sender_init(config.send_mode);
+
+    /* Dynamic parts of the site are served by upstreams */
+    proxy_init(config.proxy, config.num_proxy);
+    fastcgi_init(config.fastcgi, config.fastcgi_match,
+                 config.num_fastcgi_match, config.webroot);
+
+    /* In-process endpoints */
+    plugin_init(config.plugins, config.num_plugins);
+
+    /* Requests are resolved relative to the open webroot of their host */
+    vhost_init(config.webroot, config.vhosts, config.num_vhosts,
+               FILECACHE_MAX_ENTRIES);
+    webroot_init();
+
+    /* File metadata is only cached while inotify can keep it fresh */
+    filecache_init((unsigned)config.negative_ttl);
+    mapcache_init(config.mmap_populate);
+    if (watcher_init()) {
+        filecache_enable(true);
+        webroot_enable_dircache(true);
+        mapcache_enable(true);
+    } else {
+        fprintf(stderr, "Cannot watch webroot, file caching disabled\n");
+    }
+
+    pool = initialise_threadpool(process_client_request, reject_client);
+    set_queue_limit(pool, (size_t)config.queue_limit, config.queue_policy);
+    set_queue_delay_target(pool, config.queue_target, config.queue_interval);
+
+    /* Idle clients wait in the reactor, not in the thread pool */
+    reactor_init(pool);
+
+    /* Construct sockets, or take them over from the server being -
+       replaced. Those are kept as they are, listen addresses only change -
+       on a full restart */
+    num_listeners = handoff_receive(fds, MAX_LISTENERS);
+    if (num_listeners == 0) {
+        num_listeners = (size_t)config.num_listen;
+        for (size_t i = 0; i < num_listeners; i++) {
+            listener_open(&listeners[i], config.listen[i],
+                          tune_backlog(config.backlog));
+        }
+    } else {
+        for (size_t i = 0; i < num_listeners; i++) {
+            listener_adopt(&listeners[i], fds[i],
+                           tune_backlog(config.backlog));
+        }
+    }
+
+    /* Handed off listeners come in the order of our own arguments */
+    for (size_t i = 0; i < num_listeners; i++) {
+        listeners[i].tls = i < (size_t)config.num_listen &&
+                           config.listen_tls[i];
+        fds[i] = listeners[i].fd;
+        ready[i].fd = listeners[i].fd;
+        ready[i].events = POLLIN;
+    }
+    printf("Waiting for incoming connections...\n");
 
     /* Setup signal handler */
     action.sa_handler = signal_handler;
@@ -189,28 +487,122 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    if (sigaction(SIGUSR1, &action, NULL) == ERROR) {
+        perror("Error: SIGUSR1 sigaction() failed");
+        exit(EXIT_FAILURE);
+    }
+
+    if (sigaction(SIGUSR2, &action, NULL) == ERROR) {
+        perror("Error: SIGUSR2 sigaction() failed");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Writing to a client that hung up should fail, not kill the server */
+    action.sa_handler = SIG_IGN;
+    if (sigaction(SIGPIPE, &action, NULL) == ERROR) {
+        perror("Error: SIGPIPE sigaction() failed");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Ready to accept, an old server waiting on us can start draining */
+    handoff_complete();
+
 
     /* loop that keeps fetching connections forever until server dies */
     while (!running) {
 
-        /* Accept a connection - block until a connection is ready to -
-           be accepted. Fetch new extension descriptor to communicate on. */
-        client = accept(sockfd, (struct sockaddr *) &client_addr, &client_len);
-        if (client == ERROR && errno == EINTR) {
-            perror("Connection closed");
-            break;
+        /* Report statistics when asked */
+        if (dump_requested) {
+            dump_requested = false;
+            stats_dump(stderr);
+        }
+
+        /* Pass the listening sockets to a freshly exec'd server, then -
+           drain like a normal shutdown */
+        if (handoff_requested) {
+            handoff_requested = false;
+
+            if (handoff_start(argv, fds, num_listeners)) {
+                fprintf(stderr, "Listening sockets handed over\n");
+                break;
+            }
+        }
+
+        /* Under the block policy, leave clients in the kernel backlog -
+           until a worker frees up some queue space, and only take as -
+           many as fit */
+        space = ACCEPT_BATCH;
+        if (config.queue_policy == QUEUE_BLOCK) {
+            space = wait_for_queue_space(pool);
+            if (space == 0) {
+                continue;
+            }
+            if (space > ACCEPT_BATCH) {
+                space = ACCEPT_BATCH;
+            }
         }
 
-        /* process client work */
-        add_client_work(pool, &client);
+        /* Block until connections are waiting on any listener */
+        if (poll(ready, num_listeners, -1) == ERROR) {
+            /* Only shutdown signals end the loop */
+            if (errno == EINTR && running) {
+                perror("Connection closed");
+                break;
+            }
+
+            if (errno != EINTR) {
+                perror("Error: poll() failed on listening sockets");
+            }
+            continue;
+        }
+
+        /* Drain the backlogs, then hand the batch over in one go */
+        count = 0;
+        for (size_t i = 0; i < num_listeners && count < space; i++) {
+            if (ready[i].revents & POLLIN) {
+                count += accept_batch(&listeners[i], conns + count,
+                                      space - count);
+            }
+        }
+
+        if (count == 0) {
+            continue;
+        }
+
+        /* With deferred accept the request is usually already here, so -
+           skip the reactor. Workers park anything that isn't */
+        if (config.defer_accept > 0) {
+            add_clients_work(pool, conns, count);
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                reactor_park(conns[i]);
+            }
+        }
+    }
+
+    /* Close up the server sockets, just in case */
+    /* After a handoff this only drops our copies, the new server keeps -
+       them and their backlogs */
+    for (size_t i = 0; i < num_listeners; i++) {
+        close(listeners[i].fd);
     }
 
-    /* Close up the server socket, just in case */
-    close(sockfd);
+    /* Serve what has already been accepted, HTTP/2 connections finish -
+       their open streams and close */
+    h2_drain();
+    drain_clients(pool);
+
+    /* Stop firing deadlines */
+    reactor_stop();
 
     /* Clean up thread pool */
     /* I'm a good citizen that wants no memory leaks */
     cleanup_pool(pool);
 
+    /* No worker is left to call into a plugin */
+    plugin_teardown();
+
+    stats_dump(stderr);
+
     exit(EXIT_SUCCESS);
 }
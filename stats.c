@@ -0,0 +1,72 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: stats.c
+ * Purpose: server statistics module. Implements reporting of the counters
+ */
+
+#include "stats.h"
+
+server_stats_t stats;
+
+/* Load a counter for reporting */
+#define STAT_GET(field) \
+    atomic_load_explicit(&stats.field, memory_order_relaxed)
+
+/* Raise a high water mark */
+void stats_max(_Atomic uint64_t *field, uint64_t value) {
+    uint64_t current = atomic_load_explicit(field, memory_order_relaxed);
+
+    /* Retry until either we win, or someone raised it higher */
+    while (value > current &&
+           !atomic_compare_exchange_weak_explicit(field, &current, value,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+
+    return;
+}
+
+/* Print counters */
+void stats_dump(FILE *out) {
+    uint64_t dequeued = STAT_GET(dequeued);
+
+    fprintf(out, "queue: enqueued %lu, dequeued %lu\n",
+            (unsigned long)STAT_GET(enqueued), (unsigned long)dequeued);
+    fprintf(out, "queue wait: average %lu us, max %lu us\n",
+            (unsigned long)(dequeued ? STAT_GET(queue_wait_us) / dequeued : 0),
+            (unsigned long)STAT_GET(queue_wait_max_us));
+    fprintf(out, "queue shedding: full %lu, oldest dropped %lu, "
+                 "delay %lu\n",
+            (unsigned long)STAT_GET(rejected_full),
+            (unsigned long)STAT_GET(dropped_oldest),
+            (unsigned long)STAT_GET(shed_delay));
+    fprintf(out, "metadata cache: hits %lu, misses %lu, negative hits %lu\n",
+            (unsigned long)STAT_GET(meta_hits),
+            (unsigned long)STAT_GET(meta_misses),
+            (unsigned long)STAT_GET(negative_hits));
+    fprintf(out, "http/2: connections %lu, streams %lu\n",
+            (unsigned long)STAT_GET(h2_connections),
+            (unsigned long)STAT_GET(h2_streams));
+    fprintf(out, "tls: handshakes %lu, resumed %lu, kernel offloaded %lu\n",
+            (unsigned long)STAT_GET(tls_handshakes),
+            (unsigned long)STAT_GET(tls_resumed),
+            (unsigned long)STAT_GET(tls_offloaded));
+    fprintf(out, "proxy: requests %lu, upstream connections %lu, "
+                 "reused %lu, bad gateway %lu\n",
+            (unsigned long)STAT_GET(proxy_requests),
+            (unsigned long)STAT_GET(proxy_connects),
+            (unsigned long)STAT_GET(proxy_reused),
+            (unsigned long)STAT_GET(proxy_errors));
+    fprintf(out, "fastcgi: requests %lu, backend connections %lu, "
+                 "failed %lu\n",
+            (unsigned long)STAT_GET(fastcgi_requests),
+            (unsigned long)STAT_GET(fastcgi_connects),
+            (unsigned long)STAT_GET(fastcgi_errors));
+    fprintf(out, "plugins: requests %lu\n",
+            (unsigned long)STAT_GET(plugin_requests));
+
+    fflush(out);
+
+    return;
+}
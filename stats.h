@@ -0,0 +1,71 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: stats.h
+ * Purpose: server statistics header file. Defines counters shared by every -
+            thread in the server
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* Server wide counters, updated without locks */
+typedef struct {
+    /* Thread pool queue */
+    _Atomic uint64_t enqueued;
+    _Atomic uint64_t dequeued;
+    _Atomic uint64_t queue_wait_us;
+    _Atomic uint64_t queue_wait_max_us;
+    _Atomic uint64_t rejected_full;
+    _Atomic uint64_t dropped_oldest;
+    _Atomic uint64_t shed_delay;
+
+    /* File metadata cache */
+    _Atomic uint64_t meta_hits;
+    _Atomic uint64_t meta_misses;
+    _Atomic uint64_t negative_hits;
+
+    /* HTTP/2 */
+    _Atomic uint64_t h2_connections;
+    _Atomic uint64_t h2_streams;
+
+    /* TLS, handshakes that resumed a session or went to the kernel */
+    _Atomic uint64_t tls_handshakes;
+    _Atomic uint64_t tls_resumed;
+    _Atomic uint64_t tls_offloaded;
+
+    /* Proxied requests, upstream connections opened and pooled ones -
+       reused, and requests answered with a 502 */
+    _Atomic uint64_t proxy_requests;
+    _Atomic uint64_t proxy_connects;
+    _Atomic uint64_t proxy_reused;
+    _Atomic uint64_t proxy_errors;
+
+    /* FastCGI requests, backend connections opened, and requests that -
+       got a 502 or 503 */
+    _Atomic uint64_t fastcgi_requests;
+    _Atomic uint64_t fastcgi_connects;
+    _Atomic uint64_t fastcgi_errors;
+
+    /* Requests answered by plugins */
+    _Atomic uint64_t plugin_requests;
+} server_stats_t;
+
+extern server_stats_t stats;
+
+/* Bump a counter */
+#define STAT_INC(field) STAT_ADD(field, 1)
+#define STAT_ADD(field, value) \
+    atomic_fetch_add_explicit(&stats.field, (value), memory_order_relaxed)
+
+/* Raise a high water mark counter */
+void stats_max(_Atomic uint64_t *field, uint64_t value);
+
+/* Print every counter */
+void stats_dump(FILE *out);
+
+#endif
@@ -81,6 +81,56 @@ do_http_get () {
     fi
 }
 
+do_http_head () {
+    test_num=$1
+    test_desc=$2
+    test_url=$3
+    test_mime=$4
+
+    temp_header="$(mktemp /tmp/myscript.XXXXXX)"
+
+    head_pass=false
+    wget -q --spider --server-response $test_url 2> $temp_header
+    if grep -Eiq 'HTTP/1.0 200 OK$|HTTP/1.1 200 OK$' $temp_header &&
+       grep -Eiq "$test_mime" $temp_header &&
+       grep -Eiq 'Content-Length: [1-9]' $temp_header
+    then
+        head_pass=true
+    fi
+    rm -f "$temp_header"
+
+    if $head_pass;
+    then
+        echo "Test $test_num: $test_desc: PASS"
+    else
+        echo "Test $test_num: $test_desc: FAIL"
+    fi
+}
+
+do_http2_get () {
+    test_num=$1
+    test_desc=$2
+    test_url=$3
+    test_file=$4
+
+    temp_file="$(mktemp /tmp/myscript.XXXXXX)"
+
+    h2_pass=false
+    version=$(curl -s --http2 -o $temp_file -w '%{http_version}' $test_url)
+    if [ "$version" == "2" ] && diff $test_file $temp_file &>/dev/null
+    then
+        h2_pass=true
+    fi
+    rm -f "$temp_file"
+
+    if $h2_pass;
+    then
+        echo "Test $test_num: $test_desc: PASS"
+    else
+        echo "Test $test_num: $test_desc: FAIL"
+    fi
+}
+
 do_http_get 1 "GET HTML file in root" $base_url$index_file $web_root$index_file "200" "$mime_html"
 do_http_get 2 "GET Non-existent HTML file in root" $base_url"junk.html" $web_root$index_file "404"
 do_http_get 3 "GET CSS file in root" $base_url$css_file $web_root$css_file "200" "$mime_css"
@@ -90,6 +140,29 @@ do_http_get 6 "GET HTML file in directory" "$sub_url$index_file" "$sub_root$inde
 do_http_get 7 "GET CSS file in directory" "$sub_url$css_file" "$sub_root$css_file" "200" "$mime_css"
 do_http_get 8 "GET JavaScript file in directory" "$sub_url$javascript_file" "$sub_root$javascript_file" "200" "$mime_javascript"
 do_http_get 9 "GET JPEG file in directory" "$sub_url$jpeg_file" "$sub_root$jpeg_file" "200" "$mime_jpeg"
+do_http_head 10 "HEAD JPEG file in directory" "$sub_url$jpeg_file" "$mime_jpeg"
+do_http2_get 11 "GET JPEG file over HTTP/2" "$sub_url$jpeg_file" "$sub_root$jpeg_file"
+do_http_get 12 "GET root directory index" "$base_url" "$web_root$index_file" "200" "$mime_html"
+do_http_get 13 "GET directory without trailing slash" "${base_url}directory" "$sub_root$index_file" "200" "$mime_html"
+do_http_get 14 "GET encoded path with query" "${base_url}%64irectory//$css_file?v=123" "$sub_root$css_file" "200" "$mime_css"
+
+# Second server in front of the first, its own webroot has no directory/
+proxy_port=$(( $2 + 1 ))
+./$1 $proxy_port $sub_root --proxy=/directory/=127.0.0.1:$2 &>>test_log.txt &
+proxy_pid=$!
+sleep 1s
+proxy_url="http://127.0.0.1:$proxy_port/directory/"
+
+do_http_get 15 "GET CSS file through proxy route" "$proxy_url$css_file" "$sub_root$css_file" "200" "$mime_css"
+
+# Request cut off before its header ends, the proxy has to survive it
+exec 3<>/dev/tcp/127.0.0.1/$proxy_port
+printf 'GET /directory/%s HTTP/1.0' $css_file >&3
+exec 3>&-
+sleep 0.5s
+do_http_get 16 "GET through proxy after truncated request" "$proxy_url$jpeg_file" "$sub_root$jpeg_file" "200" "$mime_jpeg"
+
+kill $proxy_pid
 
 
 kill $server_pid
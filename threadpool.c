@@ -7,11 +7,38 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
+#include <time.h>
 
 #include "threadpool.h"
+#include "stats.h"
+
+/* Monotonic clock in microseconds, used to stamp queued clients */
+static uint64_t now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* Absolute CLOCK_REALTIME deadline for timed condition waits */
+static struct timespec deadline_after(int ms) {
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    return deadline;
+}
 
 /* Create a new threadpool */
-thread_pool *initialise_threadpool(workfunc_t work) {
+thread_pool *initialise_threadpool(workfunc_t work, rejectfunc_t reject) {
     thread_pool *pool = NULL;
 
     /* Create thread pool */
@@ -30,25 +57,121 @@ thread_pool *initialise_threadpool(workfunc_t work) {
         exit(EXIT_FAILURE);
     }
 
-    /* Initialise thread pool condition */
-    if (pthread_cond_init(&(pool->cond), NULL)) {
+    /* Initialise thread pool conditions */
+    if (pthread_cond_init(&(pool->cond), NULL) ||
+        pthread_cond_init(&(pool->space), NULL) ||
+        pthread_cond_init(&(pool->idle), NULL)) {
         perror("Error: cond init failed");
         exit(EXIT_FAILURE);
     }
 
     pool->num_threads = MAX_THREADS;
+    pool->active = 0;
+    pool->stopping = false;
+
+    /* Unbounded with no shedding until configured otherwise */
+    pool->queue_limit = 0;
+    pool->policy = QUEUE_REJECT;
+    pool->target = 0;
+    pool->interval = 0;
+    pool->interval_end = 0;
+    pool->min_wait = UINT64_MAX;
+    pool->overloaded = false;
+
+    /* Add work functions before any worker can run */
+    pool->work = work;
+    pool->reject = reject;
 
     /* Create workers for thread pool */
     create_workers(pool);
 
-    /* Add work function */
-    pool->work = work;
-
     return pool;
 }
 
+/* Bound the task queue */
+void set_queue_limit(thread_pool *pool, size_t limit, queue_policy_t policy) {
+    pthread_mutex_lock(&(pool->mutex));
+
+    pool->queue_limit = limit;
+    pool->policy = policy;
+
+    pthread_mutex_unlock(&(pool->mutex));
+
+    return;
+}
+
+/* Set queueing delay target */
+void set_queue_delay_target(thread_pool *pool, int target_ms,
+                            int interval_ms) {
+    pthread_mutex_lock(&(pool->mutex));
+
+    pool->target = (uint64_t)target_ms * 1000;
+    pool->interval = (uint64_t)interval_ms * 1000;
+
+    pthread_mutex_unlock(&(pool->mutex));
+
+    return;
+}
+
+/* Wait for room in the task queue */
+/* Only used with the block policy, leaving clients in the kernel backlog */
+size_t wait_for_queue_space(thread_pool *pool) {
+    struct timespec deadline = deadline_after(QUEUE_WAIT_MS);
+    size_t space = SIZE_MAX;
+
+    /* Critical section */
+    pthread_mutex_lock(&(pool->mutex));
+
+    while (pool->queue_limit != 0 &&
+           (size_t)queue_length(pool->task_queue) >= pool->queue_limit) {
+        if (pthread_cond_timedwait(&(pool->space), &(pool->mutex),
+                                   &deadline)) {
+            break;
+        }
+    }
+
+    if (pool->queue_limit != 0) {
+        space = (size_t)queue_length(pool->task_queue) < pool->queue_limit
+                    ? pool->queue_limit -
+                      (size_t)queue_length(pool->task_queue)
+                    : 0;
+    }
+
+    pthread_mutex_unlock(&(pool->mutex));
+
+    return space;
+}
+
+/* Wait for the pool to run out of work */
+bool wait_for_idle(thread_pool *pool, int timeout_ms) {
+    struct timespec deadline = deadline_after(timeout_ms);
+    bool idle;
+
+    /* Critical section */
+    pthread_mutex_lock(&(pool->mutex));
+
+    while (pool->active != 0 || !queue_is_empty(pool->task_queue)) {
+        if (pthread_cond_timedwait(&(pool->idle), &(pool->mutex),
+                                   &deadline)) {
+            break;
+        }
+    }
+
+    idle = pool->active == 0 && queue_is_empty(pool->task_queue);
+
+    pthread_mutex_unlock(&(pool->mutex));
+
+    return idle;
+}
+
 /* Create workers here */
 void create_workers(thread_pool *pool) {
+    sigset_t all, old;
+
+    /* Workers inherit a blocked mask, so signals reach the acceptor */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
     /* Create threadpool worker threads */
     for (size_t i = 0; i < pool->num_threads; i++) {
         if (pthread_create(&(pool->threads[i]), NULL,
@@ -59,27 +182,146 @@ void create_workers(thread_pool *pool) {
         }
     }
 
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
     return;
 }
 
 /* Add client work to task task queue */
-void add_client_work(thread_pool *pool, int *client) {
+void add_client_work(thread_pool *pool, connection_t *conn) {
+    add_clients_work(pool, &conn, 1);
+}
+
+/* Add up to POOL_MAX_BATCH clients under one lock */
+/* With hold, clients past the limit are left to the caller instead of -
+   the overflow policy. Returns how many were taken */
+static size_t add_batch(thread_pool *pool, connection_t *const *conns,
+                        size_t count, bool hold) {
+    connection_t *turned_away[POOL_MAX_BATCH];
+    size_t num_turned_away = 0, num_rejected = 0, num_dropped = 0;
+    size_t num_added, taken;
+    uint64_t now = now_us();
+
+    /* Stamp outside the lock */
+    for (size_t i = 0; i < count; i++) {
+        conns[i]->enqueued = now;
+    }
+
     /* Critical section */
     pthread_mutex_lock(&(pool->mutex));
 
-    /* Add client to the task_queue */
-    queue_enqueue(pool->task_queue, client);
+    for (taken = 0; taken < count; taken++) {
+        /* Queue is full, apply the overflow policy. Under block the -
+           acceptor takes no more than there is room for and the reactor -
+           holds on to the rest, so only a race with the other ends up -
+           rejected */
+        if (pool->queue_limit != 0 &&
+            (size_t)queue_length(pool->task_queue) >= pool->queue_limit) {
+
+            if (hold) {
+                break;
+            } else if (pool->policy != QUEUE_DROP_OLDEST) {
+                turned_away[num_turned_away++] = conns[taken];
+                num_rejected++;
+                continue;
+            } else {
+                turned_away[num_turned_away++] =
+                    queue_dequeue(pool->task_queue);
+                num_dropped++;
+            }
+        }
+
+        /* Add client to the task_queue */
+        queue_enqueue(pool->task_queue, conns[taken]);
+    }
 
     pthread_mutex_unlock(&(pool->mutex));
 
-    /* Send a signal to worker threads that a client task has been added */
-    pthread_cond_signal(&(pool->cond));
+    /* Turn clients away outside the lock */
+    for (size_t i = 0; i < num_turned_away; i++) {
+        pool->reject(turned_away[i]);
+    }
+
+    STAT_ADD(rejected_full, num_rejected);
+    STAT_ADD(dropped_oldest, num_dropped);
+    num_added = taken - num_rejected;
+    STAT_ADD(enqueued, num_added);
+
+    /* One wakeup for the whole batch */
+    if (num_added == 1) {
+        pthread_cond_signal(&(pool->cond));
+    } else if (num_added > 1) {
+        pthread_cond_broadcast(&(pool->cond));
+    }
+
+    return taken;
+}
+
+/* Add a batch of clients */
+void add_clients_work(thread_pool *pool, connection_t *const *conns,
+                      size_t count) {
+    size_t chunk;
+
+    while (count > 0) {
+        chunk = count < POOL_MAX_BATCH ? count : POOL_MAX_BATCH;
+        add_batch(pool, conns, chunk, false);
+
+        conns += chunk;
+        count -= chunk;
+    }
+
+    return;
+}
+
+/* Add as many clients as the queue has room for */
+size_t add_clients_fitting(thread_pool *pool, connection_t *const *conns,
+                           size_t count) {
+    size_t chunk, taken, total = 0;
+
+    while (count > 0) {
+        chunk = count < POOL_MAX_BATCH ? count : POOL_MAX_BATCH;
+        taken = add_batch(pool, conns, chunk, true);
+        total += taken;
+
+        if (taken < chunk) {
+            break;
+        }
+        conns += chunk;
+        count -= chunk;
+    }
+
+    return total;
+}
+
+/* Decides whether a task waited too long to be worth serving */
+/* Must be called with the pool mutex held */
+static bool should_shed(thread_pool *pool, uint64_t now, uint64_t wait) {
+    if (pool->target == 0) {
+        return false;
+    }
+
+    /* Track the smallest delay seen during this interval */
+    if (wait < pool->min_wait) {
+        pool->min_wait = wait;
+    }
+
+    /* At the end of each interval, a minimum above target means the queue -
+       never drained, so it is a standing queue rather than a burst */
+    if (now >= pool->interval_end) {
+        pool->overloaded = pool->min_wait != UINT64_MAX &&
+                           pool->min_wait > pool->target;
+        pool->min_wait = UINT64_MAX;
+        pool->interval_end = now + pool->interval;
+    }
+
+    return pool->overloaded && wait > pool->target;
 }
 
 /* Processes client request for a file */
 void *handle_client_request(void *args) {
-    void *socket = NULL;
-    int client;
+    connection_t *conn = NULL;
+    uint64_t now, wait;
+    bool shed;
 
     /* Extract threadpool contents */
     thread_pool *pool = args;
@@ -89,21 +331,49 @@ void *handle_client_request(void *args) {
         pthread_mutex_lock(&(pool->mutex));
 
         /* waiting for work to come up */
-        while (queue_is_empty(pool->task_queue)) {
+        while (queue_is_empty(pool->task_queue) && !pool->stopping) {
             pthread_cond_wait(&(pool->cond), &(pool->mutex));
         }
 
-        /* deque first task */
-        socket = queue_dequeue(pool->task_queue);
+        /* Pool is stopping and everything queued has been served */
+        if (queue_is_empty(pool->task_queue)) {
+            pthread_mutex_unlock(&(pool->mutex));
+            break;
+        }
 
-        pthread_mutex_unlock(&(pool->mutex));
+        /* deque first client */
+        conn = queue_dequeue(pool->task_queue);
+        pool->active++;
 
-        /* Get client socket id */
-        client = *(int *)socket;
+        now = now_us();
+        wait = now - conn->enqueued;
+        shed = should_shed(pool, now, wait);
 
-        /* process client task here */
-        pool->work(client);
+        pthread_mutex_unlock(&(pool->mutex));
+
+        /* Let a blocked acceptor know there is room */
+        pthread_cond_signal(&(pool->space));
+
+        STAT_INC(dequeued);
+        STAT_ADD(queue_wait_us, wait);
+        stats_max(&stats.queue_wait_max_us, wait);
+
+        /* Client has been queued too long, its time is better spent on -
+           clients that still have a chance */
+        if (shed) {
+            STAT_INC(shed_delay);
+            pool->reject(conn);
+        } else {
+            /* process client task here */
+            pool->work(conn);
+        }
 
+        /* Let a draining server know once the last worker goes quiet */
+        pthread_mutex_lock(&(pool->mutex));
+        if (--pool->active == 0 && queue_is_empty(pool->task_queue)) {
+            pthread_cond_broadcast(&(pool->idle));
+        }
+        pthread_mutex_unlock(&(pool->mutex));
     }
 
     pthread_exit(NULL);
@@ -111,14 +381,27 @@ void *handle_client_request(void *args) {
 
 /* Clean up the thread pool */
 void cleanup_pool(thread_pool *pool) {
-    /* First unblock on threads */
+    struct timespec grace = deadline_after(POOL_STOP_GRACE_MS);
+
+    /* First unblock on threads, they leave once the queue is empty */
+    pthread_mutex_lock(&(pool->mutex));
+    pool->stopping = true;
     pthread_cond_broadcast(&(pool->cond));
+    pthread_mutex_unlock(&(pool->mutex));
 
     /* Free threads */
+    /* Anything still busy after the grace period is cancelled */
     for (size_t i = 0; i < pool->num_threads; i++) {
-        pthread_mutex_unlock(&(pool->mutex));
-        pthread_cancel(pool->threads[i]);
-        pthread_join(pool->threads[i], NULL);
+        if (pthread_timedjoin_np(pool->threads[i], NULL, &grace)) {
+            pthread_cancel(pool->threads[i]);
+            pthread_join(pool->threads[i], NULL);
+        }
+    }
+
+    /* Close anything a cancelled worker left behind, the queue doesn't -
+       own pooled connections */
+    while (!queue_is_empty(pool->task_queue)) {
+        conn_close(queue_dequeue(pool->task_queue));
     }
 
     /* Free up the the task_queue */
@@ -127,6 +410,8 @@ void cleanup_pool(thread_pool *pool) {
     /* Destroy the mutex and conditions */
     pthread_mutex_destroy(&(pool->mutex));
     pthread_cond_destroy(&(pool->cond));
+    pthread_cond_destroy(&(pool->space));
+    pthread_cond_destroy(&(pool->idle));
 
     /* Free up the thread pool */
     free(pool);
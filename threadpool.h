@@ -10,18 +10,39 @@
 #define POOL_H
 
 #include <pthread.h>
+#include <stdint.h>
 
 #include "queue.h"
+#include "conn.h"
 
 /* Maxiumum number of threads defined here */
 #define MAX_THREADS 100
 
+/* How long the acceptor waits for queue space before rechecking signals */
+#define QUEUE_WAIT_MS 100
+
+/* Most clients added under one lock */
+#define POOL_MAX_BATCH 64
+
+/* How long idle workers get to notice the pool is stopping */
+#define POOL_STOP_GRACE_MS 1000
+
 /* Function pointer used to reference process work function in server */
-typedef void (*workfunc_t)(int);
+typedef void (*workfunc_t)(connection_t *);
+
+/* Function pointer used to turn away a client the pool will not serve */
+typedef void (*rejectfunc_t)(connection_t *);
+
+/* What happens to new work when the task queue is full */
+typedef enum {
+    QUEUE_BLOCK,
+    QUEUE_REJECT,
+    QUEUE_DROP_OLDEST
+} queue_policy_t;
 
 /* Thread pool information */
 typedef struct {
-    /* Queue for holding client tasks */
+    /* Queue for holding client connections */
     Queue *task_queue;
 
     /* Worker threads */
@@ -31,24 +52,69 @@ typedef struct {
     /* Mutex variables and conditions */
     pthread_mutex_t mutex;
     pthread_cond_t cond;
+    pthread_cond_t space;
+    pthread_cond_t idle;
+
+    /* Workers currently serving a client, and whether the pool is -
+       being shut down */
+    size_t active;
+    bool stopping;
 
-    /* Work function */
+    /* Work and rejection functions */
     workfunc_t work;
+    rejectfunc_t reject;
+
+    /* Queue bound, 0 for unbounded */
+    size_t queue_limit;
+    queue_policy_t policy;
+
+    /* Delay based shedding, in microseconds, target of 0 disables it */
+    /* Once the smallest queueing delay seen over an interval stays above -
+       the target, the queue is standing and anything that waited longer -
+       than the target is shed */
+    uint64_t target;
+    uint64_t interval;
+    uint64_t interval_end;
+    uint64_t min_wait;
+    bool overloaded;
 } thread_pool;
 
 /* Create a thread pool */
-thread_pool *initialise_threadpool(workfunc_t work);
+thread_pool *initialise_threadpool(workfunc_t work, rejectfunc_t reject);
+
+/* Bound the task queue */
+void set_queue_limit(thread_pool *pool, size_t limit, queue_policy_t policy);
+
+/* Shed work once queueing delay stays above target for an interval */
+void set_queue_delay_target(thread_pool *pool, int target_ms,
+                            int interval_ms);
+
+/* Wait until the queue has room, gives up after QUEUE_WAIT_MS */
+/* Returns the free slots, 0 if there are none, SIZE_MAX if unbounded */
+size_t wait_for_queue_space(thread_pool *pool);
+
+/* Wait until nothing is queued or being served, up to timeout_ms */
+bool wait_for_idle(thread_pool *pool, int timeout_ms);
 
 /* Create worker threads */
 void create_workers(thread_pool *pool);
 
-/* Add client to stack */
-void add_client_work(thread_pool *pool, int *client);
+/* Add client to task queue */
+void add_client_work(thread_pool *pool, connection_t *conn);
+
+/* Add a batch of clients under one lock, with one wakeup */
+void add_clients_work(thread_pool *pool, connection_t *const *conns,
+                      size_t count);
+
+/* Add clients in order until the queue is full, for the block policy */
+/* Returns how many were added, the rest are still the caller's */
+size_t add_clients_fitting(thread_pool *pool, connection_t *const *conns,
+                           size_t count);
 
 /* Process a client task */
 void *handle_client_request(void *args);
 
-/* Destroy thread pool */
+/* Destroy thread pool, letting workers finish what is queued first */
 void cleanup_pool(thread_pool *pool);
 
 #endif
@@ -0,0 +1,72 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: ticker.c
+ * Purpose: ticker module. Formats the Date header once a second instead of -
+            once per response. A new header is written into a spare slot and -
+            then published by swapping an index, so readers never take a -
+            lock. The same update keeps a coarse clock for timeouts
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#include "ticker.h"
+#include "timer.h"
+
+static struct {
+    char dates[TICKER_SLOTS][DATE_HEADER_SIZE + 1];
+    atomic_uint current;
+    _Atomic uint64_t now_ms;
+} ticker;
+
+/* Render the Date header into the next slot and publish it */
+static void render_date(const struct timespec *now) {
+    unsigned next = (atomic_load(&ticker.current) + 1) % TICKER_SLOTS;
+    struct tm tm;
+
+    gmtime_r(&now->tv_sec, &tm);
+    strftime(ticker.dates[next], sizeof ticker.dates[next],
+             "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+
+    atomic_store(&ticker.current, next);
+}
+
+/* Render the first Date header */
+void ticker_init(void) {
+    atomic_init(&ticker.current, 0);
+    ticker_update();
+
+    return;
+}
+
+/* Refresh the Date header and the coarse clock */
+int ticker_update(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    render_date(&now);
+
+    atomic_store_explicit(&ticker.now_ms, timer_now_ms(),
+                          memory_order_relaxed);
+
+    /* Wake up just after the second changes, so Date is never stale */
+    return 1000 - (int)(now.tv_nsec / 1000000);
+}
+
+/* Copy the current Date header */
+/* A slot is only rewritten TICKER_SLOTS - 1 seconds after it was replaced, -
+   so a copy never sees a half written header */
+void ticker_date(char date[DATE_HEADER_SIZE]) {
+    memcpy(date, ticker.dates[atomic_load(&ticker.current)],
+           DATE_HEADER_SIZE);
+
+    return;
+}
+
+/* Coarse monotonic clock */
+uint64_t ticker_now_ms(void) {
+    return atomic_load_explicit(&ticker.now_ms, memory_order_relaxed);
+}
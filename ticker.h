@@ -0,0 +1,33 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: ticker.h
+ * Purpose: ticker header file. Defines the once a second clock shared by -
+            every thread, with a pre-formatted Date header
+ */
+
+#ifndef TICKER_H
+#define TICKER_H
+
+#include <stdint.h>
+
+/* Length of a rendered header, "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n" */
+#define DATE_HEADER_SIZE 37
+
+/* Rendered headers kept around, readers copy from the newest */
+#define TICKER_SLOTS 4
+
+/* Render the first Date header, before anything can send one */
+void ticker_init(void);
+
+/* Refresh the Date header and the coarse clock */
+/* Returns milliseconds until the next second starts */
+int ticker_update(void);
+
+/* Copy the current Date header, not NUL terminated */
+void ticker_date(char date[DATE_HEADER_SIZE]);
+
+/* Monotonic clock in milliseconds, only as fresh as the last update */
+uint64_t ticker_now_ms(void);
+
+#endif
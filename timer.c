@@ -0,0 +1,235 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: timer.c
+ * Purpose: timer wheel module. Implements a hierarchical timer wheel, where -
+            each level covers 64 times the range of the level below it
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "timer.h"
+
+#define TIMER_MASK (TIMER_SLOTS - 1)
+
+/* Longest delay the wheel can hold, in ticks */
+#define TIMER_MAX_TICKS ((UINT64_C(1) << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1)
+
+/* How long the reactor may sleep when nothing is armed */
+#define TIMER_IDLE_MS 1000
+
+/* Global timer wheel */
+/* Each slot is a circular list with a sentinel entry at its head */
+static struct {
+    pthread_mutex_t mutex;
+    timer_entry_t slots[TIMER_LEVELS][TIMER_SLOTS];
+    uint64_t start_ms;
+    uint64_t now;
+    size_t armed;
+} wheel = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+/* Monotonic clock in milliseconds */
+uint64_t timer_now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* Current tick according to the clock, may be ahead of the wheel */
+static uint64_t current_tick(void) {
+    return (timer_now_ms() - wheel.start_ms) / TIMER_TICK_MS;
+}
+
+/* Unlink an entry from whatever slot it is in */
+static void unlink_entry(timer_entry_t *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+}
+
+/* Place an entry into the slot matching its expiry */
+static void insert_entry(timer_entry_t *timer) {
+    timer_entry_t *head = NULL;
+    uint64_t delta;
+    size_t level = 0, slot;
+
+    /* Already due, goes into the slot about to be run */
+    if (timer->expires < wheel.now) {
+        timer->expires = wheel.now;
+    }
+
+    /* Clamp anything beyond the top level */
+    delta = timer->expires - wheel.now;
+    if (delta > TIMER_MAX_TICKS) {
+        delta = TIMER_MAX_TICKS;
+        timer->expires = wheel.now + delta;
+    }
+
+    /* Find the lowest level whose range covers the delay */
+    while (level < TIMER_LEVELS - 1 &&
+           delta >= (UINT64_C(1) << ((level + 1) * TIMER_SLOT_BITS))) {
+        level++;
+    }
+
+    slot = (timer->expires >> (level * TIMER_SLOT_BITS)) & TIMER_MASK;
+    head = &wheel.slots[level][slot];
+
+    /* Append to the end of the slot */
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+/* Redistribute one slot of a higher level into the levels below */
+static void cascade(size_t level, size_t slot) {
+    timer_entry_t *head = &wheel.slots[level][slot];
+    timer_entry_t *timer = NULL;
+
+    while (head->next != head) {
+        timer = head->next;
+        unlink_entry(timer);
+        insert_entry(timer);
+    }
+}
+
+/* Run one tick of the wheel */
+static void wheel_tick(void) {
+    size_t index = wheel.now & TIMER_MASK, slot;
+    timer_entry_t *head = NULL, *timer = NULL;
+
+    /* Lowest level wrapped around, pull down the next slot of each level -
+       above it until one of them has not wrapped */
+    if (index == 0) {
+        for (size_t level = 1; level < TIMER_LEVELS; level++) {
+            slot = (wheel.now >> (level * TIMER_SLOT_BITS)) & TIMER_MASK;
+            cascade(level, slot);
+
+            if (slot != 0) {
+                break;
+            }
+        }
+    }
+
+    /* Fire everything in this slot */
+    head = &wheel.slots[0][index];
+    while (head->next != head) {
+        timer = head->next;
+        unlink_entry(timer);
+        timer->armed = false;
+        wheel.armed--;
+
+        timer->callback(timer->arg);
+    }
+
+    wheel.now++;
+}
+
+/* Initialise the global wheel */
+void timer_init(void) {
+    /* Every slot starts as an empty circular list */
+    for (size_t level = 0; level < TIMER_LEVELS; level++) {
+        for (size_t slot = 0; slot < TIMER_SLOTS; slot++) {
+            wheel.slots[level][slot].next = &wheel.slots[level][slot];
+            wheel.slots[level][slot].prev = &wheel.slots[level][slot];
+        }
+    }
+
+    wheel.start_ms = timer_now_ms();
+    wheel.now = 0;
+    wheel.armed = 0;
+
+    return;
+}
+
+/* Arm a timer */
+void timer_add(timer_entry_t *timer, int ms, timer_cb_t callback, void *arg) {
+    /* Critical section */
+    pthread_mutex_lock(&wheel.mutex);
+
+    /* Rearming moves the timer */
+    if (timer->armed) {
+        unlink_entry(timer);
+        wheel.armed--;
+    }
+
+    /* Round up so a timer never fires early */
+    timer->expires = (timer_now_ms() - wheel.start_ms + (uint64_t)ms +
+                      TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    timer->callback = callback;
+    timer->arg = arg;
+    timer->armed = true;
+
+    insert_entry(timer);
+    wheel.armed++;
+
+    pthread_mutex_unlock(&wheel.mutex);
+
+    return;
+}
+
+/* Disarm a timer */
+bool timer_cancel(timer_entry_t *timer) {
+    bool was_armed;
+
+    /* Critical section */
+    /* Callbacks run under this lock, so none can be in flight after it */
+    pthread_mutex_lock(&wheel.mutex);
+
+    was_armed = timer->armed;
+    if (was_armed) {
+        unlink_entry(timer);
+        timer->armed = false;
+        wheel.armed--;
+    }
+
+    pthread_mutex_unlock(&wheel.mutex);
+
+    return was_armed;
+}
+
+/* Catch the wheel up with the clock */
+void timer_advance(void) {
+    uint64_t target;
+
+    /* Critical section */
+    pthread_mutex_lock(&wheel.mutex);
+
+    target = current_tick();
+    while (wheel.now <= target) {
+        wheel_tick();
+    }
+
+    pthread_mutex_unlock(&wheel.mutex);
+
+    return;
+}
+
+/* Time until the next tick is due */
+int timer_next_timeout(void) {
+    uint64_t due, now;
+    int timeout;
+
+    /* Critical section */
+    pthread_mutex_lock(&wheel.mutex);
+
+    /* Nothing to fire, but still wake up now and then for timers armed -
+       by other threads in the meantime */
+    if (wheel.armed == 0) {
+        pthread_mutex_unlock(&wheel.mutex);
+        return TIMER_IDLE_MS;
+    }
+
+    due = wheel.start_ms + wheel.now * TIMER_TICK_MS;
+    now = timer_now_ms();
+    timeout = due > now ? (int)(due - now) : 0;
+
+    pthread_mutex_unlock(&wheel.mutex);
+
+    return timeout;
+}
@@ -0,0 +1,56 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: timer.h
+ * Purpose: timer wheel header file. Defines a hierarchical timer wheel used -
+            for connection deadlines
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Resolution of the wheel in milliseconds */
+#define TIMER_TICK_MS 10
+
+/* Wheel geometry, 4 levels of 64 slots covers about 46 hours */
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+
+/* Timer callback, runs on the reactor thread with the wheel lock held -
+   so it must be quick and must not call back into the wheel */
+typedef void (*timer_cb_t)(void *arg);
+
+/* Timer entry, embedded by the owner so arming never allocates */
+typedef struct timer_entry {
+    struct timer_entry *next;
+    struct timer_entry *prev;
+    uint64_t expires;
+    timer_cb_t callback;
+    void *arg;
+    bool armed;
+} timer_entry_t;
+
+/* Initialise the global wheel */
+void timer_init(void);
+
+/* Arm a timer to fire after ms milliseconds */
+void timer_add(timer_entry_t *timer, int ms, timer_cb_t callback, void *arg);
+
+/* Disarm a timer, returns false if it already fired */
+/* Once this returns the callback is guaranteed not to be running */
+bool timer_cancel(timer_entry_t *timer);
+
+/* Fire every timer that is due */
+void timer_advance(void);
+
+/* Milliseconds until the next tick is due */
+int timer_next_timeout(void);
+
+/* Monotonic clock in milliseconds */
+uint64_t timer_now_ms(void);
+
+#endif
@@ -0,0 +1,480 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: tls.c
+ * Purpose: TLS module. OpenSSL runs the handshake on the worker, with a -
+            session cache and tickets for resumption, then hands the record -
+            layer to the kernel with kTLS. The socket then carries plaintext -
+            as far as the server is concerned, so sendfile() and splice() -
+            keep working for encrypted bodies. Where the kernel can't take -
+            both directions, a relay thread moves records between OpenSSL -
+            and a socketpair whose other end takes over the client's fd
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "tls.h"
+#include "config.h"
+#include "timer.h"
+#include "stats.h"
+#include "http.h"
+#include "io.h"
+
+/* Protocols offered in ALPN, most preferred first */
+static const unsigned char alpn_h2[] = "\x02h2\x08http/1.1";
+static const unsigned char alpn_http1[] = "\x08http/1.1";
+
+/* A connection whose records the kernel couldn't take */
+typedef struct relay {
+    SSL *ssl;
+    int tcp;
+    int local;
+
+    /* Decrypted, waiting for the worker */
+    char to_local[TLS_RELAY_BUFFER];
+    size_t to_local_start;
+    size_t to_local_end;
+
+    /* From the worker, waiting to be encrypted */
+    /* Retried from the same buffer after SSL_write() wants I/O */
+    char to_tls[TLS_RELAY_BUFFER];
+    size_t to_tls_length;
+
+    /* What OpenSSL is waiting on, the opposite way round from usual */
+    bool read_wants_write;
+    bool write_wants_read;
+
+    bool tls_eof;
+    bool local_eof;
+    bool done;
+
+    /* Finished relays are freed once a batch of events is handled */
+    struct relay *next_dead;
+} relay_t;
+
+static struct {
+    SSL_CTX *ctx;
+    int epoll_fd;
+    pthread_t thread;
+} tls;
+
+/* Print what OpenSSL has queued up about an error */
+static void print_tls_error(const char *what) {
+    fprintf(stderr, "%s\n", what);
+    ERR_print_errors_fp(stderr);
+}
+
+/* Pick HTTP/2 when both sides speak it */
+static int select_protocol(SSL *ssl, const unsigned char **out,
+                           unsigned char *out_length, const unsigned char *in,
+                           unsigned int in_length, void *arg) {
+    const unsigned char *offer = config.http2 ? alpn_h2 : alpn_http1;
+    unsigned int offer_length = config.http2 ? sizeof alpn_h2 - 1
+                                             : sizeof alpn_http1 - 1;
+
+    (void)ssl;
+    (void)arg;
+
+    if (SSL_select_next_proto((unsigned char **)out, out_length, offer,
+                              offer_length, in, in_length) ==
+        OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_OK;
+    }
+
+    /* Nothing in common, carry on without ALPN */
+    return SSL_TLSEXT_ERR_NOACK;
+}
+
+/* Work out what a relay's fds wait for */
+static void update_interest(relay_t *relay) {
+    struct epoll_event event;
+
+    memset(&event, '\0', sizeof event);
+    event.data.ptr = relay;
+
+    /* Read records while there's room to decrypt them into */
+    if ((!relay->tls_eof && relay->to_local_end == 0) ||
+        relay->write_wants_read) {
+        event.events |= EPOLLIN;
+    }
+    if (relay->read_wants_write || relay->to_tls_length > 0) {
+        event.events |= EPOLLOUT;
+    }
+    epoll_ctl(tls.epoll_fd, EPOLL_CTL_MOD, relay->tcp, &event);
+
+    event.events = 0;
+    if (!relay->local_eof && relay->to_tls_length == 0) {
+        event.events |= EPOLLIN;
+    }
+    if (relay->to_local_end > relay->to_local_start) {
+        event.events |= EPOLLOUT;
+    }
+    epoll_ctl(tls.epoll_fd, EPOLL_CTL_MOD, relay->local, &event);
+}
+
+/* Decrypt from the client and pass it on to the worker */
+/* Returns true if anything moved */
+static bool relay_to_local(relay_t *relay) {
+    bool progress = false;
+    ssize_t written;
+    int bytes;
+
+    if (!relay->tls_eof && relay->to_local_end == 0) {
+        relay->read_wants_write = false;
+
+        bytes = SSL_read(relay->ssl, relay->to_local, sizeof relay->to_local);
+        if (bytes > 0) {
+            relay->to_local_start = 0;
+            relay->to_local_end = (size_t)bytes;
+            progress = true;
+        } else {
+            switch (SSL_get_error(relay->ssl, bytes)) {
+            case SSL_ERROR_WANT_READ:
+                break;
+            case SSL_ERROR_WANT_WRITE:
+                relay->read_wants_write = true;
+                break;
+            case SSL_ERROR_ZERO_RETURN:
+                relay->tls_eof = true;
+                break;
+            default:
+                relay->done = true;
+                return false;
+            }
+        }
+    }
+
+    if (relay->to_local_end > relay->to_local_start) {
+        written = write(relay->local, relay->to_local + relay->to_local_start,
+                        relay->to_local_end - relay->to_local_start);
+        if (written > 0) {
+            relay->to_local_start += (size_t)written;
+            progress = true;
+        } else if (written == ERROR && errno != EAGAIN && errno != EINTR) {
+            /* Worker is gone */
+            relay->done = true;
+            return false;
+        }
+
+        if (relay->to_local_start == relay->to_local_end) {
+            relay->to_local_start = 0;
+            relay->to_local_end = 0;
+        }
+    }
+
+    /* Client finished sending, so the worker reads end of file */
+    if (relay->tls_eof && relay->to_local_end == 0) {
+        shutdown(relay->local, SHUT_WR);
+    }
+
+    return progress;
+}
+
+/* Encrypt what the worker wrote and send it to the client */
+/* Returns true if anything moved */
+static bool relay_to_tls(relay_t *relay) {
+    bool progress = false;
+    ssize_t bytes;
+    int written;
+
+    if (!relay->local_eof && relay->to_tls_length == 0) {
+        bytes = read(relay->local, relay->to_tls, sizeof relay->to_tls);
+        if (bytes > 0) {
+            relay->to_tls_length = (size_t)bytes;
+            progress = true;
+        } else if (bytes == 0) {
+            relay->local_eof = true;
+        } else if (errno != EAGAIN && errno != EINTR) {
+            relay->local_eof = true;
+        }
+    }
+
+    if (relay->to_tls_length > 0) {
+        relay->write_wants_read = false;
+
+        written = SSL_write(relay->ssl, relay->to_tls,
+                            (int)relay->to_tls_length);
+        if (written > 0) {
+            relay->to_tls_length = 0;
+            progress = true;
+        } else {
+            switch (SSL_get_error(relay->ssl, written)) {
+            case SSL_ERROR_WANT_WRITE:
+                break;
+            case SSL_ERROR_WANT_READ:
+                relay->write_wants_read = true;
+                break;
+            default:
+                /* Client is gone */
+                relay->done = true;
+                return false;
+            }
+        }
+    }
+
+    return progress;
+}
+
+/* Move everything that can move, both ways */
+static void pump(relay_t *relay) {
+    bool progress;
+
+    do {
+        progress = relay_to_local(relay);
+        if (!relay->done) {
+            progress = relay_to_tls(relay) || progress;
+        }
+    } while (progress && !relay->done);
+
+    /* Worker closed the connection and all of it went out */
+    if (relay->local_eof && relay->to_tls_length == 0) {
+        SSL_shutdown(relay->ssl);
+        relay->done = true;
+    }
+
+    if (!relay->done) {
+        update_interest(relay);
+    }
+}
+
+/* Tear a relay down, its events are already handled */
+static void free_relay(relay_t *relay) {
+    epoll_ctl(tls.epoll_fd, EPOLL_CTL_DEL, relay->tcp, NULL);
+    epoll_ctl(tls.epoll_fd, EPOLL_CTL_DEL, relay->local, NULL);
+
+    SSL_free(relay->ssl);
+    close(relay->tcp);
+    close(relay->local);
+    free(relay);
+}
+
+/* Relay thread */
+/* Both fds of a relay point at it, so one batch can name it twice and -
+   frees wait until the batch is done */
+static void *relay_loop(void *args) {
+    struct epoll_event events[TLS_RELAY_MAX_EVENTS];
+    relay_t *relay = NULL, *dead = NULL;
+    int ready;
+
+    (void)args;
+
+    while (true) {
+        ready = epoll_wait(tls.epoll_fd, events, TLS_RELAY_MAX_EVENTS, -1);
+        if (ready == ERROR) {
+            if (errno != EINTR) {
+                perror("Error: epoll_wait() failed on TLS relays");
+            }
+            continue;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            relay = events[i].data.ptr;
+            if (relay->done) {
+                continue;
+            }
+
+            pump(relay);
+
+            if (relay->done) {
+                relay->next_dead = dead;
+                dead = relay;
+            }
+        }
+
+        while (dead) {
+            relay = dead;
+            dead = relay->next_dead;
+            free_relay(relay);
+        }
+    }
+
+    pthread_exit(NULL);
+}
+
+/* Load the certificate and start the relay thread */
+void tls_init(const char *cert, const char *key) {
+    sigset_t all, old;
+
+    tls.ctx = SSL_CTX_new(TLS_server_method());
+    if (!tls.ctx) {
+        print_tls_error("Error: SSL_CTX_new() failed");
+        exit(EXIT_FAILURE);
+    }
+
+    SSL_CTX_set_min_proto_version(tls.ctx, TLS1_2_VERSION);
+
+    /* Let the kernel take the record layer once the handshake is done, -
+       and treat a client hanging up like close_notify */
+    SSL_CTX_set_options(tls.ctx, SSL_OP_ENABLE_KTLS |
+                                 SSL_OP_IGNORE_UNEXPECTED_EOF);
+
+    if (SSL_CTX_use_certificate_chain_file(tls.ctx, cert) != 1 ||
+        SSL_CTX_use_PrivateKey_file(tls.ctx, key, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(tls.ctx) != 1) {
+        print_tls_error("Error: cannot load TLS certificate and key");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Returning clients skip the full handshake, through the session -
+       cache for TLS 1.2 session IDs, or stateless tickets */
+    SSL_CTX_set_session_cache_mode(tls.ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(tls.ctx, TLS_SESSION_CACHE_SIZE);
+    SSL_CTX_set_timeout(tls.ctx, TLS_SESSION_TIMEOUT);
+    SSL_CTX_set_session_id_context(tls.ctx, (const unsigned char *)"server",
+                                   strlen("server"));
+
+    SSL_CTX_set_alpn_select_cb(tls.ctx, select_protocol, NULL);
+
+    tls.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (tls.epoll_fd == ERROR) {
+        perror("Error: epoll_create1() failed for TLS relays");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Signals are meant for the acceptor, keep them off this thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    if (pthread_create(&tls.thread, NULL, relay_loop, NULL)) {
+        perror("Error: cannot create TLS relay thread");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    return;
+}
+
+/* Hand a connection the kernel couldn't take to the relay thread */
+/* The socketpair end is put in place of the client's fd, so the -
+   connection keeps its descriptor number and connection limit slot */
+static bool start_relay(connection_t *conn, SSL *ssl) {
+    struct epoll_event event;
+    relay_t *relay = NULL;
+    int pair[2], tcp;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0,
+                   pair) == ERROR) {
+        perror("Error: socketpair() failed for TLS relay");
+        return false;
+    }
+
+    tcp = fcntl(conn->fd, F_DUPFD_CLOEXEC, 0);
+    if (tcp == ERROR || dup3(pair[0], conn->fd, O_CLOEXEC) == ERROR) {
+        perror("Error: cannot move client to TLS relay");
+        if (tcp != ERROR) {
+            close(tcp);
+        }
+        close(pair[0]);
+        close(pair[1]);
+        return false;
+    }
+    close(pair[0]);
+
+    relay = calloc(1, sizeof *relay);
+    if (!relay) {
+        perror("Error: calloc() failed to allocate TLS relay");
+        exit(EXIT_FAILURE);
+    }
+
+    relay->ssl = ssl;
+    relay->tcp = tcp;
+    relay->local = pair[1];
+    SSL_set_fd(ssl, tcp);
+
+    conn->relayed = true;
+
+    /* Writable straight away, so the first pump picks up anything -
+       OpenSSL already decrypted during the handshake */
+    memset(&event, '\0', sizeof event);
+    event.data.ptr = relay;
+    event.events = EPOLLIN | EPOLLOUT;
+    epoll_ctl(tls.epoll_fd, EPOLL_CTL_ADD, tcp, &event);
+
+    event.events = EPOLLIN;
+    epoll_ctl(tls.epoll_fd, EPOLL_CTL_ADD, relay->local, &event);
+
+    return true;
+}
+
+/* Run the handshake */
+bool tls_handshake(connection_t *conn) {
+    SSL *ssl = NULL;
+    int result;
+    bool ok = true;
+
+    ssl = SSL_new(tls.ctx);
+    if (!ssl || SSL_set_fd(ssl, conn->fd) != 1) {
+        print_tls_error("Error: cannot set up TLS connection");
+        SSL_free(ssl);
+        return false;
+    }
+
+    /* Handshake counts against the header deadline */
+    timer_add(&conn->timer, config.header_timeout, conn_expired, conn);
+
+    while (ok && (result = SSL_accept(ssl)) != 1) {
+        switch (SSL_get_error(ssl, result)) {
+        case SSL_ERROR_WANT_READ:
+            ok = io_wait(conn->fd, POLLIN);
+            break;
+        case SSL_ERROR_WANT_WRITE:
+            ok = io_wait(conn->fd, POLLOUT);
+            break;
+        default:
+            /* Scanners and plain HTTP clients end up here, not worth a -
+               message each */
+            ok = false;
+        }
+    }
+
+    timer_cancel(&conn->timer);
+
+    if (!ok) {
+        SSL_free(ssl);
+        return false;
+    }
+
+    conn->handshake_pending = false;
+    STAT_INC(tls_handshakes);
+    if (SSL_session_reused(ssl)) {
+        STAT_INC(tls_resumed);
+    }
+
+    /* Kernel has both directions, the fd is plaintext from here on */
+    if (BIO_get_ktls_send(SSL_get_wbio(ssl)) &&
+        BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+        STAT_INC(tls_offloaded);
+        conn->tls = ssl;
+        return true;
+    }
+
+    if (!start_relay(conn, ssl)) {
+        SSL_free(ssl);
+        return false;
+    }
+
+    return true;
+}
+
+/* Say goodbye on an offloaded connection */
+void tls_close(connection_t *conn) {
+    /* Best effort, the socket is non-blocking and about to close */
+    SSL_shutdown(conn->tls);
+    SSL_free(conn->tls);
+    conn->tls = NULL;
+
+    return;
+}
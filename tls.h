@@ -0,0 +1,38 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: tls.h
+ * Purpose: TLS header file. Defines TLS termination for clients of TLS -
+            listeners, offloaded to the kernel where it can be
+ */
+
+#ifndef TLS_H
+#define TLS_H
+
+#include <stdbool.h>
+
+#include "conn.h"
+
+/* Sessions remembered for resumption, and for how long, in seconds */
+#define TLS_SESSION_CACHE_SIZE 20480
+#define TLS_SESSION_TIMEOUT 300
+
+/* Bytes buffered each way for a relayed connection, one TLS record */
+#define TLS_RELAY_BUFFER 16384
+
+/* Most relay events handled per wakeup */
+#define TLS_RELAY_MAX_EVENTS 64
+
+/* Load the certificate chain and key, and start the relay thread */
+/* Exits if either can't be loaded */
+void tls_init(const char *cert, const char *key);
+
+/* Run the handshake on a worker, under the header deadline */
+/* Afterwards conn->fd carries plaintext, either through kTLS or through -
+   the relay. Returns false if the handshake failed */
+bool tls_handshake(connection_t *conn);
+
+/* Send close_notify on an offloaded connection and free its state */
+void tls_close(connection_t *conn);
+
+#endif
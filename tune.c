@@ -0,0 +1,97 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: tune.c
+ * Purpose: socket tuning module. Applies the configured TCP options. A -
+            failed option only costs performance, so failures are reported -
+            and otherwise ignored
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "tune.h"
+#include "config.h"
+#include "http.h"
+
+/* Set an integer socket option, reporting failure */
+static void set_option(int sock, int level, int name, int value,
+                       const char *what) {
+    if (setsockopt(sock, level, name, &value, sizeof value) == ERROR) {
+        perror(what);
+    }
+}
+
+/* Work out the backlog */
+int tune_backlog(int requested) {
+    FILE *file = NULL;
+    int somaxconn = SOMAXCONN;
+
+    if (requested > 0) {
+        return requested;
+    }
+
+    /* Fall back to the compile time cap if procfs isn't there */
+    file = fopen(SOMAXCONN_PATH, "r");
+    if (file) {
+        if (fscanf(file, "%d", &somaxconn) != 1 || somaxconn <= 0) {
+            somaxconn = SOMAXCONN;
+        }
+        fclose(file);
+    }
+
+    return somaxconn;
+}
+
+/* Apply listener options */
+void tune_listener(int sock) {
+    /* Only hand over connections once the request has started arriving, -
+       so accept() never wakes for a client that stays silent */
+    if (config.defer_accept > 0) {
+        set_option(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, config.defer_accept,
+                   "Error: setting TCP_DEFER_ACCEPT");
+    }
+
+    /* Returning clients can send the request in the SYN */
+    if (config.fastopen > 0) {
+        set_option(sock, IPPROTO_TCP, TCP_FASTOPEN, config.fastopen,
+                   "Error: setting TCP_FASTOPEN");
+    }
+
+    /* Accepted sockets inherit this, and the window scale it implies is -
+       only negotiated if it is set before the handshake */
+    if (config.rcvbuf > 0) {
+        set_option(sock, SOL_SOCKET, SO_RCVBUF, config.rcvbuf,
+                   "Error: setting SO_RCVBUF");
+    }
+
+    return;
+}
+
+/* Apply per client options */
+void tune_client(int client) {
+    /* Responses are written in as few calls as possible, never wait on -
+       Nagle for the last partial frame */
+    set_option(client, IPPROTO_TCP, TCP_NODELAY, 1,
+               "Error: setting TCP_NODELAY");
+
+    if (config.sndbuf > 0) {
+        set_option(client, SOL_SOCKET, SO_SNDBUF, config.sndbuf,
+                   "Error: setting SO_SNDBUF");
+    }
+
+    return;
+}
+
+/* Cork or uncork a client */
+void tune_cork(const connection_t *conn, bool corked) {
+    if (config.cork && conn->peer.ss_family != AF_UNIX && !conn->relayed) {
+        set_option(conn->fd, IPPROTO_TCP, TCP_CORK, corked,
+                   "Error: setting TCP_CORK");
+    }
+
+    return;
+}
@@ -0,0 +1,34 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: tune.h
+ * Purpose: socket tuning header file. Defines the TCP options applied to -
+            the listening socket and to every client
+ */
+
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stdbool.h>
+
+#include "conn.h"
+
+/* Where the kernel cap on listen() backlogs lives */
+#define SOMAXCONN_PATH "/proc/sys/net/core/somaxconn"
+
+/* Backlog to ask for, 0 takes the kernel cap */
+/* Anything above the cap is silently cut down by the kernel anyway */
+int tune_backlog(int requested);
+
+/* Apply listener options, before or after listen() */
+void tune_listener(int sock);
+
+/* Apply per client options to a freshly accepted socket */
+void tune_client(int client);
+
+/* Hold back partial frames while headers and body are written */
+/* Uncorking pushes out whatever is left straight away */
+/* Unix socket clients are left alone */
+void tune_cork(const connection_t *conn, bool corked);
+
+#endif
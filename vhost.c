@@ -0,0 +1,265 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: vhost.c
+ * Purpose: virtual host module. Maps normalized Host header values to -
+            sites through an open addressed hash table filled at startup, -
+            so picking a site is one hash and one compare. The site is -
+            kept per thread, and the webroot and caches partition by it
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vhost.h"
+#include "http.h"
+
+/* One site */
+typedef struct {
+    char name[VHOST_NAME_SIZE];
+    const char *webroot;
+    size_t cache_budget;
+
+    /* Extensions served as something other than the built in type */
+    struct {
+        const char *extension;
+        const char *mime_type;
+    } mime[VHOST_MAX_MIME];
+    int num_mime;
+} vhost_t;
+
+static vhost_t hosts[MAX_VHOSTS];
+static int num_hosts = 0;
+
+/* Name hash to host, ERROR marks a free slot */
+static struct {
+    uint32_t hash;
+    int host;
+} slots[VHOST_SLOTS];
+
+/* Site the calling worker is serving */
+static __thread int current = VHOST_DEFAULT;
+
+/* FNV-1a hash of a normalized name */
+static uint32_t hash_name(const char *name) {
+    uint32_t hash = UINT32_C(2166136261);
+
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= UINT32_C(16777619);
+    }
+
+    return hash;
+}
+
+/* Normalize a host name, lowercase without a port or trailing dot */
+/* Returns false if nothing is left or it doesn't fit */
+static bool normalize_name(const char *name, size_t length,
+                           char out[VHOST_NAME_SIZE]) {
+    const char *end = name + length, *search = name, *colon = NULL;
+
+    /* IPv6 literals keep their colons inside the brackets */
+    if (length > 0 && name[0] == '[') {
+        search = memchr(name, ']', length);
+        if (!search) {
+            return false;
+        }
+    }
+
+    colon = memchr(search, ':', (size_t)(end - search));
+    if (colon) {
+        end = colon;
+    }
+    if (end > name && end[-1] == '.') {
+        end--;
+    }
+
+    length = (size_t)(end - name);
+    if (length == 0 || length >= VHOST_NAME_SIZE) {
+        return false;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        out[i] = name[i] >= 'A' && name[i] <= 'Z'
+                     ? (char)(name[i] + ('a' - 'A'))
+                     : name[i];
+    }
+    out[length] = '\0';
+
+    return true;
+}
+
+/* Find the host serving a normalized name */
+/* Returns ERROR if none does */
+static int find_host(const char *name) {
+    uint32_t hash = hash_name(name), slot = hash & (VHOST_SLOTS - 1);
+    int host;
+
+    while ((host = slots[slot].host) != ERROR) {
+        if (slots[slot].hash == hash && strcmp(hosts[host].name, name) == 0) {
+            return host;
+        }
+        slot = (slot + 1) & (VHOST_SLOTS - 1);
+    }
+
+    return ERROR;
+}
+
+/* Add a name to the table */
+static void insert_host(int host) {
+    uint32_t hash = hash_name(hosts[host].name);
+    uint32_t slot = hash & (VHOST_SLOTS - 1);
+
+    while (slots[slot].host != ERROR) {
+        slot = (slot + 1) & (VHOST_SLOTS - 1);
+    }
+
+    slots[slot].hash = hash;
+    slots[slot].host = host;
+
+    return;
+}
+
+/* Apply one ,cache=N or ,.EXT=TYPE option of a spec */
+/* Returns false if it isn't either */
+static bool parse_option(vhost_t *host, char *option) {
+    char *equals = strchr(option, '='), *end = NULL;
+    long budget;
+
+    if (!equals || equals[1] == '\0') {
+        return false;
+    }
+    *equals = '\0';
+
+    if (strcmp(option, "cache") == 0) {
+        budget = strtol(equals + 1, &end, 10);
+        if (*end != '\0' || budget < 0) {
+            return false;
+        }
+        host->cache_budget = (size_t)budget;
+        return true;
+    }
+
+    if (option[0] != '.' || host->num_mime == VHOST_MAX_MIME) {
+        return false;
+    }
+
+    host->mime[host->num_mime].extension = option;
+    host->mime[host->num_mime].mime_type = equals + 1;
+    host->num_mime++;
+
+    return true;
+}
+
+/* Register the sites */
+void vhost_init(const char *webroot, const char *const *specs, int count,
+                size_t default_budget) {
+    char *copy = NULL, *saveptr = NULL, *token = NULL, *equals = NULL;
+    vhost_t *host = NULL;
+
+    for (size_t i = 0; i < VHOST_SLOTS; i++) {
+        slots[i].host = ERROR;
+    }
+
+    /* Default site has no name, it's what unknown names fall back to */
+    hosts[VHOST_DEFAULT].webroot = webroot;
+    hosts[VHOST_DEFAULT].cache_budget = default_budget;
+    num_hosts = 1;
+
+    for (int i = 0; i < count; i++) {
+        host = &hosts[num_hosts];
+        host->cache_budget = default_budget;
+
+        /* Options point into the copy, it lives as long as the server */
+        copy = strdup(specs[i]);
+        if (!copy) {
+            perror("Error: strdup() failed to copy virtual host");
+            exit(EXIT_FAILURE);
+        }
+
+        token = strtok_r(copy, ",", &saveptr);
+        equals = token ? strchr(token, '=') : NULL;
+        if (!equals || equals[1] == '\0' ||
+            !normalize_name(token, (size_t)(equals - token), host->name)) {
+            fprintf(stderr, "Error: cannot parse virtual host %s, expected "
+                            "NAME=PATH[,cache=N][,.EXT=TYPE]\n", specs[i]);
+            exit(EXIT_FAILURE);
+        }
+        host->webroot = equals + 1;
+
+        while ((token = strtok_r(NULL, ",", &saveptr))) {
+            if (!parse_option(host, token)) {
+                fprintf(stderr, "Error: cannot parse options of virtual "
+                                "host %s\n", specs[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        if (find_host(host->name) != ERROR) {
+            fprintf(stderr, "Error: virtual host %s given twice\n",
+                    host->name);
+            exit(EXIT_FAILURE);
+        }
+
+        insert_host(num_hosts++);
+    }
+
+    return;
+}
+
+/* Number of hosts */
+int vhost_count(void) {
+    return num_hosts;
+}
+
+/* Webroot of a host */
+const char *vhost_webroot(int host) {
+    return hosts[host].webroot;
+}
+
+/* Cache budget of a host */
+size_t vhost_cache_budget(int host) {
+    return hosts[host].cache_budget;
+}
+
+/* Pick the host for a request */
+void vhost_select(const char *name, size_t length) {
+    char normalized[VHOST_NAME_SIZE];
+    int host = ERROR;
+
+    if (num_hosts > 1 && name && normalize_name(name, length, normalized)) {
+        host = find_host(normalized);
+    }
+
+    current = host == ERROR ? VHOST_DEFAULT : host;
+
+    return;
+}
+
+/* Host this thread serves */
+int vhost_current(void) {
+    return current;
+}
+
+/* Switch the host this thread serves */
+void vhost_set_current(int host) {
+    current = host;
+
+    return;
+}
+
+/* MIME override of the current host */
+const char *vhost_mime_type(const char *extension) {
+    const vhost_t *host = &hosts[current];
+
+    for (int i = 0; i < host->num_mime; i++) {
+        if (strcmp(host->mime[i].extension, extension) == 0) {
+            return host->mime[i].mime_type;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,53 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: vhost.h
+ * Purpose: virtual host header file. Defines the sites served by one -
+            process, each with its own webroot, MIME overrides and cache -
+            budget, and the host each worker is currently serving
+ */
+
+#ifndef VHOST_H
+#define VHOST_H
+
+#include <stddef.h>
+
+/* Most sites served at once, the default one included */
+#define MAX_VHOSTS 64
+
+/* Slots in the name hash table, power of two well above MAX_VHOSTS */
+#define VHOST_SLOTS 256
+
+/* Longest host name, and most MIME overrides per host */
+#define VHOST_NAME_SIZE 256
+#define VHOST_MAX_MIME 16
+
+/* Host 0, serving the positional webroot and any unknown Host */
+#define VHOST_DEFAULT 0
+
+/* Register the default webroot and every NAME=PATH[,cache=N][,.EXT=TYPE] */
+/* Exits on a spec it can't parse */
+void vhost_init(const char *webroot, const char *const *specs, int count,
+                size_t default_budget);
+
+/* Number of hosts, the default one included */
+int vhost_count(void);
+
+/* Webroot and metadata cache budget of a host */
+const char *vhost_webroot(int host);
+size_t vhost_cache_budget(int host);
+
+/* Serve a request for the Host header value given, on this thread */
+/* Case, a port and a trailing dot are ignored, unknown names and a -
+   missing header get the default host */
+void vhost_select(const char *name, size_t length);
+
+/* Host this thread is serving, and switching it directly */
+int vhost_current(void);
+void vhost_set_current(int host);
+
+/* MIME type the current host serves an extension as */
+/* Returns NULL if it doesn't override it */
+const char *vhost_mime_type(const char *extension);
+
+#endif
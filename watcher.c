@@ -0,0 +1,310 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: watcher.c
+ * Purpose: webroot watcher module. Watches every directory under the -
+            webroot with inotify and invalidates cache entries for exactly -
+            the paths that changed. Webroots of virtual hosts can overlap, -
+            so a watch remembers every host that reaches its directory
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "watcher.h"
+#include "filecache.h"
+#include "webroot.h"
+#include "mapcache.h"
+#include "http.h"
+#include "vhost.h"
+
+/* Everything that can change what a cached path refers to */
+#define WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | \
+                    IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                    IN_DELETE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+/* One host's name for a watched directory, relative to its webroot */
+typedef struct watch_dir {
+    int host;
+    char *dir;
+    struct watch_dir *next;
+} watch_dir_t;
+
+static struct {
+    int inotify_fd;
+
+    /* Directories of each watch, by descriptor */
+    watch_dir_t **dirs;
+    size_t num_dirs;
+
+    pthread_t thread;
+} watcher;
+
+/* Stop caching, the watcher can no longer keep caches fresh */
+static void disable_caches(void) {
+    filecache_enable(false);
+    webroot_enable_dircache(false);
+    mapcache_enable(false);
+}
+
+/* Free the directories of a watch */
+static void clear_dirs(int wd) {
+    watch_dir_t *node = NULL;
+
+    while ((node = watcher.dirs[wd])) {
+        watcher.dirs[wd] = node->next;
+        free(node->dir);
+        free(node);
+    }
+}
+
+/* Remember which directory of a host a watch descriptor belongs to */
+static void set_dir(int wd, int host, const char *dir) {
+    watch_dir_t **grown = NULL, *node = NULL;
+    size_t size;
+
+    /* Watch descriptors are small and increasing, index by them directly */
+    if ((size_t)wd >= watcher.num_dirs) {
+        size = (size_t)wd * 2 + 16;
+        grown = realloc(watcher.dirs, size * sizeof *grown);
+        if (!grown) {
+            perror("Error: realloc() failed to grow watch table");
+            exit(EXIT_FAILURE);
+        }
+
+        memset(grown + watcher.num_dirs, '\0',
+               (size - watcher.num_dirs) * sizeof *grown);
+        watcher.dirs = grown;
+        watcher.num_dirs = size;
+    }
+
+    /* Same directory moved within the tree keeps its descriptor */
+    for (node = watcher.dirs[wd]; node; node = node->next) {
+        if (node->host == host) {
+            break;
+        }
+    }
+
+    if (!node) {
+        node = malloc(sizeof *node);
+        if (!node) {
+            perror("Error: malloc() failed to allocate watch directory");
+            exit(EXIT_FAILURE);
+        }
+        node->host = host;
+        node->next = watcher.dirs[wd];
+        watcher.dirs[wd] = node;
+    } else {
+        free(node->dir);
+    }
+
+    node->dir = strdup(dir);
+    if (!node->dir) {
+        perror("Error: strdup() failed to copy directory");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Watch a directory of a host and everything below it */
+/* Returns false if the kernel refused a watch */
+static bool watch_tree(int host, const char *dir) {
+    char path[PATH_MAX], child[PATH_MAX];
+    struct dirent *entry = NULL;
+    struct stat info;
+    DIR *handle = NULL;
+    bool ok = true;
+    int wd;
+
+    snprintf(path, sizeof path, "%s%s", vhost_webroot(host), dir);
+
+    wd = inotify_add_watch(watcher.inotify_fd, path, WATCH_MASK);
+    if (wd == ERROR) {
+        /* Already gone again, nothing to watch */
+        if (errno == ENOENT || errno == ENOTDIR) {
+            return true;
+        }
+
+        perror("Error: inotify_add_watch() failed");
+        return false;
+    }
+
+    set_dir(wd, host, dir);
+
+    handle = opendir(path);
+    if (!handle) {
+        return true;
+    }
+
+    while (ok && (entry = readdir(handle))) {
+        if (strcmp(entry->d_name, ".") == 0 ||
+            strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        if ((size_t)snprintf(child, sizeof child, "%s/%s", dir,
+                             entry->d_name) >= sizeof child) {
+            continue;
+        }
+
+        /* Some filesystems don't fill in d_type */
+        if (entry->d_type == DT_UNKNOWN) {
+            snprintf(path, sizeof path, "%s%s", vhost_webroot(host), child);
+            if (lstat(path, &info) == ERROR || !S_ISDIR(info.st_mode)) {
+                continue;
+            }
+        } else if (entry->d_type != DT_DIR) {
+            continue;
+        }
+
+        ok = watch_tree(host, child);
+    }
+
+    closedir(handle);
+
+    return ok;
+}
+
+/* Apply one inotify event to the caches of the host a directory is of */
+/* Invalidation works on the current host, so switch to it first */
+static void handle_dir_event(const struct inotify_event *event,
+                             const watch_dir_t *node) {
+    char path[PATH_MAX];
+
+    vhost_set_current(node->host);
+
+    if (event->mask & IN_DELETE_SELF) {
+        filecache_invalidate_prefix(node->dir);
+        webroot_invalidate_prefix(node->dir);
+        mapcache_invalidate_prefix(node->dir);
+        return;
+    }
+
+    if (event->len == 0 ||
+        (size_t)snprintf(path, sizeof path, "%s/%s", node->dir,
+                         event->name) >= sizeof path) {
+        return;
+    }
+
+    if (event->mask & IN_ISDIR) {
+        /* New directory, watch it before anything in it gets cached */
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            if (!watch_tree(node->host, path)) {
+                fprintf(stderr, "Error: cannot watch %s, file caching "
+                                "disabled\n", path);
+                disable_caches();
+            }
+        }
+
+        /* A cached descriptor of a moved directory would follow it */
+        filecache_invalidate_prefix(path);
+        webroot_invalidate_prefix(path);
+        mapcache_invalidate_prefix(path);
+    } else {
+        filecache_invalidate(path);
+        mapcache_invalidate(path);
+    }
+}
+
+/* Apply one inotify event to the caches */
+static void handle_event(const struct inotify_event *event) {
+    const watch_dir_t *node = NULL;
+
+    /* Events were lost, nothing cached can be trusted */
+    if (event->mask & IN_Q_OVERFLOW) {
+        filecache_flush();
+        webroot_flush();
+        mapcache_flush();
+        return;
+    }
+
+    if (event->wd < 0 || (size_t)event->wd >= watcher.num_dirs ||
+        !watcher.dirs[event->wd]) {
+        return;
+    }
+
+    /* Watch removed by the kernel, directory is gone */
+    if (event->mask & IN_IGNORED) {
+        clear_dirs(event->wd);
+        return;
+    }
+
+    for (node = watcher.dirs[event->wd]; node; node = node->next) {
+        handle_dir_event(event, node);
+    }
+}
+
+/* Watcher thread */
+static void *watcher_loop(void *args) {
+    char buffer[WATCHER_BUFFER_SIZE]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event = NULL;
+    ssize_t length;
+
+    (void)args;
+
+    while (true) {
+        length = read(watcher.inotify_fd, buffer, sizeof buffer);
+        if (length == ERROR) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("Error: cannot read inotify events, file caching "
+                   "disabled");
+            disable_caches();
+            break;
+        }
+
+        for (char *ptr = buffer; ptr < buffer + length;
+             ptr += sizeof *event + event->len) {
+            event = (const struct inotify_event *)ptr;
+            handle_event(event);
+        }
+    }
+
+    pthread_exit(NULL);
+}
+
+/* Start watching the webroot of every host */
+bool watcher_init(void) {
+    sigset_t all, old;
+
+    watcher.dirs = NULL;
+    watcher.num_dirs = 0;
+
+    watcher.inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (watcher.inotify_fd == ERROR) {
+        perror("Error: inotify_init1() failed");
+        return false;
+    }
+
+    /* Every directory is watched before anything can be cached */
+    for (int host = 0; host < vhost_count(); host++) {
+        if (!watch_tree(host, "")) {
+            close(watcher.inotify_fd);
+            return false;
+        }
+    }
+
+    /* Signals are meant for the acceptor, keep them off this thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    if (pthread_create(&watcher.thread, NULL, watcher_loop, NULL)) {
+        perror("Error: cannot create watcher thread");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    return true;
+}
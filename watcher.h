@@ -0,0 +1,21 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: watcher.h
+ * Purpose: webroot watcher header file. Defines the inotify thread that -
+            keeps the caches in front of the webroot fresh
+ */
+
+#ifndef WATCHER_H
+#define WATCHER_H
+
+#include <stdbool.h>
+
+/* Size of the inotify read buffer */
+#define WATCHER_BUFFER_SIZE 16384
+
+/* Start watching the whole webroot tree of every virtual host */
+/* Returns false if inotify is unavailable, caches must then stay off */
+bool watcher_init(void);
+
+#endif
@@ -0,0 +1,265 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: webroot.c
+ * Purpose: webroot module. Resolves requested paths with openat2() and -
+            RESOLVE_BENEATH against the open webroot, so lookups start from -
+            the webroot instead of walking from / and can never climb out. -
+            Descriptors of recently used subdirectories are cached so deep -
+            paths are only walked once. Each virtual host has its own -
+            webroot, lookups use the one of the host being served
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+
+#include "webroot.h"
+#include "http.h"
+#include "vhost.h"
+
+/* Cached descriptor for one directory, relative to a host's webroot */
+typedef struct {
+    char *dir;
+    uint32_t hash;
+    int host;
+    int fd;
+} dir_slot_t;
+
+static struct {
+    int root_fds[MAX_VHOSTS];
+    bool use_openat2;
+    bool dircache_enabled;
+    pthread_rwlock_t lock;
+    dir_slot_t slots[DIRCACHE_SLOTS];
+} webroot = { .lock = PTHREAD_RWLOCK_INITIALIZER };
+
+/* FNV-1a hash over a host and a length limited string */
+static uint32_t hash_dir(int host, const char *dir, size_t length) {
+    uint32_t hash = UINT32_C(2166136261) ^ (uint32_t)host;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)dir[i];
+        hash *= UINT32_C(16777619);
+    }
+
+    return hash;
+}
+
+/* Checks for a .. component */
+static bool has_dotdot(const char *path) {
+    const char *ptr = path;
+
+    while ((ptr = strstr(ptr, ".."))) {
+        if ((ptr == path || ptr[-1] == '/') &&
+            (ptr[2] == '\0' || ptr[2] == '/')) {
+            return true;
+        }
+        ptr += 2;
+    }
+
+    return false;
+}
+
+/* Open a path beneath a directory descriptor */
+static int open_beneath(int dirfd, const char *path, int flags) {
+    struct open_how how;
+    int fd;
+
+    if (webroot.use_openat2) {
+        memset(&how, '\0', sizeof how);
+        how.flags = (uint64_t)(flags | O_CLOEXEC);
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+
+        fd = (int)syscall(SYS_openat2, dirfd, path, &how, sizeof how);
+        if (fd != ERROR || errno != ENOSYS) {
+            return fd;
+        }
+
+        /* Kernel older than 5.6 */
+        webroot.use_openat2 = false;
+    }
+
+    /* Without openat2, refuse anything that could climb out by name */
+    if (has_dotdot(path)) {
+        errno = EACCES;
+        return ERROR;
+    }
+
+    return openat(dirfd, path, flags | O_CLOEXEC);
+}
+
+/* Open the webroot of every host */
+void webroot_init(void) {
+    for (int host = 0; host < vhost_count(); host++) {
+        webroot.root_fds[host] = open(vhost_webroot(host),
+                                      O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (webroot.root_fds[host] == ERROR) {
+            fprintf(stderr, "Error: cannot open webroot %s: ",
+                    vhost_webroot(host));
+            perror(NULL);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    webroot.use_openat2 = true;
+    webroot.dircache_enabled = false;
+
+    for (size_t i = 0; i < DIRCACHE_SLOTS; i++) {
+        webroot.slots[i].dir = NULL;
+        webroot.slots[i].fd = ERROR;
+    }
+
+    return;
+}
+
+/* Turn the directory cache on or off */
+void webroot_enable_dircache(bool enabled) {
+    if (!enabled) {
+        webroot_flush();
+    }
+
+    pthread_rwlock_wrlock(&webroot.lock);
+    webroot.dircache_enabled = enabled;
+    pthread_rwlock_unlock(&webroot.lock);
+
+    return;
+}
+
+/* Empty a slot, write lock held */
+static void clear_slot(dir_slot_t *slot) {
+    if (slot->dir) {
+        close(slot->fd);
+        free(slot->dir);
+        slot->dir = NULL;
+        slot->fd = ERROR;
+    }
+}
+
+/* Open a URI relative to the webroot */
+int webroot_open(const char *uri, int flags) {
+    char dir[PATH_MAX];
+    const char *relative = NULL, *base = NULL, *slash = NULL;
+    dir_slot_t *slot = NULL;
+    size_t length;
+    uint32_t hash;
+    int host = vhost_current(), dirfd, fd;
+
+    /* Relative to the webroot, RESOLVE_BENEATH refuses absolute paths */
+    relative = uri + strspn(uri, "/");
+    if (*relative == '\0') {
+        relative = ".";
+    }
+
+    /* Files directly in the webroot need no directory descriptor */
+    slash = strrchr(relative, '/');
+    if (!slash || !webroot.dircache_enabled) {
+        return open_beneath(webroot.root_fds[host], relative, flags);
+    }
+
+    length = (size_t)(slash - relative);
+    base = *(slash + 1) ? slash + 1 : ".";
+    hash = hash_dir(host, relative, length);
+    slot = &webroot.slots[hash & (DIRCACHE_SLOTS - 1)];
+
+    /* Hit, walk only the last component */
+    /* The read lock keeps the descriptor open until we are done with it */
+    pthread_rwlock_rdlock(&webroot.lock);
+
+    if (slot->dir && slot->hash == hash && slot->host == host &&
+        strncmp(slot->dir, relative, length) == 0 &&
+        slot->dir[length] == '\0') {
+        fd = open_beneath(slot->fd, base, flags);
+        pthread_rwlock_unlock(&webroot.lock);
+        return fd;
+    }
+
+    pthread_rwlock_unlock(&webroot.lock);
+
+    if (length >= sizeof dir) {
+        errno = ENAMETOOLONG;
+        return ERROR;
+    }
+
+    memcpy(dir, relative, length);
+    dir[length] = '\0';
+
+    /* Miss, walk the directory part once and keep it */
+    dirfd = open_beneath(webroot.root_fds[host], dir, O_PATH | O_DIRECTORY);
+    if (dirfd == ERROR) {
+        return ERROR;
+    }
+
+    fd = open_beneath(dirfd, base, flags);
+
+    pthread_rwlock_wrlock(&webroot.lock);
+
+    if (webroot.dircache_enabled) {
+        clear_slot(slot);
+
+        slot->dir = strdup(dir);
+        if (!slot->dir) {
+            perror("Error: strdup() failed to copy directory");
+            exit(EXIT_FAILURE);
+        }
+        slot->hash = hash;
+        slot->host = host;
+        slot->fd = dirfd;
+        dirfd = ERROR;
+    }
+
+    pthread_rwlock_unlock(&webroot.lock);
+
+    if (dirfd != ERROR) {
+        close(dirfd);
+    }
+
+    return fd;
+}
+
+/* Drop descriptors under a directory of the current host */
+void webroot_invalidate_prefix(const char *dir) {
+    const char *relative = dir + strspn(dir, "/");
+    size_t length = strlen(relative);
+    dir_slot_t *slot = NULL;
+    int host = vhost_current();
+
+    pthread_rwlock_wrlock(&webroot.lock);
+
+    for (size_t i = 0; i < DIRCACHE_SLOTS; i++) {
+        slot = &webroot.slots[i];
+
+        /* An empty prefix is the webroot itself, so everything goes */
+        if (slot->dir && slot->host == host &&
+            strncmp(slot->dir, relative, length) == 0 &&
+            (length == 0 || slot->dir[length] == '\0' ||
+             slot->dir[length] == '/')) {
+            clear_slot(slot);
+        }
+    }
+
+    pthread_rwlock_unlock(&webroot.lock);
+
+    return;
+}
+
+/* Drop everything */
+void webroot_flush(void) {
+    pthread_rwlock_wrlock(&webroot.lock);
+
+    for (size_t i = 0; i < DIRCACHE_SLOTS; i++) {
+        clear_slot(&webroot.slots[i]);
+    }
+
+    pthread_rwlock_unlock(&webroot.lock);
+
+    return;
+}
@@ -0,0 +1,36 @@
+/* COMP30023 Computer Systems - Semester 1 2018
+ * Assignment 1 - HTTP multi-threaded Web server
+ * Author: Armaan Dhaliwal-McLeod
+ * File: webroot.h
+ * Purpose: webroot header file. Defines path resolution relative to an open -
+            webroot directory
+ */
+
+#ifndef WEBROOT_H
+#define WEBROOT_H
+
+#include <stdbool.h>
+
+/* Number of cached directory descriptors, power of two */
+#define DIRCACHE_SLOTS 64
+
+/* Open the webroot directory of every virtual host once for the server -
+   lifetime */
+void webroot_init(void);
+
+/* Only cache directory descriptors while the watcher can keep them fresh */
+void webroot_enable_dircache(bool enabled);
+
+/* Open a URI relative to the current host's webroot, never resolving -
+   outside of it */
+/* Returns a descriptor, or ERROR with errno set */
+int webroot_open(const char *uri, int flags);
+
+/* Drop cached descriptors for a directory of the current host and -
+   everything below it */
+void webroot_invalidate_prefix(const char *dir);
+
+/* Drop every cached directory descriptor, of every host */
+void webroot_flush(void);
+
+#endif